@@ -0,0 +1,204 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <functional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+
+#include "bench.pb.h"
+#include "event_parser.pb.h"
+#include "protog_corpus.h"
+#include "protog_tape.h"
+
+namespace protog {
+namespace bench {
+
+typedef std::vector<std::string> Corpus;
+
+inline Corpus loadCorpus(const std::vector<std::string> &files) {
+    Corpus corpus;
+    for (const auto &file : files) {
+        std::ifstream in(file);
+        if (!in) {
+            fprintf(stderr, "Cannot open corpus file %s\n", file.c_str());
+            exit(1);
+        }
+        const std::string text{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+        splitDocuments(text, corpus);
+    }
+    return corpus;
+}
+
+// Builds count pseudo random protog.bench.Event documents. The same seed always yields the same corpus.
+inline Corpus makeCorpus(size_t count, unsigned seed = 42) {
+    std::mt19937 rng(seed);
+    const auto number = [&rng](int max) { return static_cast<int>(rng() % max); };
+    const auto word = [&rng, &number]() {
+        std::string w;
+        for (int i = 3 + number(10); i > 0; --i) {
+            w += static_cast<char>('a' + number(26));
+        }
+        return w;
+    };
+    Corpus corpus;
+    for (size_t i = 0; i < count; ++i) {
+        std::string json = "{\"id\": \"" + word() + "-" + std::to_string(i) + "\"";
+        json += ", \"timestamp\": " + std::to_string(1500000000000LL + number(1000000000));
+        json += ", \"type\": \"" + word() + "\"";
+        json += ", \"value\": " + std::to_string(number(100000) / 100.0);
+        json += std::string(", \"ok\": ") + (number(2) ? "true" : "false");
+        json += ", \"user\": {\"name\": \"" + word() + " " + word() + "\", \"id\": " + std::to_string(number(1000000));
+        json += std::string(", \"verified\": ") + (number(2) ? "true" : "false") + ", \"scores\": [";
+        for (int j = number(8); j > 0; --j) {
+            json += std::to_string(number(1000) / 10.0) + (j > 1 ? ", " : "");
+        }
+        json += "]}, \"items\": [";
+        for (int j = 1 + number(6); j > 0; --j) {
+            json += "{\"sku\": \"" + word() + "\", \"count\": " + std::to_string(number(100));
+            json += ", \"price\": " + std::to_string(number(100000) / 100.0) + ", \"labels\": [";
+            for (int k = number(4); k > 0; --k) {
+                json += "\"" + word() + "\"" + (k > 1 ? ", " : "");
+            }
+            json += std::string("]}") + (j > 1 ? ", " : "");
+        }
+        json += "], \"tags\": [";
+        for (int j = number(5); j > 0; --j) {
+            json += "\"" + word() + "\"" + (j > 1 ? ", " : "");
+        }
+        json += "]}";
+        corpus.push_back(json);
+    }
+    return corpus;
+}
+
+inline size_t getCorpusBytes(const Corpus &corpus) {
+    size_t bytes = 0;
+    for (const auto &json : corpus) {
+        bytes += json.size();
+    }
+    return bytes;
+}
+
+// Number of values set in msg. Each element of a repeated field counts and sub messages are counted
+// recursively, so this roughly equals the number of json values the parser had to handle.
+inline size_t countFields(const google::protobuf::Message &msg) {
+    const auto *reflection = msg.GetReflection();
+    std::vector<const google::protobuf::FieldDescriptor *> fields;
+    reflection->ListFields(msg, &fields);
+    size_t count = 0;
+    for (const auto *field : fields) {
+        const bool isMessage = field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE;
+        if (field->is_repeated()) {
+            const int size = reflection->FieldSize(msg, field);
+            count += size;
+            for (int i = 0; isMessage && i < size; ++i) {
+                count += countFields(reflection->GetRepeatedMessage(msg, field, i));
+            }
+        } else {
+            count += 1 + (isMessage ? countFields(reflection->GetMessage(msg, field)) : 0);
+        }
+    }
+    return count;
+}
+
+// p-th percentile (0 <= p <= 1) of sorted values
+inline uint64_t getPercentile(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    const size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+// One way to feed documents to a generated parser. parse() returns false if the document was rejected.
+struct Variant {
+    const char *name;
+    std::function<bool(const std::string &json, Event &msg)> parse;
+};
+
+inline bool parseChunked(const std::string &json, Event &msg, const event_parser_config_s &config, size_t chunkLen) {
+    auto state = event_parser_init(msg, config);
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < json.size(); i += chunkLen) {
+        const auto len = std::min(chunkLen, json.size() - i);
+        rc = event_parser_on_chunk(state, const_cast<char *>(json.data() + i), len);
+    }
+    if (rc == 0) {
+        rc = event_parser_complete(state);
+    }
+    event_parser_free(state);
+    return rc == 0;
+}
+
+// corpora may contain unknown keys (see protog_corpus -x), which would abort the parse by default
+inline event_parser_config_s getConfig() {
+    event_parser_config_s config;
+    config.ignoreUnknownKeys = true;
+    return config;
+}
+
+// Tape of a corpus document, recorded on first use (e.g. while warming up) so that replaying it only
+// measures the state machine. Not thread safe.
+inline const std::string &getTape(const std::string &json) {
+    static std::unordered_map<const char *, std::string> tapes;
+    auto it = tapes.find(json.data());
+    if (it == tapes.end()) {
+        it = tapes.emplace(json.data(), std::string()).first;
+        TapeRecorder recorder;
+        if (recorder.record(json.data(), json.size(), it->second) != 0) {
+            it->second.clear();
+        }
+    }
+    return it->second;
+}
+
+inline std::vector<Variant> getVariants() {
+    std::vector<Variant> variants;
+    variants.push_back({"oneshot", [](const std::string &json, Event &msg) {
+        return parseChunked(json, msg, getConfig(), json.size());
+    }});
+    variants.push_back({"chunked-64", [](const std::string &json, Event &msg) {
+        return parseChunked(json, msg, getConfig(), 64);
+    }});
+    variants.push_back({"stats", [](const std::string &json, Event &msg) {
+        auto config = getConfig();
+        config.collectStats = true;
+        return parseChunked(json, msg, config, json.size());
+    }});
+    variants.push_back({"tape-replay", [](const std::string &json, Event &msg) {
+        const auto &tape = getTape(json);
+        auto state = event_parser_init(msg, getConfig());
+        const int rc = event_parser_replay(state, tape.data(), tape.size());
+        event_parser_free(state);
+        return rc == 0;
+    }});
+    return variants;
+}
+
+// Selects the variants named in a comma separated list, or all of them if the list is empty.
+inline std::vector<Variant> selectVariants(const std::string &names) {
+    std::vector<Variant> selected;
+    for (const auto &variant : getVariants()) {
+        if (names.empty() || ("," + names + ",").find("," + std::string(variant.name) + ",") != std::string::npos) {
+            selected.push_back(variant);
+        }
+    }
+    if (selected.empty()) {
+        fprintf(stderr, "No variant matches %s\n", names.c_str());
+        exit(1);
+    }
+    return selected;
+}
+
+} // namespace bench
+} // namespace protog
@@ -0,0 +1,299 @@
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <getopt.h>
+#include <limits.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+
+using namespace protog::bench;
+
+// The hooks below replace malloc and friends of libc for the whole process, which covers operator new
+// and the allocations of yajl and libprotobuf. While a parse is measured, each allocation is counted by
+// its call stack. The table is preallocated because the hooks must not allocate themselves.
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+namespace {
+
+const size_t maxFrames = 32;
+const size_t maxStacks = 4096;
+
+struct Stack {
+    size_t hash;
+    int depth;
+    void *frames[maxFrames];
+    size_t allocations;
+    size_t bytes;
+};
+
+Stack stacks[maxStacks];
+size_t droppedAllocations = 0;
+bool armed = false;
+__thread bool inHook = false;
+
+void record(size_t bytes) {
+    if (!armed || inHook) {
+        return;
+    }
+    inHook = true;
+    void *frames[maxFrames];
+    const int depth = backtrace(frames, maxFrames);
+    size_t hash = depth;
+    for (int i = 0; i < depth; ++i) {
+        hash = hash * 31 + reinterpret_cast<size_t>(frames[i]);
+    }
+    for (size_t i = 0; i < maxStacks; ++i) {
+        Stack &stack = stacks[(hash + i) % maxStacks];
+        if (stack.allocations == 0) {
+            stack.hash = hash;
+            stack.depth = depth;
+            memcpy(stack.frames, frames, depth * sizeof(void *));
+        } else if (stack.hash != hash || stack.depth != depth ||
+                   memcmp(stack.frames, frames, depth * sizeof(void *)) != 0) {
+            continue;
+        }
+        ++stack.allocations;
+        stack.bytes += bytes;
+        inHook = false;
+        return;
+    }
+    ++droppedAllocations;
+    inHook = false;
+}
+
+} // anonymous namespace
+
+extern "C" void *malloc(size_t size) {
+    record(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+    record(count * size);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    record(size);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size) {
+    record(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    record(size);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) {
+    record(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+// Resolves code addresses to function names. Symbols of the executable are mostly local (e.g. the
+// generated callbacks), so they are looked up with addr2line, the rest with dladdr.
+class Symbolizer {
+public:
+    Symbolizer() {
+        dl_iterate_phdr([](struct dl_phdr_info *info, size_t, void *bias) {
+            *static_cast<ElfW(Addr) *>(bias) = info->dlpi_addr; // the executable comes first
+            return 1;
+        }, &exeBias);
+        ssize_t len = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+        exePath[len > 0 ? len : 0] = 0;
+    }
+
+    const std::string &getName(void *address) {
+        auto it = names.find(address);
+        if (it == names.end()) {
+            it = names.emplace(address, lookup(address)).first;
+        }
+        return it->second;
+    }
+
+private:
+    std::string lookup(void *address) {
+        // return addresses point behind the call
+        const auto pc = reinterpret_cast<uintptr_t>(address) - 1;
+        Dl_info info;
+        if (dladdr(reinterpret_cast<void *>(pc), &info) && info.dli_sname) {
+            int status = 0;
+            char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            const std::string name = status == 0 ? demangled : info.dli_sname;
+            ::free(demangled);
+            return name;
+        }
+        char path[PATH_MAX];
+        if (dladdr(reinterpret_cast<void *>(pc), &info) && realpath(info.dli_fname, path) &&
+            strcmp(path, exePath) != 0) {
+            return std::string("?? in ") + info.dli_fname;
+        }
+        char command[PATH_MAX + 64];
+        snprintf(command, sizeof(command), "addr2line -f -C -e %s 0x%zx", exePath, static_cast<size_t>(pc - exeBias));
+        std::string name = "??";
+        if (FILE *pipe = popen(command, "r")) {
+            char line[4096];
+            if (fgets(line, sizeof(line), pipe)) {
+                name = line;
+                name.erase(name.find_last_not_of('\n') + 1);
+            }
+            pclose(pipe);
+        }
+        return name;
+    }
+
+    ElfW(Addr) exeBias = 0;
+    char exePath[PATH_MAX];
+    std::map<void *, std::string> names;
+};
+
+// Attributes an allocation to the innermost frame of a generated parser ("site"), and to the frame that
+// the site called into, e.g. std::string or std::vector ("via"). Frames of the hooks are skipped.
+static std::pair<std::string, std::string> attribute(const Stack &stack, Symbolizer &symbolizer) {
+    std::string via;
+    for (int i = 1; i < stack.depth; ++i) {
+        const auto &name = symbolizer.getName(stack.frames[i]);
+        if (name.find("_parser_") != std::string::npos) {
+            return {name, via.empty() ? "(direct)" : via};
+        }
+        if (name.find("operator new") == std::string::npos && name.find("alloc") != 0 &&
+            name.find("malloc") == std::string::npos && name.find("realloc") == std::string::npos) {
+            via = name;
+        }
+    }
+    return {"(outside of generated code)", via};
+}
+
+void print_help(FILE* f) {
+    fprintf(f, "Usage: protog_bench_alloc [OPTIONS] [CORPUS_FILE...]\n");
+    fprintf(f, "Parse a corpus with one reused parser state and message and count the heap allocations\n");
+    fprintf(f, "per parse once the state is warmed up. Allocations are attributed to the generated\n");
+    fprintf(f, "function that caused them. Exits with 1 if a document is rejected or the allocations\n");
+    fprintf(f, "per parse exceed the budget.\n");
+    fprintf(f, "CORPUS_FILE contains json documents, e.g. from protog_corpus.\n");
+    fprintf(f, "  -h                 Print this help message.\n");
+    fprintf(f, "  -n ITERATIONS      Measured passes over the corpus. It defaults to 3.\n");
+    fprintf(f, "  -w ITERATIONS      Passes over the corpus to warm up. It defaults to 1.\n");
+    fprintf(f, "  -b BUDGET          Allowed allocations per parse. It defaults to 0.\n");
+    fprintf(f, "  -g DOCUMENTS       Size of the generated corpus used without CORPUS_FILE.\n");
+    fprintf(f, "                     It defaults to 1000.\n");
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = 3;
+    size_t warmup = 1;
+    double budget = 0;
+    size_t documents = 1000;
+
+    int c;
+    opterr = 0;
+    while ((c = getopt(argc, argv, "hn:w:b:g:")) != -1) {
+        switch (c) {
+        case 'h':
+            print_help(stdout);
+            exit(EXIT_SUCCESS);
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            warmup = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            budget = atof(optarg);
+            break;
+        case 'g':
+            documents = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_help(stderr);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    auto corpus = optind < argc ? loadCorpus(std::vector<std::string>(argv + optind, argv + argc))
+                                      : makeCorpus(documents);
+    if (corpus.empty() || iterations == 0) {
+        print_help(stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    void *frames[1];
+    backtrace(frames, 1); // loads libgcc, which allocates
+
+    Event msg;
+    auto state = event_parser_init(msg, getConfig());
+    size_t rejected = 0;
+    for (size_t i = 0; i < warmup + iterations; ++i) {
+        armed = i >= warmup;
+        for (auto &json : corpus) {
+            event_parser_reset(state);
+            rejected += event_parser_on_chunk(state, &json[0], json.size()) != 0 ||
+                        event_parser_complete(state) != 0;
+        }
+    }
+    armed = false;
+    event_parser_free(state);
+
+    const double parses = static_cast<double>(corpus.size() * iterations);
+    size_t allocations = droppedAllocations;
+    size_t bytes = 0;
+    Symbolizer symbolizer;
+    std::map<std::pair<std::string, std::string>, std::pair<size_t, size_t>> sites;
+    for (const auto &stack : stacks) {
+        if (stack.allocations) {
+            allocations += stack.allocations;
+            bytes += stack.bytes;
+            auto &site = sites[attribute(stack, symbolizer)];
+            site.first += stack.allocations;
+            site.second += stack.bytes;
+        }
+    }
+
+    std::vector<std::pair<std::pair<std::string, std::string>, std::pair<size_t, size_t>>> sorted(sites.begin(), sites.end());
+    std::sort(sorted.begin(), sorted.end(), [](const decltype(sorted)::value_type &a, const decltype(sorted)::value_type &b) {
+        return a.second.first > b.second.first;
+    });
+
+    printf("corpus: %zu documents, %zu bytes, %zu warm up and %zu measured iterations\n",
+           corpus.size(), getCorpusBytes(corpus), warmup, iterations);
+    if (rejected) {
+        printf("%zu documents rejected\n", rejected);
+    }
+    printf("%.3f allocations and %.1f bytes per parse (budget %.3f)\n", allocations / parses, bytes / parses, budget);
+    if (!sorted.empty()) {
+        printf("\n%12s %12s  %s\n", "allocs/parse", "bytes/parse", "site <- via");
+    }
+    for (const auto &site : sorted) {
+        printf("%12.3f %12.1f  %s <- %s\n", site.second.first / parses, site.second.second / parses,
+               site.first.first.c_str(), site.first.second.c_str());
+    }
+    if (droppedAllocations) {
+        printf("%12.3f %12s  (call stacks beyond %zu)\n", droppedAllocations / parses, "", maxStacks);
+    }
+    // a rejected document fails before it allocates what a parse needs, so it must not pass the budget
+    return rejected || allocations / parses > budget ? 1 : 0;
+}
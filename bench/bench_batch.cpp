@@ -0,0 +1,130 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+
+using namespace protog::bench;
+
+void print_help(FILE* f) {
+    fprintf(f, "Usage: protog_bench_batch [OPTIONS] [CORPUS_FILE...]\n");
+    fprintf(f, "Parse a working set larger than the caches document by document and with\n");
+    fprintf(f, "event_parser_parse_batch() on 1, 2, 4, ... lanes, and report the throughput.\n");
+    fprintf(f, "  -h                 Print this help message.\n");
+    fprintf(f, "  -n ITERATIONS      Passes over the working set per mode. It defaults to 5.\n");
+    fprintf(f, "  -g DOCUMENTS       Size of the generated corpus used without CORPUS_FILE.\n");
+    fprintf(f, "                     It defaults to 1000.\n");
+    fprintf(f, "  -m MEGABYTES       Size of the working set, the corpus is repeated to fill it.\n");
+    fprintf(f, "                     It defaults to 64.\n");
+    fprintf(f, "  -l MAX_LANES       Largest number of lanes. It defaults to 8.\n");
+    fprintf(f, "  -s SLICE_BYTES     Bytes a lane parses per turn. It defaults to 1024.\n");
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = 5;
+    size_t documents = 1000;
+    size_t megabytes = 64;
+    size_t max_lanes = 8;
+    size_t slice_bytes = 1024;
+
+    int c;
+    opterr = 0;
+    while ((c = getopt(argc, argv, "hn:g:m:l:s:")) != -1) {
+        switch (c) {
+        case 'h':
+            print_help(stdout);
+            exit(EXIT_SUCCESS);
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            documents = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            megabytes = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            max_lanes = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            slice_bytes = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_help(stderr);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const auto corpus = optind < argc ? loadCorpus(std::vector<std::string>(argv + optind, argv + argc))
+                                      : makeCorpus(documents);
+    if (corpus.empty() || iterations == 0 || slice_bytes == 0) {
+        print_help(stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    // every document gets its own copy of the json and its own message, so neither stays in the caches
+    std::vector<std::string> working_set;
+    size_t bytes = 0;
+    while (bytes < megabytes << 20 || working_set.size() < corpus.size()) {
+        working_set.push_back(corpus[working_set.size() % corpus.size()]);
+        bytes += working_set.back().size();
+    }
+    std::vector<char *> docs;
+    std::vector<size_t> doc_lens;
+    for (auto& json : working_set) {
+        docs.push_back(&json[0]);
+        doc_lens.push_back(json.size());
+    }
+    std::vector<Event> msgs(working_set.size());
+    std::vector<int> results(working_set.size());
+    printf("working set: %zu documents, %.1f MB, %zu iterations\n", working_set.size(), bytes / 1e6, iterations);
+
+    const auto config = getConfig();
+    auto state = event_parser_init(msgs[0], config);
+    const auto run_sequential = [&]() {
+        size_t rejected = 0;
+        for (size_t i = 0; i < docs.size(); ++i) {
+            // a state is bound to its message, so each document needs a new one; batch-1 shows the cost of that
+            event_parser_free(state);
+            msgs[i].Clear();
+            state = event_parser_init(msgs[i], config);
+            rejected += event_parser_on_chunk(state, docs[i], doc_lens[i]) != 0 || event_parser_complete(state) != 0;
+        }
+        return rejected;
+    };
+    auto batch_config = config;
+    batch_config.sliceBytes = slice_bytes;
+    size_t lanes = 0;
+    const auto run_batch = [&]() {
+        return event_parser_parse_batch(docs.data(), doc_lens.data(), msgs.data(), results.data(), docs.size(),
+                                        batch_config, lanes);
+    };
+
+    const auto measure = [&](const char *name, const std::function<size_t()> &run) {
+        run(); // warm up, and the messages reach their final size
+        size_t rejected = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            rejected += run();
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        printf("%-12s %10.2f MB/s", name, bytes * iterations / elapsed.count() / 1e6);
+        if (rejected) {
+            printf(", %zu documents rejected", rejected);
+        }
+        printf("\n");
+    };
+
+    measure("sequential", run_sequential);
+    event_parser_free(state);
+    for (lanes = 1; lanes <= max_lanes && lanes <= 16; lanes *= 2) {
+        const auto name = "batch-" + std::to_string(lanes);
+        measure(name.c_str(), run_batch);
+    }
+    return 0;
+}
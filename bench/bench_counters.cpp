@@ -0,0 +1,120 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "perf_counters.h"
+
+using namespace protog::bench;
+
+void print_help(FILE* f) {
+    fprintf(f, "Usage: protog_bench_counters [OPTIONS] [CORPUS_FILE...]\n");
+    fprintf(f, "Parse a corpus with each parser variant and report throughput and hardware counters\n");
+    fprintf(f, "per byte and per field. CORPUS_FILE contains json documents, e.g. from protog_corpus.\n");
+    fprintf(f, "  -h                 Print this help message.\n");
+    fprintf(f, "  -n ITERATIONS      Passes over the corpus per variant. It defaults to 20.\n");
+    fprintf(f, "  -g DOCUMENTS       Size of the generated corpus used without CORPUS_FILE.\n");
+    fprintf(f, "                     It defaults to 1000.\n");
+    fprintf(f, "  -v VARIANTS        Comma separated list of variants to run. Runs all by default.\n");
+}
+
+static void print_counter(const PerfCounters& counters, Counter counter, size_t bytes, size_t fields) {
+    if (!counters.isAvailable(counter)) {
+        printf("    %-16s %12s %12s\n", getCounterName(counter), "n/a", "n/a");
+        return;
+    }
+    const double value = static_cast<double>(counters.getValue(counter));
+    printf("    %-16s %12.4f %12.4f\n", getCounterName(counter), value / bytes, value / fields);
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = 20;
+    size_t documents = 1000;
+    std::string variant_names;
+
+    int c;
+    opterr = 0;
+    while ((c = getopt(argc, argv, "hn:g:v:")) != -1) {
+        switch (c) {
+        case 'h':
+            print_help(stdout);
+            exit(EXIT_SUCCESS);
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            documents = strtoul(optarg, NULL, 10);
+            break;
+        case 'v':
+            variant_names = optarg;
+            break;
+        default:
+            print_help(stderr);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const auto corpus = optind < argc ? loadCorpus(std::vector<std::string>(argv + optind, argv + argc))
+                                      : makeCorpus(documents);
+    const auto variants = selectVariants(variant_names);
+    if (corpus.empty() || iterations == 0) {
+        print_help(stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    // every variant fills the same fields, so count them once
+    Event msg;
+    size_t corpus_fields = 0;
+    for (const auto& json : corpus) {
+        msg.Clear();
+        if (!variants[0].parse(json, msg)) {
+            fprintf(stderr, "Variant %s rejects document: %s\n", variants[0].name, json.c_str());
+            exit(EXIT_FAILURE);
+        }
+        corpus_fields += countFields(msg);
+    }
+    const size_t bytes = getCorpusBytes(corpus) * iterations;
+    const size_t fields = corpus_fields * iterations;
+    printf("corpus: %zu documents, %zu bytes, %zu fields, %zu iterations\n",
+           corpus.size(), getCorpusBytes(corpus), corpus_fields, iterations);
+
+    PerfCounters counters;
+    for (const auto& variant : variants) {
+        for (const auto& json : corpus) { // warm up caches and branch predictors
+            msg.Clear();
+            variant.parse(json, msg);
+        }
+
+        size_t rejected = 0;
+        const auto start = std::chrono::steady_clock::now();
+        counters.start();
+        for (size_t i = 0; i < iterations; ++i) {
+            for (const auto& json : corpus) {
+                msg.Clear();
+                rejected += !variant.parse(json, msg);
+            }
+        }
+        counters.stop();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        printf("\n%s: %.2f MB/s, %.2f M fields/s", variant.name,
+               bytes / elapsed.count() / 1e6, fields / elapsed.count() / 1e6);
+        if (counters.isAvailable(Counter::CYCLES) && counters.isAvailable(Counter::INSTRUCTIONS)) {
+            printf(", IPC %.2f", static_cast<double>(counters.getValue(Counter::INSTRUCTIONS)) /
+                                 counters.getValue(Counter::CYCLES));
+        }
+        if (rejected) {
+            printf(", %zu documents rejected", rejected);
+        }
+        printf("\n");
+        printf("    %-16s %12s %12s\n", "counter", "per byte", "per field");
+        for (size_t i = 0; i < counterCount; ++i) {
+            print_counter(counters, static_cast<Counter>(i), bytes, fields);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "msgpack_writer.h"
+#include "parser.h"
+#include "rapidjson_writer.h"
+#include "yajl_writer.h"
+
+// Times protog itself: loading a synthetic schema, building the Graph and writing the parser. Every level of
+// the schema refers to the next level's message WIDTH times, so the Graph holds about WIDTH^DEPTH copies of
+// the innermost message, like real schemas that reuse common messages in many places.
+
+static void print_help(FILE* f) {
+    fprintf(f, "Usage: protog_bench_generator [OPTIONS]\n");
+    fprintf(f, "  -d DEPTH       Levels of nested messages (default 6).\n");
+    fprintf(f, "  -w WIDTH       Fields of each level that refer to the next level (default 4).\n");
+    fprintf(f, "  -f FIELDS      Scalar fields of each level (default 12).\n");
+    fprintf(f, "  -n ITERATIONS  Generation runs, the median is reported (default 3).\n");
+    fprintf(f, "  -b BACKEND     yajl (default), rapidjson or msgpack.\n");
+    fprintf(f, "  -O             Minimize the Graph before writing it.\n");
+}
+
+static std::string make_schema(int depth, int width, int fields) {
+    static const char* types[] = {"string", "int64", "double", "bool", "int32", "bytes"};
+    std::string proto = "syntax = \"proto2\";\npackage protog.genbench;\n";
+    for (int level = 0; level <= depth; ++level) {
+        proto += "\nmessage Level" + std::to_string(level) + " {\n";
+        int number = 1;
+        for (int i = 0; i < fields; ++i, ++number) {
+            proto += std::string("    ") + (i % 5 == 4 ? "repeated " : "optional ") + types[i % 6] +
+                     " field_with_a_long_name_" + std::to_string(i) + " = " + std::to_string(number) + ";\n";
+        }
+        for (int i = 0; level < depth && i < width; ++i, ++number) {
+            proto += std::string("    ") + (i % 2 ? "repeated" : "optional") + " Level" + std::to_string(level + 1) +
+                     " child_" + std::to_string(i) + " = " + std::to_string(number) + ";\n";
+        }
+        proto += "}\n";
+    }
+    return proto;
+}
+
+static double get_ms(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count() / 1000.0;
+}
+
+static off_t get_file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+int main(int argc, char** argv) {
+    int depth = 6;
+    int width = 4;
+    int fields = 12;
+    size_t iterations = 3;
+    std::string backend = "yajl";
+    bool minimize = false;
+    int c;
+    while ((c = getopt(argc, argv, "hd:w:f:n:b:O")) != -1) {
+        switch (c) {
+            case 'd':
+                depth = atoi(optarg);
+                break;
+            case 'w':
+                width = atoi(optarg);
+                break;
+            case 'f':
+                fields = atoi(optarg);
+                break;
+            case 'n':
+                iterations = std::max(1, atoi(optarg));
+                break;
+            case 'b':
+                backend = optarg;
+                break;
+            case 'O':
+                minimize = true;
+                break;
+            case 'h':
+                print_help(stdout);
+                return 0;
+            default:
+                print_help(stderr);
+                return 1;
+        }
+    }
+
+    // the writers put their files into the working directory
+    char dir[] = "/tmp/protog_bench_generator_XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string proto_file = std::string(dir) + "/genbench.proto";
+    FILE* proto = fopen(proto_file.c_str(), "w");
+    const std::string schema = make_schema(depth, width, fields);
+    fwrite(schema.data(), 1, schema.size(), proto);
+    fclose(proto);
+
+    std::vector<double> load, build, reduce, emit;
+    size_t nodes = 0;
+    for (size_t i = 0; i < iterations; ++i) {
+        std::shared_ptr<protog::Writer> writer;
+        if (backend == "rapidjson") {
+            writer = std::make_shared<protog::RapidjsonWriter>();
+        } else if (backend == "msgpack") {
+            writer = std::make_shared<protog::MsgpackWriter>();
+        } else {
+            writer = std::make_shared<protog::YajlWriter>();
+        }
+
+        const auto t0 = std::chrono::steady_clock::now();
+        protog::Graph graph{proto_file, "protog.genbench.Level0"};
+        const auto t1 = std::chrono::steady_clock::now();
+        graph.parseMessageDesc();
+        const auto t2 = std::chrono::steady_clock::now();
+        if (minimize) {
+            graph.minimize();
+        }
+        const auto t3 = std::chrono::steady_clock::now();
+        writer->write(graph, "genbench.pb.h");
+        const auto t4 = std::chrono::steady_clock::now();
+
+        load.push_back(get_ms(t0, t1));
+        build.push_back(get_ms(t1, t2));
+        reduce.push_back(get_ms(t2, t3));
+        emit.push_back(get_ms(t3, t4));
+        nodes = graph.all_nodes.size();
+    }
+
+    const off_t output = get_file_size("level0_parser.pb.h") + get_file_size("level0_parser.pb.cc");
+    unlink("level0_parser.pb.h");
+    unlink("level0_parser.pb.cc");
+    unlink(proto_file.c_str());
+    rmdir(dir);
+
+    const auto median = [](std::vector<double> v) {
+        std::sort(v.begin(), v.end());
+        return v[v.size() / 2];
+    };
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("depth %d, width %d, %d scalar fields: %zu nodes, %.1f MB of %s parser\n", depth, width, fields, nodes,
+           output / 1e6, backend.c_str());
+    printf("%-10s %10s\n", "phase", "median ms");
+    printf("%-10s %10.1f\n", "load", median(load));
+    printf("%-10s %10.1f\n", "graph", median(build));
+    printf("%-10s %10.1f\n", "minimize", median(reduce));
+    printf("%-10s %10.1f\n", "emit", median(emit));
+    printf("peak rss %.1f MB, %.0f bytes per node\n", usage.ru_maxrss / 1024.0,
+           usage.ru_maxrss * 1024.0 / std::max<size_t>(nodes, 1));
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+
+using namespace protog::bench;
+
+enum class Mode {
+    COLD,       // caches evicted before each parse, new parser state and message per parse
+    WARM_FRESH, // new parser state and message per parse
+    WARM,       // one parser state and message, reset between parses
+};
+
+static const char* get_mode_name(Mode mode) {
+    switch (mode) {
+        case Mode::COLD: return "cold";
+        case Mode::WARM_FRESH: return "warm-fresh";
+        case Mode::WARM: return "warm";
+    }
+    return "unknown";
+}
+
+// ns per parse, split into setting up the parser state (init or reset), feeding the document
+// (on_chunk and complete) and tearing the state down again (free)
+struct Latencies {
+    std::vector<uint64_t> setup;
+    std::vector<uint64_t> parse;
+    std::vector<uint64_t> teardown;
+    std::vector<uint64_t> total;
+};
+
+// Writes to every cache line of a buffer larger than the last level cache.
+static void evict_caches(std::vector<char>& buffer) {
+    static char round = 0;
+    ++round;
+    for (size_t i = 0; i < buffer.size(); i += 64) {
+        buffer[i] = round;
+    }
+    asm volatile("" : : "r"(buffer.data()) : "memory");
+}
+
+static uint64_t get_ns(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+}
+
+static Latencies run(const Corpus& corpus, Mode mode, size_t parses, size_t evict_bytes) {
+    Latencies latencies;
+    std::vector<char> evict_buffer(mode == Mode::COLD ? evict_bytes : 0);
+    Event reused;
+    event_parser_state_t state = mode == Mode::WARM ? event_parser_init(reused, getConfig()) : nullptr;
+    size_t rejected = 0;
+    for (size_t i = 0; i < parses; ++i) {
+        auto& json = const_cast<std::string&>(corpus[i % corpus.size()]);
+        if (mode == Mode::COLD) {
+            evict_caches(evict_buffer);
+        }
+
+        Event* fresh = nullptr;
+        const auto start = std::chrono::steady_clock::now();
+        if (mode == Mode::WARM) {
+            event_parser_reset(state);
+        } else {
+            fresh = new Event();
+            state = event_parser_init(*fresh, getConfig());
+        }
+        const auto setup = std::chrono::steady_clock::now();
+        int rc = event_parser_on_chunk(state, &json[0], json.size());
+        if (rc == 0) {
+            rc = event_parser_complete(state);
+        }
+        const auto parse = std::chrono::steady_clock::now();
+        if (mode != Mode::WARM) {
+            event_parser_free(state);
+            delete fresh;
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        rejected += rc != 0;
+        latencies.setup.push_back(get_ns(start, setup));
+        latencies.parse.push_back(get_ns(setup, parse));
+        latencies.teardown.push_back(get_ns(parse, end));
+        latencies.total.push_back(get_ns(start, end));
+    }
+    if (mode == Mode::WARM) {
+        event_parser_free(state);
+    }
+    if (rejected) {
+        fprintf(stderr, "%zu documents rejected\n", rejected);
+    }
+    for (auto* phase : {&latencies.setup, &latencies.parse, &latencies.teardown, &latencies.total}) {
+        std::sort(phase->begin(), phase->end());
+    }
+    return latencies;
+}
+
+static void print_phase(const char* name, const std::vector<uint64_t>& sorted) {
+    printf("    %-10s %10.2f %10.2f %10.2f %10.2f\n", name, getPercentile(sorted, 0.5) / 1e3,
+           getPercentile(sorted, 0.99) / 1e3, getPercentile(sorted, 0.999) / 1e3, sorted.back() / 1e3);
+}
+
+void print_help(FILE* f) {
+    fprintf(f, "Usage: protog_bench_latency [OPTIONS] [CORPUS_FILE...]\n");
+    fprintf(f, "Time each parse individually and report p50/p99/p99.9/max latencies of setting up\n");
+    fprintf(f, "the parser, parsing and tearing it down again. Runs three modes: cold evicts caches\n");
+    fprintf(f, "and creates a new parser per parse, warm-fresh only creates a new parser and warm\n");
+    fprintf(f, "resets one parser. CORPUS_FILE contains json documents, e.g. from protog_corpus.\n");
+    fprintf(f, "  -h                 Print this help message.\n");
+    fprintf(f, "  -n PARSES          Parses per mode, cycling through the corpus. It defaults to 2000.\n");
+    fprintf(f, "  -g DOCUMENTS       Size of the generated corpus used without CORPUS_FILE.\n");
+    fprintf(f, "                     It defaults to 1000.\n");
+    fprintf(f, "  -e EVICT_MB        Size of the buffer written to evict caches in cold mode.\n");
+    fprintf(f, "                     It should exceed the last level cache. It defaults to 64.\n");
+}
+
+int main(int argc, char **argv) {
+    size_t parses = 2000;
+    size_t documents = 1000;
+    size_t evict_mb = 64;
+
+    int c;
+    opterr = 0;
+    while ((c = getopt(argc, argv, "hn:g:e:")) != -1) {
+        switch (c) {
+        case 'h':
+            print_help(stdout);
+            exit(EXIT_SUCCESS);
+        case 'n':
+            parses = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            documents = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            evict_mb = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_help(stderr);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const auto corpus = optind < argc ? loadCorpus(std::vector<std::string>(argv + optind, argv + argc))
+                                      : makeCorpus(documents);
+    if (corpus.empty() || parses == 0) {
+        print_help(stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("corpus: %zu documents, %zu bytes, %zu parses per mode\n", corpus.size(), getCorpusBytes(corpus), parses);
+    for (const auto mode : {Mode::COLD, Mode::WARM_FRESH, Mode::WARM}) {
+        const auto latencies = run(corpus, mode, parses, evict_mb << 20);
+        printf("\n%s\n", get_mode_name(mode));
+        printf("    %-10s %10s %10s %10s %10s\n", "phase", "p50 us", "p99 us", "p99.9 us", "max us");
+        print_phase("setup", latencies.setup);
+        print_phase("parse", latencies.parse);
+        print_phase("teardown", latencies.teardown);
+        print_phase("total", latencies.total);
+    }
+    return 0;
+}
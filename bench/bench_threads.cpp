@@ -0,0 +1,209 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <google/protobuf/arena.h>
+
+#include "bench.h"
+
+using namespace protog::bench;
+
+// How much a thread keeps between two documents.
+enum class Mode {
+    FRESH, // new parser state and message per document
+    REUSE, // one parser state and message per thread, reset between documents
+    ARENA, // new parser state per document, message on an arena that starts in a per thread block
+};
+
+static const char* get_mode_name(Mode mode) {
+    switch (mode) {
+        case Mode::FRESH: return "fresh";
+        case Mode::REUSE: return "reuse";
+        case Mode::ARENA: return "arena";
+    }
+    return "unknown";
+}
+
+class Worker {
+public:
+    explicit Worker(Mode mode) : mode(mode), arenaBlock(mode == Mode::ARENA ? 256 * 1024 : 0) {
+        if (mode == Mode::REUSE) {
+            state = event_parser_init(msg, getConfig());
+        }
+    }
+
+    ~Worker() {
+        if (state) {
+            event_parser_free(state);
+        }
+    }
+
+    bool parse(const std::string& json) {
+        switch (mode) {
+            case Mode::FRESH: {
+                Event fresh;
+                return parseChunked(json, fresh, getConfig(), json.size());
+            }
+            case Mode::REUSE: {
+                event_parser_reset(state);
+                int rc = event_parser_on_chunk(state, const_cast<char*>(json.data()), json.size());
+                return rc == 0 && event_parser_complete(state) == 0;
+            }
+            case Mode::ARENA: {
+                google::protobuf::ArenaOptions options;
+                options.initial_block = arenaBlock.data();
+                options.initial_block_size = arenaBlock.size();
+                google::protobuf::Arena arena(options);
+                auto* onArena = google::protobuf::Arena::CreateMessage<Event>(&arena);
+                return parseChunked(json, *onArena, getConfig(), json.size());
+            }
+        }
+        return false;
+    }
+
+    std::vector<uint64_t> latencies; // ns per document
+
+private:
+    const Mode mode;
+    Event msg;
+    event_parser_state_t state = nullptr;
+    std::vector<char> arenaBlock;
+};
+
+struct Result {
+    double seconds;
+    size_t rejected;
+    std::vector<uint64_t> latencies; // sorted
+};
+
+// Every thread parses the whole corpus iterations times, starting at a different document so the threads
+// do not walk through the corpus in lockstep.
+static Result run(const Corpus& corpus, Mode mode, size_t threads, size_t iterations) {
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<size_t> rejected{0};
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back(new Worker(mode));
+        workers.back()->latencies.reserve(corpus.size() * iterations);
+    }
+
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t] {
+            Worker& worker = *workers[t];
+            size_t failed = 0;
+            ++ready;
+            while (!go.load(std::memory_order_acquire)) {
+            }
+            for (size_t i = 0; i < corpus.size() * iterations; ++i) {
+                const auto& json = corpus[(i + t * corpus.size() / threads) % corpus.size()];
+                const auto start = std::chrono::steady_clock::now();
+                failed += !worker.parse(json);
+                const auto end = std::chrono::steady_clock::now();
+                worker.latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+            }
+            rejected += failed;
+        });
+    }
+    while (ready.load() != threads) {
+    }
+    const auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    Result result{elapsed.count(), rejected.load(), {}};
+    for (const auto& worker : workers) {
+        result.latencies.insert(result.latencies.end(), worker->latencies.begin(), worker->latencies.end());
+    }
+    std::sort(result.latencies.begin(), result.latencies.end());
+    return result;
+}
+
+void print_help(FILE* f) {
+    fprintf(f, "Usage: protog_bench_threads [OPTIONS] [CORPUS_FILE...]\n");
+    fprintf(f, "Parse a shared corpus on 1, 2, 4, ... MAX_THREADS threads, with and without reusing\n");
+    fprintf(f, "parser states and arenas. Reports aggregate throughput, the efficiency compared to\n");
+    fprintf(f, "linear scaling and latency percentiles.\n");
+    fprintf(f, "CORPUS_FILE contains json documents, e.g. from protog_corpus.\n");
+    fprintf(f, "  -h                 Print this help message.\n");
+    fprintf(f, "  -t MAX_THREADS     It defaults to the number of hardware threads.\n");
+    fprintf(f, "  -n ITERATIONS      Passes over the corpus per thread. It defaults to 5.\n");
+    fprintf(f, "  -g DOCUMENTS       Size of the generated corpus used without CORPUS_FILE.\n");
+    fprintf(f, "                     It defaults to 1000.\n");
+}
+
+int main(int argc, char **argv) {
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t iterations = 5;
+    size_t documents = 1000;
+
+    int c;
+    opterr = 0;
+    while ((c = getopt(argc, argv, "ht:n:g:")) != -1) {
+        switch (c) {
+        case 'h':
+            print_help(stdout);
+            exit(EXIT_SUCCESS);
+        case 't':
+            max_threads = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            documents = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_help(stderr);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const auto corpus = optind < argc ? loadCorpus(std::vector<std::string>(argv + optind, argv + argc))
+                                      : makeCorpus(documents);
+    if (corpus.empty() || iterations == 0 || max_threads == 0) {
+        print_help(stderr);
+        exit(EXIT_FAILURE);
+    }
+    std::vector<size_t> thread_counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    const size_t corpus_bytes = getCorpusBytes(corpus);
+    printf("corpus: %zu documents, %zu bytes, %zu iterations per thread\n", corpus.size(), corpus_bytes, iterations);
+    for (const auto mode : {Mode::FRESH, Mode::REUSE, Mode::ARENA}) {
+        printf("\n%s\n", get_mode_name(mode));
+        printf("    %7s %10s %10s %10s %10s %10s\n", "threads", "MB/s", "efficiency", "p50 us", "p99 us", "p99.9 us");
+        double single_thread = 0;
+        for (const auto threads : thread_counts) {
+            const auto result = run(corpus, mode, threads, iterations);
+            const double throughput = corpus_bytes * iterations * threads / result.seconds / 1e6;
+            if (threads == 1) {
+                single_thread = throughput;
+            }
+            printf("    %7zu %10.2f %9.0f%% %10.2f %10.2f %10.2f", threads, throughput,
+                   100 * throughput / (threads * single_thread),
+                   getPercentile(result.latencies, 0.5) / 1e3, getPercentile(result.latencies, 0.99) / 1e3,
+                   getPercentile(result.latencies, 0.999) / 1e3);
+            if (result.rejected) {
+                printf(", %zu documents rejected", result.rejected);
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace protog {
+namespace bench {
+
+enum class Counter {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    LLC_MISSES,
+};
+
+static const size_t counterCount = 5;
+
+inline const char *getCounterName(Counter counter) {
+    switch (counter) {
+        case Counter::CYCLES: return "cycles";
+        case Counter::INSTRUCTIONS: return "instructions";
+        case Counter::BRANCH_MISSES: return "branch-misses";
+        case Counter::L1D_MISSES: return "L1d-misses";
+        case Counter::LLC_MISSES: return "LLC-misses";
+    }
+    return "unknown";
+}
+
+// Counts hardware events of the calling thread in user space with perf_event_open(2). Events that the
+// CPU or kernel does not provide (VMs, perf_event_paranoid > 2, ...) are reported as unavailable.
+class PerfCounters {
+public:
+    PerfCounters() {
+        open(Counter::CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        open(Counter::INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        open(Counter::BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        open(Counter::L1D_MISSES, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        open(Counter::LLC_MISSES, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    }
+
+    ~PerfCounters() {
+        for (const int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    void start() {
+        for (const int fd : fds) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    void stop() {
+        for (size_t i = 0; i < counterCount; ++i) {
+            if (fds[i] >= 0) {
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                values[i] = read(fds[i]);
+            }
+        }
+    }
+
+    bool isAvailable(Counter counter) const {
+        return fds[static_cast<size_t>(counter)] >= 0;
+    }
+
+    // value between the last start() and stop(), scaled up if the kernel had to multiplex the counter
+    uint64_t getValue(Counter counter) const {
+        return values[static_cast<size_t>(counter)];
+    }
+
+private:
+    void open(Counter counter, uint32_t type, uint64_t config) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        const auto i = static_cast<size_t>(counter);
+        fds[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        values[i] = 0;
+    }
+
+    static uint64_t read(int fd) {
+        uint64_t data[3]; // value, time enabled, time running
+        if (::read(fd, data, sizeof(data)) != sizeof(data) || data[2] == 0) {
+            return 0;
+        }
+        return data[2] < data[1] ? static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]) : data[0];
+    }
+
+    int fds[counterCount];
+    uint64_t values[counterCount];
+};
+
+} // namespace bench
+} // namespace protog
@@ -0,0 +1,394 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "parser.h"
+
+namespace protog {
+
+// Random sizes for arrays and strings, parsed from "fixed:N", "uniform:MIN:MAX" or "geometric:MEAN".
+struct Distribution {
+    enum class Kind {
+        FIXED,
+        UNIFORM,
+        GEOMETRIC,
+    };
+
+    Kind kind;
+    double a;
+    double b;
+
+    static Distribution parse(const std::string &spec) {
+        Distribution dist{Kind::FIXED, 0, 0};
+        char kind[16] = {0};
+        const int n = sscanf(spec.c_str(), "%15[a-z]:%lf:%lf", kind, &dist.a, &dist.b);
+        if (n == 2 && strcmp(kind, "fixed") == 0) {
+            dist.kind = Kind::FIXED;
+        } else if (n == 3 && strcmp(kind, "uniform") == 0 && dist.a <= dist.b) {
+            dist.kind = Kind::UNIFORM;
+        } else if (n == 2 && strcmp(kind, "geometric") == 0) {
+            dist.kind = Kind::GEOMETRIC;
+        } else {
+            throw std::runtime_error("Invalid distribution " + spec);
+        }
+        if (dist.a < 0) {
+            throw std::runtime_error("Invalid distribution " + spec);
+        }
+        return dist;
+    }
+
+    size_t sample(std::mt19937_64 &rng) const {
+        switch (kind) {
+            case Kind::FIXED:
+                return static_cast<size_t>(a);
+            case Kind::UNIFORM:
+                return std::uniform_int_distribution<size_t>(static_cast<size_t>(a), static_cast<size_t>(b))(rng);
+            case Kind::GEOMETRIC:
+                return std::geometric_distribution<size_t>(1 / (a + 1))(rng);
+        }
+        return 0;
+    }
+};
+
+enum class Whitespace {
+    COMPACT, // {"a":1,"b":[1,2]}
+    SPACED,  // {"a": 1, "b": [1, 2]}
+    PRETTY,  // one value per line, indented by two spaces
+};
+
+struct CorpusOptions {
+    uint64_t seed = 42;
+    // probability of an optional field to be present, by default and by Node::full_name (e.g. ".my_inner.a")
+    double presence = 0.8;
+    std::map<std::string, double> fieldPresence;
+    Distribution arrayLength{Distribution::Kind::UNIFORM, 0, 4};
+    Distribution stringLength{Distribution::Kind::GEOMETRIC, 8, 0};
+    bool shuffleKeys = false;
+    Whitespace whitespace = Whitespace::COMPACT;
+    // probability of each object to get a key that is not part of its message
+    double unknownKeys = 0;
+};
+
+// Generates random json documents that the parser for the graph's message accepts: values have the field's
+// type and satisfy the protog constraints, required fields are always present and repeated fields with
+// min_items are never left out. Each document ends with a newline, but pretty documents span several lines, so
+// read them back with splitDocuments() from protog_corpus.h.
+struct CorpusWriter {
+    CorpusWriter(const Graph &graph, const CorpusOptions &options)
+            : graph(graph), options(options), rng(options.seed) {
+    }
+
+    void write(FILE *file, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            const auto json = generate();
+            fwrite(json.data(), 1, json.size(), file);
+            fputc('\n', file);
+        }
+    }
+
+    std::string generate() {
+        out.clear();
+        writeObject(graph.root, 0);
+        return out;
+    }
+
+private:
+    void writeObject(const Node &object, int indent) {
+        std::vector<const Node *> keys;
+        for (const auto *child : object.children) {
+            if (isPresent(*child)) {
+                keys.push_back(child);
+            }
+        }
+        if (options.shuffleKeys) {
+            std::shuffle(keys.begin(), keys.end(), rng);
+        }
+        const bool addUnknownKey = chance(options.unknownKeys);
+        const size_t unknownIndex = addUnknownKey ? random(0, keys.size()) : SIZE_MAX;
+
+        out += '{';
+        bool first = true;
+        for (size_t i = 0; i <= keys.size(); ++i) {
+            if (i == unknownIndex) {
+                writeKey(getUnknownKey(object), first, indent + 1);
+                writeUnknownValue(indent + 1, 0);
+            }
+            if (i < keys.size()) {
+                writeKey(keys[i]->name, first, indent + 1);
+                writeField(*keys[i], indent + 1);
+            }
+        }
+        if (!first) {
+            newline(indent);
+        }
+        out += '}';
+    }
+
+    void writeField(const Node &key, int indent) {
+        if (key.type != NodeType::ARRAY) {
+            writeValue(key, indent);
+            return;
+        }
+        assert(key.children.size() == 1);
+        size_t length = options.arrayLength.sample(rng);
+        if (key.constraints.has_min_items) {
+            length = std::max<size_t>(length, key.constraints.min_items);
+        }
+        if (key.constraints.has_max_items) {
+            length = std::min<size_t>(length, key.constraints.max_items);
+        }
+        out += '[';
+        for (size_t i = 0; i < length; ++i) {
+            if (i > 0) {
+                out += ',';
+                if (options.whitespace == Whitespace::SPACED) {
+                    out += ' ';
+                }
+            }
+            newline(indent + 1);
+            writeValue(*key.children[0], indent + 1);
+        }
+        if (length > 0) {
+            newline(indent);
+        }
+        out += ']';
+    }
+
+    void writeValue(const Node &node, int indent) {
+        switch (node.type) {
+            case NodeType::BOOL:
+                out += chance(0.5) ? "true" : "false";
+                break;
+            case NodeType::LONG:
+                out += std::to_string(getLong(node));
+                break;
+            case NodeType::DOUBLE:
+                out += getDouble(node);
+                break;
+            case NodeType::STRING:
+                writeString(getString(node.constraints));
+                break;
+            case NodeType::OUTSIDE_OBJECT:
+                assert(node.children.size() == 1);
+                writeObject(*node.children[0], indent);
+                break;
+            default:
+                throw std::runtime_error("Unexpected node " + node.full_name());
+        }
+    }
+
+    long long getLong(const Node &node) {
+        const auto &field = *node.field;
+        if (field.type() == FieldDescriptor::TYPE_ENUM) {
+            const auto &constraints = node.constraints;
+            const auto &values = *field.enum_type();
+            std::vector<int> numbers;
+            for (int i = 0; i < values.value_count(); ++i) {
+                const int number = values.value(i)->number();
+                if ((!constraints.has_min_value || number >= constraints.min_value) &&
+                    (!constraints.has_max_value || number <= constraints.max_value)) {
+                    numbers.push_back(number);
+                }
+            }
+            if (numbers.empty()) {
+                throw std::runtime_error("No value of " + values.full_name() + " satisfies the constraints of " +
+                                         node.full_name());
+            }
+            return numbers[random(0, numbers.size() - 1)];
+        }
+        long long lo = 0;
+        long long hi = 1000000;
+        switch (field.cpp_type()) {
+            case FieldDescriptor::CPPTYPE_INT32:
+                lo = -1000;
+                break;
+            case FieldDescriptor::CPPTYPE_INT64:
+                lo = -1000000;
+                hi = 1000000000000LL;
+                break;
+            case FieldDescriptor::CPPTYPE_UINT64:
+                hi = 1000000000000LL;
+                break;
+            default:
+                break;
+        }
+        const auto &constraints = node.constraints;
+        if (constraints.has_min_value) {
+            lo = static_cast<long long>(ceil(constraints.min_value));
+            hi = std::max(hi, lo);
+        }
+        if (constraints.has_max_value) {
+            hi = static_cast<long long>(floor(constraints.max_value));
+            lo = std::min(lo, hi);
+        }
+        return std::uniform_int_distribution<long long>(lo, hi)(rng);
+    }
+
+    std::string getDouble(const Node &node) {
+        const auto &constraints = node.constraints;
+        double lo = constraints.has_min_value ? constraints.min_value
+                                              : constraints.has_max_value ? constraints.max_value - 1000 : 0;
+        double hi = constraints.has_max_value ? constraints.max_value : lo + 1000;
+        const double v = std::uniform_real_distribution<double>(lo, hi)(rng);
+        // most real numbers have few decimals. Fall back to full precision if rounding leaves the range.
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", static_cast<int>(random(0, 6)), v);
+        const double rounded = strtod(buf, nullptr);
+        if (rounded < lo || rounded > hi) {
+            snprintf(buf, sizeof(buf), "%.17g", v);
+        }
+        return buf;
+    }
+
+    std::string getString(const Constraints &constraints) {
+        static const std::string alphabet = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ";
+        static const std::string special = "\"\\/\n\t";
+        const size_t affixes = constraints.prefix.size() + constraints.suffix.size();
+        size_t length = options.stringLength.sample(rng);
+        if (constraints.has_min_length && constraints.min_length > affixes) {
+            length = std::max<size_t>(length, constraints.min_length - affixes);
+        }
+        if (constraints.has_max_length) {
+            length = std::min<size_t>(length, constraints.max_length > affixes ? constraints.max_length - affixes : 0);
+        }
+        std::string s = constraints.prefix;
+        for (size_t i = 0; i < length; ++i) {
+            if (!constraints.allowed_chars.empty()) {
+                s += constraints.allowed_chars[random(0, constraints.allowed_chars.size() - 1)];
+            } else if (chance(1.0 / 64)) {
+                s += special[random(0, special.size() - 1)];
+            } else {
+                s += alphabet[random(0, alphabet.size() - 1)];
+            }
+        }
+        return s + constraints.suffix;
+    }
+
+    void writeUnknownValue(int indent, int depth) {
+        switch (random(0, depth < 2 ? 5 : 3)) {
+            case 0:
+                out += "null";
+                break;
+            case 1:
+                out += chance(0.5) ? "true" : "false";
+                break;
+            case 2:
+                out += std::to_string(random(0, 100000));
+                break;
+            case 3:
+                writeString(getString(Constraints()));
+                break;
+            case 4: {
+                out += '[';
+                const size_t length = options.arrayLength.sample(rng);
+                for (size_t i = 0; i < length; ++i) {
+                    if (i > 0) {
+                        out += options.whitespace == Whitespace::SPACED ? ", " : ",";
+                    }
+                    newline(indent + 1);
+                    writeUnknownValue(indent + 1, depth + 1);
+                }
+                if (length > 0) {
+                    newline(indent);
+                }
+                out += ']';
+                break;
+            }
+            default: {
+                out += '{';
+                bool first = true;
+                for (size_t i = random(1, 3); i > 0; --i) {
+                    writeKey("k" + std::to_string(i), first, indent + 1);
+                    writeUnknownValue(indent + 1, depth + 1);
+                }
+                newline(indent);
+                out += '}';
+                break;
+            }
+        }
+    }
+
+    std::string getUnknownKey(const Node &object) {
+        for (size_t i = 0;; ++i) {
+            const auto key = "unknown_" + std::to_string(i);
+            const auto it = std::find_if(object.children.begin(), object.children.end(),
+                                         [&key](const Node *child) { return child->name == key; });
+            if (it == object.children.end()) {
+                return key;
+            }
+        }
+    }
+
+    void writeKey(const std::string &key, bool &first, int indent) {
+        if (!first) {
+            out += ',';
+            if (options.whitespace == Whitespace::SPACED) {
+                out += ' ';
+            }
+        }
+        first = false;
+        newline(indent);
+        writeString(key);
+        out += options.whitespace == Whitespace::COMPACT ? ":" : ": ";
+    }
+
+    void writeString(const std::string &s) {
+        out += '"';
+        for (const char c : s) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char buf[8];
+                        snprintf(buf, sizeof(buf), "\\u%04x", c);
+                        out += buf;
+                    } else {
+                        out += c;
+                    }
+            }
+        }
+        out += '"';
+    }
+
+    void newline(int indent) {
+        if (options.whitespace == Whitespace::PRETTY) {
+            out += '\n';
+            out.append(2 * indent, ' ');
+        }
+    }
+
+    bool isPresent(const Node &key) {
+        const auto &field = *key.field;
+        if (field.is_required() || (key.constraints.has_min_items && key.constraints.min_items > 0)) {
+            return true;
+        }
+        const auto it = options.fieldPresence.find(key.full_name());
+        return chance(it == options.fieldPresence.end() ? options.presence : it->second);
+    }
+
+    bool chance(double p) {
+        return std::uniform_real_distribution<double>(0, 1)(rng) < p;
+    }
+
+    size_t random(size_t lo, size_t hi) {
+        return std::uniform_int_distribution<size_t>(lo, hi)(rng);
+    }
+
+    const Graph &graph;
+    const CorpusOptions options;
+    std::mt19937_64 rng;
+    std::string out;
+};
+
+} // namespace protog
@@ -0,0 +1,332 @@
+#pragma once
+
+#include "sax_writer.h"
+
+namespace protog {
+
+// Backend for MessagePack input. The decoder is generated along with the state machine, so it needs no
+// library. Maps and arrays are announced with their sizes, so the decoder keeps the remaining items of
+// each open container and emits the end events itself. Like with RapidJSON, the chunks are collected and
+// decoded at once by parser_complete(). Values of unknown keys are captured as json.
+struct MsgpackWriter : public SaxWriter {
+    virtual ~MsgpackWriter() {}
+
+    virtual void printBackendIncludes(FILE *file) override {
+        fprintf(file, "#include <cmath>\n");
+        fprintf(file, "#include <limits>\n");
+    }
+
+    virtual void printBackendState(FILE *file, const char *t) override {
+        fprintf(file, "    // the message collected from the chunks\n");
+        fprintf(file, "    std::string input;\n");
+        fprintf(file, "    size_t consumed = 0;\n");
+        fprintf(file, "    struct frame_s {\n");
+        fprintf(file, "        size_t remaining; // keys and values of a map, items of an array\n");
+        fprintf(file, "        bool map;\n");
+        fprintf(file, "        bool first;\n");
+        fprintf(file, "    };\n");
+        fprintf(file, "    std::vector<frame_s> frames;\n\n");
+    }
+
+    virtual const char *getConsumed() override {
+        return "state.consumed";
+    }
+
+    virtual bool capturesRawInput() override {
+        return false;
+    }
+
+    virtual void printBackendCallbacks(FILE *file, const char *t) override {
+        fprintf(file, "static uint64_t %s_parser_impl_load(const unsigned char *p, size_t len) {\n", t);
+        fprintf(file, "    uint64_t v = 0;\n");
+        fprintf(file, "    for (size_t i = 0; i < len; ++i) {\n");
+        fprintf(file, "        v = (v << 8) | p[i];\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return v;\n");
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static void %s_parser_impl_capture_string(std::string &target, const unsigned char *s, size_t len) {\n", t);
+        fprintf(file, "    target.push_back('\"');\n");
+        fprintf(file, "    for (size_t i = 0; i < len; ++i) {\n");
+        fprintf(file, "        const unsigned char ch = s[i];\n");
+        fprintf(file, "        if (ch == '\"' || ch == '\\\\') {\n");
+        fprintf(file, "            target.push_back('\\\\');\n");
+        fprintf(file, "            target.push_back(ch);\n");
+        fprintf(file, "        } else if (ch < 0x20) {\n");
+        fprintf(file, "            char esc[8];\n");
+        fprintf(file, "            snprintf(esc, sizeof(esc), \"\\\\u%%04x\", ch);\n");
+        fprintf(file, "            target.append(esc);\n");
+        fprintf(file, "        } else {\n");
+        fprintf(file, "            target.push_back(ch);\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    target.push_back('\"');\n");
+        fprintf(file, "}\n\n");
+
+        // Decodes state.input and calls the parser_impl_parse_* callbacks like a json parser would. While a
+        // value of an unknown key is captured (state.unknownTarget), every token is also appended as json.
+        fprintf(file, "enum %s_parser_impl_kind { MSGPACK_NIL, MSGPACK_BOOLEAN, MSGPACK_INTEGER, MSGPACK_UNSIGNED, MSGPACK_FLOAT, MSGPACK_DOUBLE, MSGPACK_STR, MSGPACK_BIN, MSGPACK_MAP, MSGPACK_ARRAY, MSGPACK_UNSUPPORTED };\n\n", t);
+
+        fprintf(file, "static int %s_parser_impl_decode(%s_parser_state_s &state) {\n", t, t);
+        fprintf(file, "    const unsigned char *const begin = reinterpret_cast<const unsigned char *>(state.input.data());\n");
+        fprintf(file, "    const unsigned char *const end = begin + state.input.size();\n");
+        fprintf(file, "    const unsigned char *p = begin;\n");
+        fprintf(file, "    auto &frames = state.frames;\n");
+        fprintf(file, "    frames.clear();\n");
+        fprintf(file, "    bool decoded = false;\n");
+        fprintf(file, "    while (true) {\n");
+        fprintf(file, "        while (!frames.empty() && frames.back().remaining == 0) {\n");
+        fprintf(file, "            const bool map = frames.back().map;\n");
+        fprintf(file, "            frames.pop_back();\n");
+        fprintf(file, "            if (state.unknownTarget) {\n");
+        fprintf(file, "                state.unknownTarget->push_back(map ? '}' : ']');\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            if (!(map ? %s_parser_impl_parse_end_map(&state) : %s_parser_impl_parse_end_array(&state))) {\n", t, t);
+        fprintf(file, "                return 0;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (frames.empty() && decoded) {\n");
+        fprintf(file, "            break;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        decoded = true;\n");
+        fprintf(file, "        if (PROTOG_UNLIKELY(p == end)) {\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"premature end of input\");\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        const bool key = !frames.empty() && frames.back().map && frames.back().remaining %% 2 == 0;\n");
+        fprintf(file, "        if (!frames.empty()) {\n");
+        fprintf(file, "            auto &frame = frames.back();\n");
+        fprintf(file, "            --frame.remaining;\n");
+        fprintf(file, "            if (key || !frame.map) {\n");
+        fprintf(file, "                if (state.unknownTarget && !frame.first) {\n");
+        fprintf(file, "                    state.unknownTarget->push_back(',');\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                frame.first = false;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "\n");
+        fprintf(file, "        // the kind of the value, and the width of the big-endian field that follows the type byte\n");
+        fprintf(file, "        const unsigned char type = *p++;\n");
+        fprintf(file, "        %s_parser_impl_kind kind = MSGPACK_UNSUPPORTED;\n", t);
+        fprintf(file, "        size_t width = 0;\n");
+        fprintf(file, "        uint64_t field = 0;\n");
+        fprintf(file, "        if (type <= 0x7f) {\n");
+        fprintf(file, "            kind = MSGPACK_UNSIGNED;\n");
+        fprintf(file, "            field = type;\n");
+        fprintf(file, "        } else if (type <= 0x8f) {\n");
+        fprintf(file, "            kind = MSGPACK_MAP;\n");
+        fprintf(file, "            field = type & 0x0f;\n");
+        fprintf(file, "        } else if (type <= 0x9f) {\n");
+        fprintf(file, "            kind = MSGPACK_ARRAY;\n");
+        fprintf(file, "            field = type & 0x0f;\n");
+        fprintf(file, "        } else if (type <= 0xbf) {\n");
+        fprintf(file, "            kind = MSGPACK_STR;\n");
+        fprintf(file, "            field = type & 0x1f;\n");
+        fprintf(file, "        } else if (type >= 0xe0) {\n");
+        fprintf(file, "            kind = MSGPACK_INTEGER;\n");
+        fprintf(file, "            field = static_cast<uint64_t>(static_cast<int64_t>(static_cast<int8_t>(type)));\n");
+        fprintf(file, "        } else {\n");
+        fprintf(file, "            switch (type) {\n");
+        fprintf(file, "                case 0xc0: kind = MSGPACK_NIL; break;\n");
+        fprintf(file, "                case 0xc2: kind = MSGPACK_BOOLEAN; field = 0; break;\n");
+        fprintf(file, "                case 0xc3: kind = MSGPACK_BOOLEAN; field = 1; break;\n");
+        fprintf(file, "                case 0xc4: kind = MSGPACK_BIN; width = 1; break;\n");
+        fprintf(file, "                case 0xc5: kind = MSGPACK_BIN; width = 2; break;\n");
+        fprintf(file, "                case 0xc6: kind = MSGPACK_BIN; width = 4; break;\n");
+        fprintf(file, "                case 0xca: kind = MSGPACK_FLOAT; width = 4; break;\n");
+        fprintf(file, "                case 0xcb: kind = MSGPACK_DOUBLE; width = 8; break;\n");
+        fprintf(file, "                case 0xcc: kind = MSGPACK_UNSIGNED; width = 1; break;\n");
+        fprintf(file, "                case 0xcd: kind = MSGPACK_UNSIGNED; width = 2; break;\n");
+        fprintf(file, "                case 0xce: kind = MSGPACK_UNSIGNED; width = 4; break;\n");
+        fprintf(file, "                case 0xcf: kind = MSGPACK_UNSIGNED; width = 8; break;\n");
+        fprintf(file, "                case 0xd0: kind = MSGPACK_INTEGER; width = 1; break;\n");
+        fprintf(file, "                case 0xd1: kind = MSGPACK_INTEGER; width = 2; break;\n");
+        fprintf(file, "                case 0xd2: kind = MSGPACK_INTEGER; width = 4; break;\n");
+        fprintf(file, "                case 0xd3: kind = MSGPACK_INTEGER; width = 8; break;\n");
+        fprintf(file, "                case 0xd9: kind = MSGPACK_STR; width = 1; break;\n");
+        fprintf(file, "                case 0xda: kind = MSGPACK_STR; width = 2; break;\n");
+        fprintf(file, "                case 0xdb: kind = MSGPACK_STR; width = 4; break;\n");
+        fprintf(file, "                case 0xdc: kind = MSGPACK_ARRAY; width = 2; break;\n");
+        fprintf(file, "                case 0xdd: kind = MSGPACK_ARRAY; width = 4; break;\n");
+        fprintf(file, "                case 0xde: kind = MSGPACK_MAP; width = 2; break;\n");
+        fprintf(file, "                case 0xdf: kind = MSGPACK_MAP; width = 4; break;\n");
+        fprintf(file, "                default: break; // ext types and the unused 0xc1\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (PROTOG_UNLIKELY(static_cast<size_t>(end - p) < width)) {\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"premature end of input\");\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (width) {\n");
+        fprintf(file, "            field = %s_parser_impl_load(p, width);\n", t);
+        fprintf(file, "            p += width;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (kind == MSGPACK_INTEGER && width && width < 8) { // sign extension\n");
+        fprintf(file, "            const uint64_t sign = static_cast<uint64_t>(1) << (width * 8 - 1);\n");
+        fprintf(file, "            field = (field ^ sign) - sign;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (PROTOG_UNLIKELY(key && kind != MSGPACK_STR)) {\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"map key is not a string\");\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        std::string *const capture = state.unknownTarget;\n");
+        fprintf(file, "        int rc = 1;\n");
+        fprintf(file, "        switch (kind) {\n");
+        fprintf(file, "            case MSGPACK_NIL:\n");
+        fprintf(file, "                if (capture) {\n");
+        fprintf(file, "                    capture->append(\"null\");\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                state.consumed = p - begin;\n");
+        fprintf(file, "                rc = %s_parser_impl_parse_null(&state);\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            case MSGPACK_BOOLEAN:\n");
+        fprintf(file, "                if (capture) {\n");
+        fprintf(file, "                    capture->append(field ? \"true\" : \"false\");\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                state.consumed = p - begin;\n");
+        fprintf(file, "                rc = %s_parser_impl_parse_boolean(&state, static_cast<int>(field));\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            case MSGPACK_UNSIGNED:\n");
+        fprintf(file, "                if (PROTOG_UNLIKELY(field > static_cast<uint64_t>(std::numeric_limits<long long>::max()))) {\n");
+        fprintf(file, "                    return %s_parser_impl_fail(state, \"integer overflow\");\n", t);
+        fprintf(file, "                }\n");
+        fprintf(file, "                // fall through\n");
+        fprintf(file, "            case MSGPACK_INTEGER:\n");
+        fprintf(file, "                if (capture) {\n");
+        fprintf(file, "                    capture->append(std::to_string(static_cast<long long>(field)));\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                state.consumed = p - begin;\n");
+        fprintf(file, "                rc = %s_parser_impl_parse_integer(&state, static_cast<long long>(field));\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            case MSGPACK_FLOAT:\n");
+        fprintf(file, "            case MSGPACK_DOUBLE: {\n");
+        fprintf(file, "                double v;\n");
+        fprintf(file, "                if (kind == MSGPACK_FLOAT) {\n");
+        fprintf(file, "                    const uint32_t bits = static_cast<uint32_t>(field);\n");
+        fprintf(file, "                    float f;\n");
+        fprintf(file, "                    memcpy(&f, &bits, sizeof(f));\n");
+        fprintf(file, "                    v = f;\n");
+        fprintf(file, "                } else {\n");
+        fprintf(file, "                    memcpy(&v, &field, sizeof(v));\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                if (capture) {\n");
+        fprintf(file, "                    char num[32];\n");
+        fprintf(file, "                    snprintf(num, sizeof(num), \"%%.17g\", v);\n");
+        fprintf(file, "                    capture->append(std::isfinite(v) ? num : \"null\"); // json has no nan and inf\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                state.consumed = p - begin;\n");
+        fprintf(file, "                // Encoders may write any number as a float. Integral values go to the integer callback,\n");
+        fprintf(file, "                // which floating point fields accept as well; -0.0 keeps its sign as a double.\n");
+        fprintf(file, "                if (v == std::trunc(v) && v >= -9223372036854775808.0 && v < 9223372036854775808.0 &&\n");
+        fprintf(file, "                        !(v == 0 && std::signbit(v))) {\n");
+        fprintf(file, "                    rc = %s_parser_impl_parse_integer(&state, static_cast<long long>(v));\n", t);
+        fprintf(file, "                } else {\n");
+        fprintf(file, "                    rc = %s_parser_impl_parse_double(&state, v);\n", t);
+        fprintf(file, "                }\n");
+        fprintf(file, "                break;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            case MSGPACK_STR:\n");
+        fprintf(file, "            case MSGPACK_BIN: {\n");
+        fprintf(file, "                if (PROTOG_UNLIKELY(static_cast<uint64_t>(end - p) < field)) {\n");
+        fprintf(file, "                    return %s_parser_impl_fail(state, \"premature end of input\");\n", t);
+        fprintf(file, "                }\n");
+        fprintf(file, "                const unsigned char *s = p;\n");
+        fprintf(file, "                p += field;\n");
+        fprintf(file, "                if (capture) {\n");
+        fprintf(file, "                    %s_parser_impl_capture_string(*capture, s, field);\n", t);
+        fprintf(file, "                    if (key) {\n");
+        fprintf(file, "                        capture->push_back(':');\n");
+        fprintf(file, "                    }\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                state.consumed = p - begin;\n");
+        fprintf(file, "                rc = key ? %s_parser_impl_parse_map_key(&state, s, field) : %s_parser_impl_parse_string(&state, s, field);\n", t, t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            case MSGPACK_MAP:\n");
+        fprintf(file, "            case MSGPACK_ARRAY:\n");
+        fprintf(file, "                // every item takes at least one byte, which bounds the counts by the input\n");
+        fprintf(file, "                if (PROTOG_UNLIKELY(static_cast<uint64_t>(end - p) < (kind == MSGPACK_MAP ? 2 : 1) * field)) {\n");
+        fprintf(file, "                    return %s_parser_impl_fail(state, \"premature end of input\");\n", t);
+        fprintf(file, "                }\n");
+        fprintf(file, "                if (capture) {\n");
+        fprintf(file, "                    capture->push_back(kind == MSGPACK_MAP ? '{' : '[');\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                state.consumed = p - begin;\n");
+        fprintf(file, "                rc = kind == MSGPACK_MAP ? %s_parser_impl_parse_start_map(&state) : %s_parser_impl_parse_start_array(&state);\n", t, t);
+        fprintf(file, "                frames.push_back({static_cast<size_t>((kind == MSGPACK_MAP ? 2 : 1) * field), kind == MSGPACK_MAP, true});\n");
+        fprintf(file, "                break;\n");
+        fprintf(file, "            case MSGPACK_UNSUPPORTED:\n");
+        fprintf(file, "                return %s_parser_impl_fail(state, \"unsupported msgpack type\");\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (!rc) {\n");
+        fprintf(file, "            return 0;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (PROTOG_UNLIKELY(p != end)) {\n");
+        fprintf(file, "        return %s_parser_impl_fail(state, \"trailing bytes after the message\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    virtual void printBackendApiImpl(FILE *file, const char *t, const char *c) override {
+        fprintf(file, "%s_parser_state_t %s_parser_init(%s &msg, const %s_parser_config_s &config) {\n", t, t, c, t);
+        fprintf(file, "    %s_parser_state_t state = new %s_parser_state_s(msg);\n", t, t);
+        fprintf(file, "    state->config = config;\n");
+        fprintf(file, "    return state;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "void %s_parser_free(%s_parser_state_t state) {\n", t, t);
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    delete state;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "int %s_parser_on_chunk(%s_parser_state_t state, char *chunk, size_t chunkLen) {\n", t, t);
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    if (!state->error.empty()) {\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    %s_parser_impl_start(*state);\n", t);
+        fprintf(file, "    state->input.append(chunk, chunkLen);\n");
+        fprintf(file, "    return 0;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "int %s_parser_complete(%s_parser_state_t state) {\n", t, t);
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    if (!state->error.empty()) {\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    state->chunk = state->input.c_str();\n");
+        fprintf(file, "    state->chunkOffset = 0;\n");
+        fprintf(file, "    const bool ok = %s_parser_impl_decode(*state) != 0;\n", t);
+        fprintf(file, "    state->chunk = nullptr;\n");
+        fprintf(file, "    state->offset = state->input.size();\n");
+        fprintf(file, "    PROTOG_PROBE4(parse_end, \"%s\", state->location, state->offset, ok);\n", t);
+        fprintf(file, "    %s_parser_impl_record(*state, ok);\n", t);
+        fprintf(file, "    return !ok;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "int %s_parser_reset(%s_parser_state_t state) {\n", t, t);
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    if (state) {\n");
+        fprintf(file, "        state->reset();\n");
+        fprintf(file, "        state->input.clear();\n");
+        fprintf(file, "        state->consumed = 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 0;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "char *%s_parser_get_error(%s_parser_state_t state) {\n", t, t);
+        fprintf(file, "    return %s_parser_get_error(state, 0, 0, 0);\n", t);
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "char *%s_parser_get_error(%s_parser_state_t state, int verbose, const char *chunk,\n", t, t);
+        fprintf(file, "                                  size_t chunkLen) {\n");
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    return strdup(state && !state->error.empty() ? state->error.c_str() : \"no error\");\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "void %s_parser_free_error(%s_parser_state_t state, char *err) {\n", t, t);
+        fprintf(file, "    free(err);\n");
+        fprintf(file, "}\n\n");
+    }
+};
+
+} // namespace protog
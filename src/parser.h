@@ -3,14 +3,21 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <cmath>
 #include <functional>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include <google/protobuf/descriptor.h>
+#include <google/protobuf/descriptor.pb.h>
+#include <google/protobuf/unknown_field_set.h>
 #include <google/protobuf/compiler/parser.h>
 #include <google/protobuf/io/zero_copy_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
@@ -20,6 +27,8 @@ using google::protobuf::DescriptorPool;
 using google::protobuf::FieldDescriptor;
 using google::protobuf::FileDescriptor;
 using google::protobuf::FileDescriptorProto;
+using google::protobuf::UnknownField;
+using google::protobuf::UnknownFieldSet;
 using google::protobuf::compiler::Parser;
 using google::protobuf::io::FileInputStream;
 using google::protobuf::io::Tokenizer;
@@ -56,12 +65,12 @@ static NodeType getNodeTypeForProtoType(FieldDescriptor::Type type) {
         case FieldDescriptor::TYPE_DOUBLE:
             return NodeType::DOUBLE;
         case FieldDescriptor::TYPE_STRING:
+        case FieldDescriptor::TYPE_BYTES: // filled like strings, without base64
             return NodeType::STRING;
         case FieldDescriptor::TYPE_MESSAGE:
             return NodeType::OUTSIDE_OBJECT;
         case FieldDescriptor::TYPE_ENUM:
             return NodeType::LONG;
-        case FieldDescriptor::TYPE_BYTES: // TODO
         default:
             throw std::runtime_error("Unsupported protobuf type " + std::to_string(static_cast<int>(type)));
     }
@@ -72,7 +81,7 @@ static std::string getTypeNameForFieldDesc(const FieldDescriptor &fieldDesc) {
                                                              : fieldDesc.type_name();
 }
 
-static std::string replace_all(std::string str, const std::string& from, const std::string& to) {
+inline std::string replace_all(std::string str, const std::string& from, const std::string& to) {
     size_t start_pos = 0;
     while((start_pos = str.find(from, start_pos)) != std::string::npos) {
         str.replace(start_pos, from.length(), to);
@@ -81,7 +90,7 @@ static std::string replace_all(std::string str, const std::string& from, const s
     return str;
 }
 
-static std::vector<std::string> split(const std::string& str, const char delim, bool include_empty = false) {
+inline std::vector<std::string> split(const std::string& str, const char delim, bool include_empty = false) {
     std::vector<std::string> result;
     std::stringstream ss{str};
     std::string item;
@@ -93,6 +102,121 @@ static std::vector<std::string> split(const std::string& str, const char delim,
     return result;
 }
 
+// field numbers of the options in protog.proto
+enum class ConstraintOption : int {
+    MIN_VALUE = 51200,
+    MAX_VALUE = 51201,
+    MIN_LENGTH = 51202,
+    MAX_LENGTH = 51203,
+    PREFIX = 51204,
+    SUFFIX = 51205,
+    ALLOWED_CHARS = 51206,
+    MIN_ITEMS = 51207,
+    MAX_ITEMS = 51208,
+    STREAM = 51209,
+    KEEP_ITEMS = 51210,
+};
+
+struct Constraints {
+    bool has_min_value = false;
+    double min_value = 0;
+    bool has_max_value = false;
+    double max_value = 0;
+    bool has_min_length = false;
+    uint64_t min_length = 0;
+    bool has_max_length = false;
+    uint64_t max_length = 0;
+    std::string prefix;
+    std::string suffix;
+    std::string allowed_chars;
+    bool has_min_items = false;
+    uint64_t min_items = 0;
+    bool has_max_items = false;
+    uint64_t max_items = 0;
+    bool has_keep_items = false; // not a constraint, the parser drops the other items
+    uint64_t keep_items = 0;
+
+    bool empty() const {
+        return !has_min_value && !has_max_value && !has_min_length && !has_max_length && prefix.empty() &&
+               suffix.empty() && allowed_chars.empty() && !has_min_items && !has_max_items;
+    }
+};
+
+// The options are not compiled into protog, so the pool keeps them as unknown fields of the field options.
+static Constraints getConstraintsForFieldDesc(const FieldDescriptor &fieldDesc) {
+    Constraints constraints;
+    const UnknownFieldSet &options = fieldDesc.options().unknown_fields();
+    for (int i = 0; i < options.field_count(); ++i) {
+        const UnknownField &option = options.field(i);
+        double d = 0;
+        if (option.type() == UnknownField::TYPE_FIXED64) {
+            const uint64_t bits = option.fixed64();
+            memcpy(&d, &bits, sizeof(d));
+        }
+        switch (static_cast<ConstraintOption>(option.number())) {
+            case ConstraintOption::MIN_VALUE:
+                constraints.has_min_value = true;
+                constraints.min_value = d;
+                break;
+            case ConstraintOption::MAX_VALUE:
+                constraints.has_max_value = true;
+                constraints.max_value = d;
+                break;
+            case ConstraintOption::MIN_LENGTH:
+                constraints.has_min_length = true;
+                constraints.min_length = option.varint();
+                break;
+            case ConstraintOption::MAX_LENGTH:
+                constraints.has_max_length = true;
+                constraints.max_length = option.varint();
+                break;
+            case ConstraintOption::PREFIX:
+                constraints.prefix = option.length_delimited();
+                break;
+            case ConstraintOption::SUFFIX:
+                constraints.suffix = option.length_delimited();
+                break;
+            case ConstraintOption::ALLOWED_CHARS:
+                constraints.allowed_chars = option.length_delimited();
+                break;
+            case ConstraintOption::MIN_ITEMS:
+                constraints.has_min_items = true;
+                constraints.min_items = option.varint();
+                break;
+            case ConstraintOption::MAX_ITEMS:
+                constraints.has_max_items = true;
+                constraints.max_items = option.varint();
+                break;
+            case ConstraintOption::KEEP_ITEMS:
+                constraints.has_keep_items = true;
+                constraints.keep_items = option.varint();
+                break;
+            default:
+                break;
+        }
+    }
+    // the bounds are printed into the parser as literals, which exist only for finite values
+    if ((constraints.has_min_value && !std::isfinite(constraints.min_value)) ||
+        (constraints.has_max_value && !std::isfinite(constraints.max_value))) {
+        throw std::runtime_error("Field " + fieldDesc.full_name() + " must have finite min_value and max_value");
+    }
+    return constraints;
+}
+
+static bool isStreamedFieldDesc(const FieldDescriptor &fieldDesc) {
+    const UnknownFieldSet &options = fieldDesc.options().unknown_fields();
+    bool stream = false;
+    for (int i = 0; i < options.field_count(); ++i) {
+        if (options.field(i).number() == static_cast<int>(ConstraintOption::STREAM)) {
+            stream = options.field(i).varint() != 0;
+        }
+    }
+    if (stream && (getNodeTypeForProtoType(fieldDesc.type()) != NodeType::STRING || fieldDesc.is_repeated())) {
+        throw std::runtime_error("Streamed field " + fieldDesc.full_name() + " must be a non-repeated string or bytes");
+    }
+    return stream;
+}
+
 struct Node {
     // structure
     Node *parent;
@@ -101,27 +225,54 @@ struct Node {
     // node info
     NodeType type;
     int state;
-    std::string name;
-    std::string full_name; // including path
-    std::string type_name;
+    int frame = 0; // nesting level of the message that the values are written to, 0 for the root message
+    const char *name;      // interned by the Graph
+    const char *type_name; // interned by the Graph
     const Descriptor *desc;
     const FieldDescriptor *field;
+    const FieldDescriptor *unknown_field = nullptr; // collects unknown keys of this object
+    Constraints constraints;
+    bool stream = false; // string value is decoded in pieces, see (protog.stream)
+
+    // path of the node, e.g. ".my_inner.a" or ".my_list[]."; built on demand, since most nodes never need it
+    std::string full_name() const {
+        size_t size = 0;
+        for (const Node *node = this; node; node = node->parent) {
+            size += strlen(node->path_part());
+        }
+        std::string path(size, '.');
+        for (const Node *node = this; node; node = node->parent) {
+            const char *part = node->path_part();
+            const size_t len = strlen(part);
+            size -= len;
+            memcpy(&path[size], part, len);
+        }
+        return path;
+    }
 
-    ~Node() {
-        for(auto& child : children) {
-            delete child;
+    const char *path_part() const {
+        if (!parent || type == NodeType::INSIDE_OBJECT) {
+            return ".";
         }
+        return parent->type == NodeType::ARRAY ? "[]" : name;
     }
 };
 
 struct Graph {
     std::string fname;
     std::string msgName;
+    std::vector<std::string> includePaths;
     DescriptorPool pool;
     const FileDescriptor *fileDesc;
     const Descriptor *msgDesc;
+    std::string unknownFieldName;
     int stateCounter = 0;
+    int skipState = 0;
     Node root;
+    // nodes are handed out from blocks that live as long as the Graph, names are shared through the pool
+    std::vector<std::unique_ptr<Node[]>> nodeBlocks;
+    size_t nodeBlockUsed = 0;
+    std::unordered_set<std::string> names;
     std::vector<Node *> all_nodes;
     std::vector<Node *> null_nodes;
     std::vector<Node *> bool_nodes;
@@ -132,22 +283,16 @@ struct Graph {
     std::vector<Node *> key_nodes;
     std::vector<Node *> array_nodes;
 
-    Graph(const std::string &fname, const std::string &msgName) : fname(fname), msgName(msgName) {
+    Graph(const std::string &fname, const std::string &msgName, const std::vector<std::string> &includePaths = {})
+            : fname(fname), msgName(msgName), includePaths(includePaths) {
         root.state = ++stateCounter;
 
-        int fd = open(fname.c_str(), O_RDONLY);
-        if (fd < 0) {
-            throw std::runtime_error("Unable to open proto file " + fname);
-        }
-
-        ZeroCopyInputStream *input = new FileInputStream(fd);
-        Tokenizer tokenizer{input, nullptr};
+        // imports are looked up next to the proto file first
+        const auto slash = fname.find_last_of('/');
+        this->includePaths.insert(this->includePaths.begin(), slash == std::string::npos ? "." : fname.substr(0, slash));
 
-        Parser parser;
         FileDescriptorProto protoDesc;
-        if (!parser.Parse(&tokenizer, &protoDesc)) {
-            throw std::runtime_error("Unable to parse proto file " + fname);
-        }
+        parseProtoFile(fname, protoDesc);
 
         protoDesc.set_name("XXX"); // TODO: what is this name for?
         protoDesc.CheckInitialized();
@@ -160,6 +305,7 @@ struct Graph {
         printf("\n");
 #endif
 
+        loadDependencies(protoDesc);
         fileDesc = pool.BuildFile(protoDesc);
         if (!fileDesc) {
             throw std::runtime_error("Unable to load proto file " + fname);
@@ -171,36 +317,104 @@ struct Graph {
         }
     }
 
+    void parseProtoFile(const std::string &path, FileDescriptorProto &protoDesc) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Unable to open proto file " + path);
+        }
+
+        FileInputStream input{fd};
+        input.SetCloseOnDelete(true);
+        Tokenizer tokenizer{&input, nullptr};
+
+        Parser parser;
+        if (!parser.Parse(&tokenizer, &protoDesc)) {
+            throw std::runtime_error("Unable to parse proto file " + path);
+        }
+    }
+
+    void loadDependencies(const FileDescriptorProto &protoDesc) {
+        for (int i = 0; i < protoDesc.dependency_size(); ++i) {
+            const auto &name = protoDesc.dependency(i);
+            if (pool.FindFileByName(name)) {
+                continue;
+            }
+
+            FileDescriptorProto depDesc;
+            // files compiled into libprotobuf (e.g. google/protobuf/descriptor.proto) are not on disk
+            const FileDescriptor *compiledDesc = DescriptorPool::generated_pool()->FindFileByName(name);
+            if (compiledDesc) {
+                compiledDesc->CopyTo(&depDesc);
+            } else {
+                parseProtoFile(findProtoFile(name), depDesc);
+                depDesc.set_name(name);
+            }
+
+            loadDependencies(depDesc);
+            if (!pool.BuildFile(depDesc)) {
+                throw std::runtime_error("Unable to load imported proto file " + name);
+            }
+        }
+    }
+
+    std::string findProtoFile(const std::string &name) const {
+        for (const auto &dir : includePaths) {
+            const auto path = dir + "/" + name;
+            if (access(path.c_str(), R_OK) == 0) {
+                return path;
+            }
+        }
+        throw std::runtime_error("Unable to find imported proto file " + name);
+    }
+
     void parseMessageDesc() {
         const auto &desc = *msgDesc;
 
         root.parent = nullptr;
         root.name = ".";
-        root.full_name = ".";
-        root.type_name = desc.name();
+        root.type_name = desc.name().c_str();
         root.type = NodeType::INSIDE_OBJECT;
         root.desc = &desc;
         root.field = nullptr;
         addNodeToTypeLists(root);
 
         parseMessageDescRec(desc, root);
+
+        // reserved state for values of unknown keys that get skipped or captured
+        skipState = ++stateCounter;
     }
 
     void parseMessageDescRec(const Descriptor &desc, Node &node) {
         for (int f = 0; f < desc.field_count(); ++f) {
             const FieldDescriptor &fieldDesc = *desc.field(f);
+            if (!unknownFieldName.empty() && fieldDesc.name() == unknownFieldName) {
+                if (fieldDesc.type() != FieldDescriptor::TYPE_STRING || fieldDesc.is_repeated()) {
+                    throw std::runtime_error("Unknown key field " + fieldDesc.full_name() + " must be a non-repeated string");
+                }
+                node.unknown_field = &fieldDesc;
+                continue;
+            }
+
             const auto type = getNodeTypeForProtoType(fieldDesc.type());
             const auto isRepeated = fieldDesc.is_repeated();
 
             Node &child = addChild(node);
-            child.name = fieldDesc.name();
-            child.full_name = node.full_name + child.name;
+            child.name = fieldDesc.name().c_str();
             child.field = &fieldDesc;
             child.desc = &desc;
+            child.constraints = getConstraintsForFieldDesc(fieldDesc);
+            child.stream = isStreamedFieldDesc(fieldDesc);
+            if (child.stream && (child.constraints.has_min_length || !child.constraints.prefix.empty() ||
+                                 !child.constraints.suffix.empty() || !child.constraints.allowed_chars.empty())) {
+                throw std::runtime_error("Streamed field " + fieldDesc.full_name() + " only supports max_length");
+            }
+            if (child.constraints.has_keep_items && !isRepeated) {
+                throw std::runtime_error("Field " + fieldDesc.full_name() + " must be repeated to use keep_items");
+            }
 
             if (!isRepeated) {
                 child.type = type;
-                child.type_name = getTypeNameForFieldDesc(fieldDesc);
+                child.type_name = intern(getTypeNameForFieldDesc(fieldDesc));
                 addNodeToTypeLists(child);
                 if (type == NodeType::OUTSIDE_OBJECT) {
                     Node& objChild = injectObjectNode(desc, fieldDesc, child);
@@ -208,7 +422,7 @@ struct Graph {
                 }
             } else {
                 child.type = NodeType::ARRAY;
-                child.type_name = "[" + getTypeNameForFieldDesc(fieldDesc) + "]";
+                child.type_name = intern("[" + getTypeNameForFieldDesc(fieldDesc) + "]");
                 addNodeToTypeLists(child);
                 Node& arrChild = injectArrayNode(desc, fieldDesc, type, child);
                 if (type == NodeType::OUTSIDE_OBJECT) {
@@ -221,12 +435,12 @@ struct Graph {
 
     Node& injectArrayNode(const Descriptor &desc, const FieldDescriptor& fieldDesc, NodeType type, Node& node) {
         Node &arrChild = addChild(node);
-        arrChild.name = fieldDesc.name();
-        arrChild.full_name = node.full_name + "[]";
+        arrChild.name = fieldDesc.name().c_str();
         arrChild.type = type; // specifies what type to expect in array
-        arrChild.type_name = getTypeNameForFieldDesc(fieldDesc);
+        arrChild.type_name = intern(getTypeNameForFieldDesc(fieldDesc));
         arrChild.field = &fieldDesc;
         arrChild.desc = &desc;
+        arrChild.constraints = node.constraints;
         addNodeToTypeLists(arrChild);
         return arrChild;
     }
@@ -234,7 +448,7 @@ struct Graph {
     Node& injectObjectNode(const Descriptor &desc, const FieldDescriptor& fieldDesc, Node& keyNode) {
         Node &objNode = addChild(keyNode);
         objNode.name = keyNode.name;
-        objNode.full_name = keyNode.full_name + ".";
+        objNode.frame = keyNode.frame + 1;
         objNode.type = NodeType::INSIDE_OBJECT;
         objNode.type_name = keyNode.type_name;
         objNode.field = &fieldDesc;
@@ -278,10 +492,65 @@ struct Graph {
         }
     }
 
+    struct Reduction {
+        int statesBefore;
+        int statesAfter;
+        size_t casesBefore;
+        size_t casesAfter;
+    };
+
+    // Merges states that the json grammar keeps apart. A message value is entered through its key node, which
+    // only sees the value (null or the start of the object), and then lives in the injected object node, which
+    // only sees keys and the end of the object. The same holds for the item node of an array of messages,
+    // which sees items and the end of the array. Each pair can share one state, so the start of the object no
+    // longer has to chain through to another state. The object nodes' null cases are dropped, since an object
+    // body never sees null. States are numbered densely afterwards.
+    Reduction minimize() {
+        Reduction reduction{stateCounter + 1, 0, countCases(), 0};
+        null_nodes.erase(std::remove_if(null_nodes.begin(), null_nodes.end(), [](const Node *node) {
+            return node->type == NodeType::INSIDE_OBJECT;
+        }), null_nodes.end());
+        for (auto &node : object_nodes) {
+            if (node->parent) {
+                node->state = node->parent->state;
+            }
+        }
+
+        std::vector<int> numbers(stateCounter + 1, 0);
+        stateCounter = 0;
+        for (auto &node : all_nodes) {
+            if (numbers[node->state] == 0) {
+                numbers[node->state] = ++stateCounter;
+            }
+            node->state = numbers[node->state];
+        }
+        skipState = ++stateCounter;
+
+        reduction.statesAfter = stateCounter + 1;
+        reduction.casesAfter = countCases();
+        return reduction;
+    }
+
+    // case labels of the generated callbacks, not counting the skip state
+    size_t countCases() const {
+        return null_nodes.size() + bool_nodes.size() + long_nodes.size() + double_nodes.size() + string_nodes.size() +
+               object_nodes.size() * 3 + array_nodes.size() * 2;
+    }
+
+    const char *intern(const std::string &name) {
+        return names.insert(name).first->c_str();
+    }
+
     Node &addChild(Node &node) {
-        node.children.push_back(new Node());
-        auto& child = *node.children.back();
+        static const size_t blockSize = 256;
+        if (nodeBlocks.empty() || nodeBlockUsed == blockSize) {
+            nodeBlocks.emplace_back(new Node[blockSize]());
+            nodeBlockUsed = 0;
+        }
+        auto& child = nodeBlocks.back()[nodeBlockUsed++];
+        node.children.push_back(&child);
         child.parent = &node;
+        child.frame = node.frame;
         child.state = ++stateCounter;
         return child;
     }
@@ -291,7 +560,7 @@ struct Graph {
     }
 
     void printDebugRec(FILE* file, const Node& node, int depth) const {
-        printf(">> %s (type=%s, type_id=%d, state=%d\n", node.full_name.c_str(), node.type_name.c_str(), node.type, node.state);
+        printf(">> %s (type=%s, type_id=%d, state=%d\n", node.full_name().c_str(), node.type_name, node.type, node.state);
         for (const auto &child : node.children) {
             printDebugRec(file, *child, depth + 1);
         }
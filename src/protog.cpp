@@ -2,6 +2,7 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <algorithm>
 #include <functional>
@@ -16,7 +17,10 @@
 #include <google/protobuf/io/zero_copy_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 
+#include "msgpack_writer.h"
 #include "parser.h"
+#include "rapidjson_writer.h"
+#include "transcoder_writer.h"
 #include "yajl_writer.h"
 
 static const char* DEFAULT_OUTPUT_DIR = ".";
@@ -30,6 +34,16 @@ void print_help(FILE* f) {
     fprintf(f, "  -m PROTO_MESSAGE   Fully qualified name of the message for which the\n");
     fprintf(f, "                     parser code should be generated.\n");
     fprintf(f, "  -i PROTO_INCLUDE   Name of the header file generated by protoc.\n");
+    fprintf(f, "  -I IMPORT_DIR      Folder to search for imported proto files. Can be given\n");
+    fprintf(f, "                     multiple times. The folder of PROTO_FILE is searched first.\n");
+    fprintf(f, "  -u UNKNOWN_FIELD   Name of a string field that collects unknown keys and\n");
+    fprintf(f, "                     their raw json values of the message it belongs to.\n");
+    fprintf(f, "  -b BACKEND         json parser the generated code is built on: yajl (default)\n");
+    fprintf(f, "                     or rapidjson. msgpack generates a MessagePack decoder.\n");
+    fprintf(f, "  -O                 Merge parser states that never see the same json events\n");
+    fprintf(f, "                     and print the reduction.\n");
+    fprintf(f, "  -t                 Generate a transcoder from protobuf wire format to json\n");
+    fprintf(f, "                     (NAME_json.pb.h/.cc) instead of a parser.\n");
     fprintf(f, "  -o OUTPUT_DIR      Folder where generated source files should be placed\n");
     fprintf(f, "                     It defaults to \"%s\".\n", DEFAULT_OUTPUT_DIR);
     fprintf(f, "Example usage:\n");
@@ -38,15 +52,20 @@ void print_help(FILE* f) {
 
 int main(int argc, char **argv) {
     bool debug = false;
+    bool transcoder = false;
+    bool minimize = false;
     const char* output_dir = DEFAULT_OUTPUT_DIR;
     // TODO: derive proto header name from proto_file
     const char* proto_include = NULL;
     const char* proto_message = NULL;
     const char* proto_file = NULL;
+    const char* unknown_field = NULL;
+    const char* backend = "yajl";
+    std::vector<std::string> import_dirs;
 
     int c;
     opterr = 0;
-    while ((c = getopt(argc, argv, "hdo:i:m:p:")) != -1) {
+    while ((c = getopt(argc, argv, "hdOto:i:I:m:p:u:b:")) != -1) {
         switch (c) {
         case 'h':
             print_help(stdout);
@@ -54,6 +73,12 @@ int main(int argc, char **argv) {
         case 'd':
             debug = true;
             break;
+        case 'O':
+            minimize = true;
+            break;
+        case 't':
+            transcoder = true;
+            break;
         case 'p':
             proto_file = optarg;
             break;
@@ -63,28 +88,58 @@ int main(int argc, char **argv) {
         case 'i':
             proto_include = optarg;
             break;
+        case 'I':
+            import_dirs.push_back(optarg);
+            break;
         case 'o':
             output_dir = optarg;
             break;
+        case 'u':
+            unknown_field = optarg;
+            break;
+        case 'b':
+            backend = optarg;
+            break;
         default:
             print_help(stderr);
             exit(EXIT_FAILURE);
         }
     }
 
-    if (!proto_file || !proto_message || !proto_include || !output_dir) {
+    if (!proto_file || !proto_message || (!proto_include && !transcoder) || !output_dir) {
         fprintf(stderr, "Missing required argument.\n");
         print_help(stderr);
         exit(EXIT_FAILURE);
     }
 
-    protog::Graph graph{proto_file, proto_message};
+    protog::Graph graph{proto_file, proto_message, import_dirs};
+    if (unknown_field) {
+        graph.unknownFieldName = unknown_field;
+    }
     graph.parseMessageDesc();
+    if (minimize) {
+        const auto reduction = graph.minimize();
+        printf("%s: %d to %d states, %zu to %zu cases\n", proto_message, reduction.statesBefore,
+               reduction.statesAfter, reduction.casesBefore, reduction.casesAfter);
+    }
     if (debug) {
         graph.printDebug(stdout);
     }
 
-    auto writer = std::make_shared<protog::YajlWriter>();
+    std::shared_ptr<protog::Writer> writer;
+    if (transcoder) {
+        writer = std::make_shared<protog::TranscoderWriter>();
+    } else if (strcmp(backend, "yajl") == 0) {
+        writer = std::make_shared<protog::YajlWriter>();
+    } else if (strcmp(backend, "rapidjson") == 0) {
+        writer = std::make_shared<protog::RapidjsonWriter>();
+    } else if (strcmp(backend, "msgpack") == 0) {
+        writer = std::make_shared<protog::MsgpackWriter>();
+    } else {
+        fprintf(stderr, "Unknown backend %s.\n", backend);
+        print_help(stderr);
+        exit(EXIT_FAILURE);
+    }
     writer->write(graph, proto_include);
 
     return 0;
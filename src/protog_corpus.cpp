@@ -0,0 +1,142 @@
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "corpus_writer.h"
+#include "parser.h"
+
+void print_help(FILE* f) {
+    fprintf(f, "Usage: protog_corpus [OPTIONS]\n");
+    fprintf(f, "Generate random json documents that are valid for the given proto message. Each document\n");
+    fprintf(f, "ends with a newline, but spans several lines with -w pretty:\n");
+    fprintf(f, "  -h                 Print this help message.\n");
+    fprintf(f, "  -p PROTO_FILE      The protobuf file containing the desired proto message.\n");
+    fprintf(f, "  -m PROTO_MESSAGE   Fully qualified name of the message.\n");
+    fprintf(f, "  -I IMPORT_DIR      Folder to search for imported proto files. Can be given\n");
+    fprintf(f, "                     multiple times. The folder of PROTO_FILE is searched first.\n");
+    fprintf(f, "  -u UNKNOWN_FIELD   Name of the unknown key field (see protog -u). It is never generated.\n");
+    fprintf(f, "  -n COUNT           Number of documents. It defaults to 1000.\n");
+    fprintf(f, "  -s SEED            Seed of the random generator. It defaults to 42.\n");
+    fprintf(f, "  -P [FIELD=]P       Probability of optional fields to be present. Without FIELD it sets\n");
+    fprintf(f, "                     the default (0.8), otherwise the probability of the field with the\n");
+    fprintf(f, "                     given path, e.g. .my_inner.a or .my_list[].b. Can be given multiple times.\n");
+    fprintf(f, "  -a DISTRIBUTION    Length of arrays. It defaults to uniform:0:4.\n");
+    fprintf(f, "  -l DISTRIBUTION    Length of strings. It defaults to geometric:8.\n");
+    fprintf(f, "                     DISTRIBUTION is fixed:N, uniform:MIN:MAX or geometric:MEAN.\n");
+    fprintf(f, "  -k                 Shuffle the order of keys in each object.\n");
+    fprintf(f, "  -w WHITESPACE      One of compact (default), spaced or pretty.\n");
+    fprintf(f, "  -x P               Probability of each object to contain an unknown key.\n");
+    fprintf(f, "  -o OUTPUT_FILE     File to write to. It defaults to stdout.\n");
+    fprintf(f, "Example usage:\n");
+    fprintf(f, "  protog_corpus -p openrtb.proto -m com.google.openrtb.BidRequest -n 10000 -k -x 0.1\n");
+}
+
+int main(int argc, char **argv) {
+    const char* proto_message = NULL;
+    const char* proto_file = NULL;
+    const char* unknown_field = NULL;
+    const char* output_file = NULL;
+    std::vector<std::string> import_dirs;
+    size_t count = 1000;
+    protog::CorpusOptions options;
+
+    try {
+        int c;
+        opterr = 0;
+        while ((c = getopt(argc, argv, "hp:m:I:u:n:s:P:a:l:kw:x:o:")) != -1) {
+            switch (c) {
+            case 'h':
+                print_help(stdout);
+                exit(EXIT_SUCCESS);
+            case 'p':
+                proto_file = optarg;
+                break;
+            case 'm':
+                proto_message = optarg;
+                break;
+            case 'I':
+                import_dirs.push_back(optarg);
+                break;
+            case 'u':
+                unknown_field = optarg;
+                break;
+            case 'n':
+                count = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                options.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'P': {
+                const char *eq = strchr(optarg, '=');
+                if (eq) {
+                    options.fieldPresence[std::string(optarg, eq - optarg)] = atof(eq + 1);
+                } else {
+                    options.presence = atof(optarg);
+                }
+                break;
+            }
+            case 'a':
+                options.arrayLength = protog::Distribution::parse(optarg);
+                break;
+            case 'l':
+                options.stringLength = protog::Distribution::parse(optarg);
+                break;
+            case 'k':
+                options.shuffleKeys = true;
+                break;
+            case 'w':
+                if (strcmp(optarg, "compact") == 0) {
+                    options.whitespace = protog::Whitespace::COMPACT;
+                } else if (strcmp(optarg, "spaced") == 0) {
+                    options.whitespace = protog::Whitespace::SPACED;
+                } else if (strcmp(optarg, "pretty") == 0) {
+                    options.whitespace = protog::Whitespace::PRETTY;
+                } else {
+                    throw std::runtime_error(std::string("Invalid whitespace style ") + optarg);
+                }
+                break;
+            case 'x':
+                options.unknownKeys = atof(optarg);
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            default:
+                print_help(stderr);
+                exit(EXIT_FAILURE);
+            }
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        exit(EXIT_FAILURE);
+    }
+
+    if (!proto_file || !proto_message) {
+        fprintf(stderr, "Missing required argument.\n");
+        print_help(stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    protog::Graph graph{proto_file, proto_message, import_dirs};
+    if (unknown_field) {
+        graph.unknownFieldName = unknown_field;
+    }
+    graph.parseMessageDesc();
+
+    FILE* file = output_file ? fopen(output_file, "w") : stdout;
+    if (!file) {
+        fprintf(stderr, "Unable to open %s\n", output_file);
+        exit(EXIT_FAILURE);
+    }
+    protog::CorpusWriter writer{graph, options};
+    writer.write(file, count);
+    if (output_file) {
+        fclose(file);
+    }
+
+    return 0;
+}
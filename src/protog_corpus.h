@@ -0,0 +1,36 @@
+#pragma once
+
+// Reads the files written by protog_corpus. Its documents can span several lines (see -w pretty), so they are
+// split by their nesting instead of by line.
+
+#include <string>
+#include <vector>
+
+namespace protog {
+
+// Appends each top level json object or array of text to documents. Whitespace between them is dropped.
+inline void splitDocuments(const std::string &text, std::vector<std::string> &documents) {
+    size_t depth = 0;
+    size_t start = 0;
+    bool inString = false;
+    for (size_t i = 0; i < text.size(); ++i) {
+        const char c = text[i];
+        if (inString) {
+            if (c == '\\') {
+                ++i;
+            } else if (c == '"') {
+                inString = false;
+            }
+        } else if (c == '"') {
+            inString = true;
+        } else if (c == '{' || c == '[') {
+            if (depth++ == 0) {
+                start = i;
+            }
+        } else if ((c == '}' || c == ']') && depth > 0 && --depth == 0) {
+            documents.push_back(text.substr(start, i + 1 - start));
+        }
+    }
+}
+
+} // namespace protog
@@ -0,0 +1,402 @@
+#pragma once
+
+// Loads many small files, e.g. archived json documents, and hands each one to a pool of worker threads
+// that run generated parsers. With io_uring, the calling thread submits the opens, reads into registered
+// (fixed) buffers and closes of up to `buffers` files at a time, and reacts to their completions only. A
+// worker hands its buffer back through an eventfd whose read is part of the ring, so the loop never
+// blocks on anything but completions. Without io_uring (old kernels, seccomp filters), the workers open
+// and read their files with plain syscalls instead. Linux only.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace protog {
+
+class FileLoader {
+public:
+    // Called on a worker thread for each file. worker identifies the thread (0 <= worker < workers), so
+    // that each one can keep its own parser state. data stays valid until the handler returns.
+    typedef std::function<void(size_t worker, size_t file, char *data, size_t len)> Handler;
+    // Called for files that cannot be opened or read, or are not smaller than bufferSize (EFBIG).
+    // It may be called from several threads at once.
+    typedef std::function<void(size_t file, int err)> ErrorHandler;
+
+    FileLoader(size_t workers, size_t buffers = 64, size_t bufferSize = 1 << 20, bool useIoUring = true)
+            : workers(workers ? workers : 1), bufferSize(bufferSize) {
+        if (useIoUring) {
+            setupRing(buffers ? buffers : 1);
+        }
+        if (ring < 0) {
+            allocateBuffers(this->workers);
+        }
+    }
+
+    FileLoader(const FileLoader &) = delete;
+    FileLoader &operator=(const FileLoader &) = delete;
+
+    ~FileLoader() {
+        teardownRing();
+        for (char *buffer : buffers) {
+            free(buffer);
+        }
+    }
+
+    // whether files are read through io_uring, or by the thread pool fallback
+    bool usesIoUring() const {
+        return ring >= 0;
+    }
+
+    // Reads all paths and returns once every file was handled or failed.
+    void load(const std::vector<std::string> &paths, const Handler &handle, const ErrorHandler &fail) {
+        if (ring >= 0) {
+            loadWithRing(paths, handle, fail);
+        } else {
+            loadWithThreads(paths, handle, fail);
+        }
+    }
+
+private:
+    enum Op : uint64_t { OPEN = 1, READ, CLOSE, WAKEUP };
+
+    struct Slot {
+        size_t file;
+        int fd;
+    };
+
+    struct Job {
+        size_t slot;
+        size_t len;
+    };
+
+    void allocateBuffers(size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            void *buffer = nullptr;
+            if (posix_memalign(&buffer, 4096, bufferSize) != 0) {
+                abort();
+            }
+            buffers.push_back(static_cast<char *>(buffer));
+        }
+    }
+
+    // fallback: every worker opens and reads the next file into its own buffer
+    void loadWithThreads(const std::vector<std::string> &paths, const Handler &handle, const ErrorHandler &fail) {
+        std::atomic<size_t> next{0};
+        std::vector<std::thread> threads;
+        for (size_t worker = 0; worker < workers; ++worker) {
+            threads.emplace_back([&, worker]() {
+                char *buffer = buffers[worker];
+                for (size_t file; (file = next.fetch_add(1)) < paths.size();) {
+                    const int fd = open(paths[file].c_str(), O_RDONLY | O_CLOEXEC);
+                    if (fd < 0) {
+                        fail(file, errno);
+                        continue;
+                    }
+                    size_t len = 0;
+                    ssize_t n;
+                    while ((n = read(fd, buffer + len, bufferSize - len)) > 0 && (len += n) < bufferSize) {
+                    }
+                    const int err = n < 0 ? errno : 0;
+                    close(fd);
+                    if (err || len == bufferSize) {
+                        fail(file, err ? err : EFBIG);
+                    } else {
+                        handle(worker, file, buffer, len);
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    void loadWithRing(const std::vector<std::string> &paths, const Handler &handle, const ErrorHandler &fail) {
+        std::vector<Slot> slots(buffers.size());
+        std::vector<size_t> freeSlots;
+        for (size_t i = slots.size(); i > 0; --i) {
+            freeSlots.push_back(i - 1);
+        }
+
+        // the worker pool, which hands buffers back through returned and the eventfd
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<Job> jobs;
+        std::vector<size_t> returned;
+        bool finished = false;
+        std::vector<std::thread> threads;
+        for (size_t worker = 0; worker < workers; ++worker) {
+            threads.emplace_back([&, worker]() {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (true) {
+                    cond.wait(lock, [&]() { return finished || !jobs.empty(); });
+                    if (jobs.empty()) {
+                        return;
+                    }
+                    const Job job = jobs.front();
+                    jobs.pop_front();
+                    lock.unlock();
+                    handle(worker, slots[job.slot].file, buffers[job.slot], job.len);
+                    lock.lock();
+                    returned.push_back(job.slot);
+                    const uint64_t one = 1;
+                    if (write(wakeupFd, &one, sizeof(one)) != sizeof(one)) {
+                        abort();
+                    }
+                }
+            });
+        }
+
+        uint64_t wakeups = 0;
+        prepare(IORING_OP_READ, wakeupFd, &wakeups, sizeof(wakeups), WAKEUP << 32);
+        size_t nextFile = 0;
+        size_t completed = 0; // files handed to a worker or failed
+        while (completed < paths.size()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                freeSlots.insert(freeSlots.end(), returned.begin(), returned.end());
+                returned.clear();
+            }
+            while (!freeSlots.empty() && nextFile < paths.size()) {
+                const size_t slot = freeSlots.back();
+                freeSlots.pop_back();
+                slots[slot].file = nextFile;
+                slots[slot].fd = -1;
+                struct io_uring_sqe *sqe = prepare(IORING_OP_OPENAT, AT_FDCWD, paths[nextFile].c_str(), 0,
+                                                   (OPEN << 32) | slot);
+                sqe->open_flags = O_RDONLY | O_CLOEXEC;
+                ++nextFile;
+            }
+            submit(1);
+            unsigned head = *cqHead;
+            const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const struct io_uring_cqe &cqe = cqes[head & *cqMask];
+                const uint64_t op = cqe.user_data >> 32;
+                const size_t slot = cqe.user_data & 0xffffffff;
+                if (op == WAKEUP) {
+                    prepare(IORING_OP_READ, wakeupFd, &wakeups, sizeof(wakeups), WAKEUP << 32);
+                } else if (op == CLOSE) {
+                    --closesInFlight;
+                } else if (op == OPEN && cqe.res >= 0) {
+                    slots[slot].fd = cqe.res;
+                    struct io_uring_sqe *sqe = prepare(IORING_OP_READ_FIXED, cqe.res, buffers[slot], bufferSize,
+                                                       (READ << 32) | slot);
+                    sqe->buf_index = static_cast<uint16_t>(slot);
+                } else if (op == OPEN || op == READ) {
+                    if (slots[slot].fd >= 0) {
+                        prepare(IORING_OP_CLOSE, slots[slot].fd, nullptr, 0, CLOSE << 32);
+                    }
+                    const size_t len = cqe.res > 0 ? static_cast<size_t>(cqe.res) : 0;
+                    if (op == READ && cqe.res >= 0 && len < bufferSize) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        jobs.push_back({slot, len});
+                        cond.notify_one();
+                    } else {
+                        fail(slots[slot].file, cqe.res < 0 ? -cqe.res : EFBIG);
+                        freeSlots.push_back(slot);
+                    }
+                    ++completed;
+                }
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            cond.notify_all();
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        // reap the outstanding closes, so that no fd leaks into the next load(), and complete the wakeup
+        // read, which writes into this stack frame
+        const uint64_t one = 1;
+        if (write(wakeupFd, &one, sizeof(one)) != sizeof(one)) {
+            abort();
+        }
+        while (closesInFlight || wakeupArmed) {
+            submit(1);
+            unsigned head = *cqHead;
+            const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const uint64_t op = cqes[head & *cqMask].user_data >> 32;
+                closesInFlight -= op == CLOSE;
+                wakeupArmed = wakeupArmed && op != WAKEUP;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    struct io_uring_sqe *prepare(uint8_t opcode, int fd, const void *addr, uint32_t len, uint64_t userData) {
+        unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries) {
+            submit(0);
+        }
+        struct io_uring_sqe *sqe = &sqes[tail & *sqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(addr);
+        sqe->len = len;
+        sqe->user_data = userData;
+        sqArray[tail & *sqMask] = tail & *sqMask;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++toSubmit;
+        closesInFlight += opcode == IORING_OP_CLOSE;
+        wakeupArmed = wakeupArmed || fd == wakeupFd;
+        return sqe;
+    }
+
+    // submits the prepared entries and waits for minComplete completions
+    void submit(unsigned minComplete) {
+        while (true) {
+            const long rc = syscall(__NR_io_uring_enter, ring, toSubmit, minComplete,
+                                    minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (rc >= 0) {
+                toSubmit -= static_cast<unsigned>(rc);
+                return;
+            }
+            if (errno != EINTR) {
+                abort();
+            }
+        }
+    }
+
+    void setupRing(size_t bufferCount) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        // every buffer has at most two operations in flight (open or read, then close), plus the wakeup
+        const unsigned entries = static_cast<unsigned>(2 * bufferCount + 1);
+        ring = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring < 0) {
+            return;
+        }
+        sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sqRingBytes = cqRingBytes = std::max(sqRingBytes, cqRingBytes);
+        }
+        sqRing = mmap(nullptr, sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        cqRing = params.features & IORING_FEAT_SINGLE_MMAP
+                 ? sqRing
+                 : mmap(nullptr, cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+        sqesBytes = params.sq_entries * sizeof(struct io_uring_sqe);
+        void *sqesMapped = mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqesMapped == MAP_FAILED) {
+            teardownRing();
+            return;
+        }
+        char *sq = static_cast<char *>(sqRing);
+        char *cq = static_cast<char *>(cqRing);
+        sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        sqEntries = params.sq_entries;
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+        sqes = static_cast<struct io_uring_sqe *>(sqesMapped);
+
+        if (!supportsOps() || (wakeupFd = eventfd(0, EFD_CLOEXEC)) < 0) {
+            teardownRing();
+            return;
+        }
+        allocateBuffers(bufferCount);
+        std::vector<struct iovec> iovecs;
+        for (char *buffer : buffers) {
+            iovecs.push_back({buffer, bufferSize});
+        }
+        if (syscall(__NR_io_uring_register, ring, IORING_REGISTER_BUFFERS, iovecs.data(), iovecs.size()) != 0) {
+            teardownRing();
+            for (char *buffer : buffers) {
+                free(buffer);
+            }
+            buffers.clear();
+        }
+    }
+
+    // openat, read and close need Linux 5.6
+    bool supportsOps() {
+        const size_t ops = 256;
+        std::vector<char> memory(sizeof(struct io_uring_probe) + ops * sizeof(struct io_uring_probe_op), 0);
+        auto *probe = reinterpret_cast<struct io_uring_probe *>(memory.data());
+        if (syscall(__NR_io_uring_register, ring, IORING_REGISTER_PROBE, probe, ops) != 0) {
+            return false;
+        }
+        for (const uint8_t op : {IORING_OP_OPENAT, IORING_OP_READ_FIXED, IORING_OP_READ, IORING_OP_CLOSE}) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void teardownRing() {
+        if (sqes) {
+            munmap(sqes, sqesBytes);
+        }
+        if (cqRing && cqRing != MAP_FAILED && cqRing != sqRing) {
+            munmap(cqRing, cqRingBytes);
+        }
+        if (sqRing && sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingBytes);
+        }
+        if (ring >= 0) {
+            close(ring);
+        }
+        if (wakeupFd >= 0) {
+            close(wakeupFd);
+        }
+        sqes = nullptr;
+        sqRing = cqRing = nullptr;
+        ring = wakeupFd = -1;
+    }
+
+    const size_t workers;
+    const size_t bufferSize;
+    std::vector<char *> buffers;
+
+    int ring = -1;
+    int wakeupFd = -1;
+    void *sqRing = nullptr;
+    void *cqRing = nullptr;
+    size_t sqRingBytes = 0;
+    size_t cqRingBytes = 0;
+    size_t sqesBytes = 0;
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqMask = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned sqEntries = 0;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned *cqMask = nullptr;
+    struct io_uring_cqe *cqes = nullptr;
+    struct io_uring_sqe *sqes = nullptr;
+    unsigned toSubmit = 0;
+    size_t closesInFlight = 0;
+    bool wakeupArmed = false;
+};
+
+} // namespace protog
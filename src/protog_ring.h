@@ -0,0 +1,312 @@
+#pragma once
+
+// Hands json bodies from a network process to parser worker processes, and the parsed messages back,
+// through shared memory. A ShmRing is a single producer, single consumer ring of records in a memfd,
+// which can be inherited by fork() or passed to another process like any file descriptor. The producer
+// writes each record in place (reserve/commit) and the consumer reads it in place (next/release), so a
+// body is never copied between processes. Both sides spin briefly and then sleep on a futex in the
+// shared mapping when the ring is empty or full. Linux only.
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+
+namespace protog {
+
+class ShmRing {
+public:
+    // flags of a record; the highest bit is reserved by the ring and dropped from the flags of reserve()
+    enum {
+        REJECTED = 1, // the worker could not parse the request, the payload is empty
+    };
+
+    ShmRing() = default;
+    ShmRing(const ShmRing &) = delete;
+    ShmRing &operator=(const ShmRing &) = delete;
+
+    ~ShmRing() {
+        if (header) {
+            munmap(header, mappedBytes);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // Creates a ring with room for capacity bytes of records (rounded up to a power of two, at most 4 GiB,
+    // since a record's length has 32 bits) in a new memfd. Returns 0 on success or an errno value.
+    int create(size_t capacity) {
+        if (capacity > MAX_CAPACITY) {
+            return EINVAL;
+        }
+        size_t rounded = 4096;
+        while (rounded < capacity) {
+            rounded *= 2;
+        }
+        const int memfd = memfd_create("protog_ring", MFD_CLOEXEC);
+        if (memfd < 0) {
+            return errno;
+        }
+        if (ftruncate(memfd, sizeof(Header) + rounded) != 0) {
+            const int err = errno;
+            ::close(memfd);
+            return err;
+        }
+        const int err = map(memfd);
+        if (err != 0) {
+            return err;
+        }
+        new (header) Header();
+        header->capacity = rounded;
+        header->magic = MAGIC;
+        return 0;
+    }
+
+    // Maps the ring in fd, which was created by create() in this or another process. The ring takes
+    // ownership of fd. Returns 0 on success or an errno value.
+    int attach(int fd) {
+        const int err = map(fd);
+        if (err != 0) {
+            return err;
+        }
+        if (mappedBytes < sizeof(Header) || header->magic != MAGIC || header->capacity > MAX_CAPACITY ||
+            sizeof(Header) + header->capacity != mappedBytes) {
+            return EINVAL;
+        }
+        return 0;
+    }
+
+    int getFd() const {
+        return fd;
+    }
+
+    // the largest payload that fits into the ring
+    size_t getMaxLength() const {
+        return header->capacity - sizeof(Record);
+    }
+
+    // Producer: returns room for a payload of len bytes, waiting until the consumer has released enough
+    // records. Returns nullptr if the ring is closed or len exceeds getMaxLength().
+    char *reserve(size_t len, uint64_t tag, uint32_t flags = 0) {
+        const uint64_t capacity = header->capacity;
+        const uint64_t total = align(sizeof(Record) + len);
+        if (len > getMaxLength() || header->closed.load()) {
+            return nullptr;
+        }
+        uint64_t head = header->head.load(std::memory_order_relaxed);
+        const uint64_t contiguous = capacity - head % capacity;
+        if (contiguous < total) {
+            // Records do not wrap around. The marker is published on its own, because a record that is
+            // larger than the rest of the ring needs the consumer to release the ring up to its start.
+            if (!waitForSpace(head, contiguous)) {
+                return nullptr;
+            }
+            Record *marker = at(head);
+            marker->len = 0;
+            marker->flags = WRAP;
+            head += contiguous;
+            publish(head);
+        }
+        if (!waitForSpace(head, total)) {
+            return nullptr;
+        }
+        Record *record = at(head);
+        record->len = static_cast<uint32_t>(len);
+        record->flags = flags & ~WRAP;
+        record->tag = tag;
+        reservedHead = head + total;
+        return reinterpret_cast<char *>(record + 1);
+    }
+
+    // Producer: publishes the record returned by the last reserve().
+    void commit() {
+        publish(reservedHead);
+    }
+
+    // Consumer: returns the payload of the next record, waiting until one is committed. Returns nullptr
+    // once the ring is closed and all records are consumed.
+    char *next(size_t *len, uint64_t *tag, uint32_t *flags = nullptr) {
+        const uint64_t capacity = header->capacity;
+        uint64_t tail = header->tail.load(std::memory_order_relaxed);
+        while (true) {
+            wait(header->dataSeq, header->consumerWaiting, [&]() {
+                return header->head.load() != tail || header->closed.load();
+            });
+            if (header->head.load() == tail) {
+                return nullptr; // closed
+            }
+            Record *record = at(tail);
+            if (record->flags & WRAP) {
+                tail += capacity - tail % capacity;
+                releaseTo(tail);
+                continue;
+            }
+            *len = record->len;
+            *tag = record->tag;
+            if (flags) {
+                *flags = record->flags;
+            }
+            releasedTail = tail + align(sizeof(Record) + record->len);
+            return reinterpret_cast<char *>(record + 1);
+        }
+    }
+
+    // Consumer: hands the record returned by the last next() back to the producer.
+    void release() {
+        releaseTo(releasedTail);
+    }
+
+    // Either side: no more records will be reserved. The consumer still gets the committed ones.
+    void close() {
+        header->closed.store(1);
+        header->dataSeq.fetch_add(1);
+        header->spaceSeq.fetch_add(1);
+        wake(header->dataSeq);
+        wake(header->spaceSeq);
+    }
+
+private:
+    static const uint64_t MAGIC = 0x70726f746f677231; // identifies the mapping of a ring
+    static const uint32_t WRAP = 0x80000000; // the rest of the ring is unused, continue at its start
+    // getMaxLength() of the largest ring still fits into Record::len
+    static const uint64_t MAX_CAPACITY = static_cast<uint64_t>(1) << 32;
+
+    struct Record {
+        uint32_t len;
+        uint32_t flags;
+        uint64_t tag;
+    };
+
+    // Each side owns a cache line, so that they do not invalidate each other's lines on every record.
+    struct Header {
+        uint64_t magic = 0;
+        uint64_t capacity = 0;
+        alignas(64) std::atomic<uint64_t> head{0}; // bytes committed by the producer
+        std::atomic<uint32_t> dataSeq{0};
+        std::atomic<uint32_t> consumerWaiting{0};
+        alignas(64) std::atomic<uint64_t> tail{0}; // bytes released by the consumer
+        std::atomic<uint32_t> spaceSeq{0};
+        std::atomic<uint32_t> producerWaiting{0};
+        alignas(64) std::atomic<uint32_t> closed{0};
+    };
+
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+                  "atomics in shared memory must be lock free");
+
+    static uint64_t align(uint64_t len) {
+        return (len + sizeof(Record) - 1) & ~static_cast<uint64_t>(sizeof(Record) - 1);
+    }
+
+    Record *at(uint64_t pos) const {
+        return reinterpret_cast<Record *>(reinterpret_cast<char *>(header + 1) + pos % header->capacity);
+    }
+
+    // Waits until len bytes from head are released by the consumer. Returns false if the ring is closed.
+    bool waitForSpace(uint64_t head, uint64_t len) {
+        wait(header->spaceSeq, header->producerWaiting, [&]() {
+            return header->capacity - (head - header->tail.load()) >= len || header->closed.load();
+        });
+        return !header->closed.load();
+    }
+
+    void publish(uint64_t head) {
+        header->head.store(head);
+        header->dataSeq.fetch_add(1);
+        if (header->consumerWaiting.exchange(0)) {
+            wake(header->dataSeq);
+        }
+    }
+
+    void releaseTo(uint64_t tail) {
+        header->tail.store(tail);
+        header->spaceSeq.fetch_add(1);
+        if (header->producerWaiting.exchange(0)) {
+            wake(header->spaceSeq);
+        }
+    }
+
+    int map(int memfd) {
+        struct stat st;
+        if (fstat(memfd, &st) != 0) {
+            const int err = errno;
+            ::close(memfd);
+            return err;
+        }
+        void *mapped = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (mapped == MAP_FAILED) {
+            const int err = errno;
+            ::close(memfd);
+            return err;
+        }
+        fd = memfd;
+        mappedBytes = st.st_size;
+        header = static_cast<Header *>(mapped);
+        return 0;
+    }
+
+    // Sleeps on seq until ready() holds. The other side bumps seq after each change and only wakes us
+    // if we announced to sleep through waiting, which keeps the syscall off the fast path.
+    template <typename Ready>
+    static void wait(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiting, Ready ready) {
+        for (int spin = 0; spin < 128; ++spin) {
+            if (ready()) {
+                return;
+            }
+        }
+        while (!ready()) {
+            const uint32_t s = seq.load();
+            waiting.store(1);
+            if (ready()) {
+                return;
+            }
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAIT, s, nullptr, nullptr, 0);
+        }
+    }
+
+    static void wake(std::atomic<uint32_t> &seq) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    int fd = -1;
+    size_t mappedBytes = 0;
+    Header *header = nullptr;
+    uint64_t reservedHead = 0;
+    uint64_t releasedTail = 0;
+};
+
+// The loop of a parser worker process. Each json body from requests is parsed in place with
+// parse(json, len, msg), which returns 0 on success or a non-zero error, and answered on responses with
+// the same tag and the message in wire format. Rejected bodies, and messages larger than the response
+// ring, are answered with a REJECTED record. Returns once requests is closed and drained, after closing
+// responses.
+template <typename Message, typename Parse>
+void serveParser(ShmRing &requests, ShmRing &responses, Message &msg, Parse parse) {
+    size_t len;
+    uint64_t tag;
+    while (char *json = requests.next(&len, &tag)) {
+        const bool parsed = parse(json, len, msg) == 0;
+        requests.release();
+        const size_t size = parsed ? msg.ByteSizeLong() : 0;
+        if (parsed && size <= responses.getMaxLength()) {
+            char *wire = responses.reserve(size, tag);
+            if (!wire) {
+                break;
+            }
+            msg.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t *>(wire));
+        } else if (!responses.reserve(0, tag, ShmRing::REJECTED)) {
+            break;
+        }
+        responses.commit();
+    }
+    responses.close();
+}
+
+} // namespace protog
@@ -0,0 +1,178 @@
+#pragma once
+
+// A tape holds the json events of one document. A document is tokenized once with TapeRecorder, and its
+// tape can then be replayed into any number of generated parsers with parser_replay(), which skips the
+// lexing. Tapes can be stored, but numbers are written in native byte order:
+//
+//   header   "PGT1", uint32 length of the json
+//   record   uint8 type, uint32 json offset behind the token, payload
+//
+//   type  event         payload
+//   0     null
+//   1     false
+//   2     true
+//   3     integer       int64
+//   4     double        double
+//   5     string        uint32 length, decoded bytes
+//   6     map key       uint32 length, decoded bytes
+//   7     map start
+//   8     map end
+//   9     array start
+//   10    array end
+//
+// The offsets let parser_replay() copy the raw json of unknown keys, if the json is passed along. They must not
+// decrease or exceed the length of the json, otherwise the tape is rejected as corrupt.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <limits>
+#include <string>
+
+#include <yajl/yajl_parse.h>
+
+namespace protog {
+
+enum TapeRecordType {
+    TAPE_NULL = 0,
+    TAPE_FALSE = 1,
+    TAPE_TRUE = 2,
+    TAPE_INTEGER = 3,
+    TAPE_DOUBLE = 4,
+    TAPE_STRING = 5,
+    TAPE_MAP_KEY = 6,
+    TAPE_MAP_START = 7,
+    TAPE_MAP_END = 8,
+    TAPE_ARRAY_START = 9,
+    TAPE_ARRAY_END = 10,
+};
+
+// Tokenizes json with yajl, which validates it like the yajl backend of protog does.
+class TapeRecorder {
+public:
+    // Replaces the contents of tape with the events of json. Returns 0 on success, otherwise getError()
+    // describes the problem.
+    int record(const char *json, size_t jsonLen, std::string &tape) {
+        tape.clear();
+        error.clear();
+        if (jsonLen > std::numeric_limits<uint32_t>::max()) {
+            error = "json exceeds 4 GiB";
+            return 1;
+        }
+        this->tape = &tape;
+        tape.append("PGT1", 4);
+        append(static_cast<uint32_t>(jsonLen));
+        handle = yajl_alloc(&getCallbacks(), nullptr, this);
+        yajl_config(handle, yajl_allow_comments, 0);
+        yajl_config(handle, yajl_dont_validate_strings, 0);
+        const unsigned char *uJson = reinterpret_cast<const unsigned char *>(json);
+        yajl_status stat = yajl_parse(handle, uJson, jsonLen);
+        if (stat == yajl_status_ok) {
+            stat = yajl_complete_parse(handle);
+        }
+        if (stat != yajl_status_ok) {
+            unsigned char *err = yajl_get_error(handle, 0, uJson, jsonLen);
+            error = reinterpret_cast<char *>(err);
+            yajl_free_error(handle, err);
+        }
+        yajl_free(handle);
+        handle = nullptr;
+        this->tape = nullptr;
+        return stat != yajl_status_ok;
+    }
+
+    const std::string &getError() const {
+        return error;
+    }
+
+private:
+    template <typename T>
+    void append(T value) {
+        tape->append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    int event(TapeRecordType type) {
+        tape->push_back(static_cast<char>(type));
+        append(static_cast<uint32_t>(yajl_get_bytes_consumed(handle)));
+        return 1;
+    }
+
+    int event(TapeRecordType type, const unsigned char *s, size_t len) {
+        event(type);
+        append(static_cast<uint32_t>(len));
+        tape->append(reinterpret_cast<const char *>(s), len);
+        return 1;
+    }
+
+    static TapeRecorder &self(void *ctx) {
+        return *static_cast<TapeRecorder *>(ctx);
+    }
+
+    static int onNull(void *ctx) {
+        return self(ctx).event(TAPE_NULL);
+    }
+
+    static int onBoolean(void *ctx, int b) {
+        return self(ctx).event(b ? TAPE_TRUE : TAPE_FALSE);
+    }
+
+    static int onInteger(void *ctx, long long v) {
+        self(ctx).event(TAPE_INTEGER);
+        self(ctx).append(static_cast<int64_t>(v));
+        return 1;
+    }
+
+    static int onDouble(void *ctx, double v) {
+        self(ctx).event(TAPE_DOUBLE);
+        self(ctx).append(v);
+        return 1;
+    }
+
+    static int onString(void *ctx, const unsigned char *s, size_t len) {
+        return self(ctx).event(TAPE_STRING, s, len);
+    }
+
+    static int onMapKey(void *ctx, const unsigned char *s, size_t len) {
+        return self(ctx).event(TAPE_MAP_KEY, s, len);
+    }
+
+    static int onStartMap(void *ctx) {
+        return self(ctx).event(TAPE_MAP_START);
+    }
+
+    static int onEndMap(void *ctx) {
+        return self(ctx).event(TAPE_MAP_END);
+    }
+
+    static int onStartArray(void *ctx) {
+        return self(ctx).event(TAPE_ARRAY_START);
+    }
+
+    static int onEndArray(void *ctx) {
+        return self(ctx).event(TAPE_ARRAY_END);
+    }
+
+    static const yajl_callbacks &getCallbacks() {
+        static const yajl_callbacks callbacks = {
+                onNull,
+                onBoolean,
+                onInteger,
+                onDouble,
+                nullptr,
+                onString,
+                onStartMap,
+                onMapKey,
+                onEndMap,
+                onStartArray,
+                onEndArray,
+        };
+        return callbacks;
+    }
+
+    std::string *tape = nullptr;
+    yajl_handle handle = nullptr;
+    std::string error;
+};
+
+} // namespace protog
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "sax_writer.h"
+
+namespace protog {
+
+// Backend for RapidJSON. Its reader is not incremental, so the chunks are collected in the state and
+// parsed at once by parser_complete(), in place unless raw values of unknown keys are captured. The
+// handler is a template argument of the reader, so the parser_impl_parse_* callbacks can be inlined.
+struct RapidjsonWriter : public SaxWriter {
+    virtual ~RapidjsonWriter() {}
+
+    virtual void printBackendIncludes(FILE *file) override {
+        fprintf(file, "#include <limits>\n\n");
+        fprintf(file, "#include <rapidjson/error/en.h>\n");
+        fprintf(file, "#include <rapidjson/reader.h>\n");
+    }
+
+    virtual void printBackendState(FILE *file, const char *t) override {
+        fprintf(file, "    // the document collected from the chunks\n");
+        fprintf(file, "    std::string input;\n");
+        fprintf(file, "    size_t consumed = 0;\n");
+        fprintf(file, "    rapidjson::Reader reader;\n\n");
+    }
+
+    virtual const char *getConsumed() override {
+        return "state.consumed";
+    }
+
+    virtual void printBackendCallbacks(FILE *file, const char *t) override {
+        // The string streams of RapidJSON are copied while a token is parsed, so their position lags behind
+        // within the callbacks. This stream is used by reference and decodes strings in place.
+        fprintf(file, "struct %s_parser_impl_stream {\n", t);
+        fprintf(file, "    typedef char Ch;\n");
+        fprintf(file, "\n");
+        fprintf(file, "    explicit %s_parser_impl_stream(char *src) : src(src), head(src), dst(nullptr) { }\n", t);
+        fprintf(file, "\n");
+        fprintf(file, "    Ch Peek() const { return *src; }\n");
+        fprintf(file, "    Ch Take() { return *src++; }\n");
+        fprintf(file, "    size_t Tell() const { return static_cast<size_t>(src - head); }\n");
+        fprintf(file, "    Ch *PutBegin() { return dst = src; }\n");
+        fprintf(file, "    void Put(Ch c) { *dst++ = c; }\n");
+        fprintf(file, "    void Flush() { }\n");
+        fprintf(file, "    size_t PutEnd(Ch *begin) { return static_cast<size_t>(dst - begin); }\n");
+        fprintf(file, "\n");
+        fprintf(file, "    char *src;\n");
+        fprintf(file, "    char *head;\n");
+        fprintf(file, "    char *dst;\n");
+        fprintf(file, "};\n\n");
+
+        fprintf(file, "struct %s_parser_impl_handler {\n", t);
+        fprintf(file, "    %s_parser_state_s &state;\n", t);
+        fprintf(file, "    const %s_parser_impl_stream &stream;\n", t);
+        fprintf(file, "\n");
+        fprintf(file, "    void *next() {\n");
+        fprintf(file, "        state.consumed = stream.Tell();\n");
+        fprintf(file, "        return &state;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "\n");
+        fprintf(file, "    bool Null() { return %s_parser_impl_parse_null(next()); }\n", t);
+        fprintf(file, "    bool Bool(bool b) { return %s_parser_impl_parse_boolean(next(), b); }\n", t);
+        fprintf(file, "    bool Int(int i) { return %s_parser_impl_parse_integer(next(), i); }\n", t);
+        fprintf(file, "    bool Uint(unsigned u) { return %s_parser_impl_parse_integer(next(), u); }\n", t);
+        fprintf(file, "    bool Int64(int64_t i) { return %s_parser_impl_parse_integer(next(), i); }\n", t);
+        fprintf(file, "    bool Uint64(uint64_t u) {\n");
+        fprintf(file, "        if (PROTOG_UNLIKELY(u > static_cast<uint64_t>(std::numeric_limits<long long>::max()))) {\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"integer overflow\");\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        return %s_parser_impl_parse_integer(next(), static_cast<long long>(u));\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    bool Double(double d) { return %s_parser_impl_parse_double(next(), d); }\n", t);
+        fprintf(file, "    bool RawNumber(const char *, rapidjson::SizeType, bool) { return false; } // kParseNumbersAsStringsFlag is not used\n");
+        fprintf(file, "    bool String(const char *s, rapidjson::SizeType len, bool) {\n");
+        fprintf(file, "        return %s_parser_impl_parse_string(next(), reinterpret_cast<const unsigned char *>(s), len);\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    bool StartObject() { return %s_parser_impl_parse_start_map(next()); }\n", t);
+        fprintf(file, "    bool Key(const char *s, rapidjson::SizeType len, bool) {\n");
+        fprintf(file, "        return %s_parser_impl_parse_map_key(next(), reinterpret_cast<const unsigned char *>(s), len);\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    bool EndObject(rapidjson::SizeType) { return %s_parser_impl_parse_end_map(next()); }\n", t);
+        fprintf(file, "    bool StartArray() { return %s_parser_impl_parse_start_array(next()); }\n", t);
+        fprintf(file, "    bool EndArray(rapidjson::SizeType) { return %s_parser_impl_parse_end_array(next()); }\n", t);
+        fprintf(file, "};\n\n");
+    }
+
+    virtual void printBackendApiImpl(FILE *file, const char *t, const char *c) override {
+        fprintf(file, "%s_parser_state_t %s_parser_init(%s &msg, const %s_parser_config_s &config) {\n", t, t, c, t);
+        fprintf(file, "    %s_parser_state_t state = new %s_parser_state_s(msg);\n", t, t);
+        fprintf(file, "    state->config = config;\n");
+        fprintf(file, "    return state;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "void %s_parser_free(%s_parser_state_t state) {\n", t, t);
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    delete state;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "int %s_parser_on_chunk(%s_parser_state_t state, char *chunk, size_t chunkLen) {\n", t, t);
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    if (!state->error.empty()) {\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    %s_parser_impl_start(*state);\n", t);
+        fprintf(file, "    state->input.append(chunk, chunkLen);\n");
+        fprintf(file, "    return 0;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "int %s_parser_complete(%s_parser_state_t state) {\n", t, t);
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    if (!state->error.empty()) {\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    // raw values of unknown keys are copied from the input, which must not be decoded in place then\n");
+        fprintf(file, "    const bool insitu = !state->config.captureUnknownKeys;\n");
+        fprintf(file, "    %s_parser_impl_stream stream(&state->input[0]);\n", t);
+        fprintf(file, "    %s_parser_impl_handler handler{*state, stream};\n", t);
+        fprintf(file, "    state->chunk = state->input.c_str();\n");
+        fprintf(file, "    state->chunkOffset = 0;\n");
+        fprintf(file, "    const rapidjson::ParseResult result = insitu\n");
+        fprintf(file, "            ? state->reader.Parse<rapidjson::kParseInsituFlag | rapidjson::kParseValidateEncodingFlag |\n");
+        fprintf(file, "                                  rapidjson::kParseFullPrecisionFlag>(stream, handler)\n");
+        fprintf(file, "            : state->reader.Parse<rapidjson::kParseValidateEncodingFlag | rapidjson::kParseFullPrecisionFlag>(stream, handler);\n");
+        fprintf(file, "    state->chunk = nullptr;\n");
+        fprintf(file, "    state->offset = state->input.size();\n");
+        fprintf(file, "    if (result.IsError() && state->error.empty()) { // rejected by rapidjson itself\n");
+        fprintf(file, "        PROTOG_PROBE4(error, \"%s\", state->location, result.Offset(), \"Invalid json\");\n", t);
+        fprintf(file, "        char err[256];\n");
+        fprintf(file, "        snprintf(err, sizeof(err), \"parse error: %%s at offset %%zu\", rapidjson::GetParseError_En(result.Code()), result.Offset());\n");
+        fprintf(file, "        state->error = err;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    PROTOG_PROBE4(parse_end, \"%s\", state->location, state->offset, !result.IsError());\n", t);
+        fprintf(file, "    %s_parser_impl_record(*state, !result.IsError());\n", t);
+        fprintf(file, "    return result.IsError();\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "int %s_parser_reset(%s_parser_state_t state) {\n", t, t);
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    if (state) {\n");
+        fprintf(file, "        state->reset();\n");
+        fprintf(file, "        state->input.clear();\n");
+        fprintf(file, "        state->consumed = 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 0;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "char *%s_parser_get_error(%s_parser_state_t state) {\n", t, t);
+        fprintf(file, "    return %s_parser_get_error(state, 0, 0, 0);\n", t);
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "char *%s_parser_get_error(%s_parser_state_t state, int verbose, const char *chunk,\n", t, t);
+        fprintf(file, "                                  size_t chunkLen) {\n");
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    return strdup(state && !state->error.empty() ? state->error.c_str() : \"no error\");\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "void %s_parser_free_error(%s_parser_state_t state, char *err) {\n", t, t);
+        fprintf(file, "    free(err);\n");
+        fprintf(file, "}\n\n");
+    }
+};
+
+} // namespace protog
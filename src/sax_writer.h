@@ -0,0 +1,1751 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "parser.h"
+#include "writer.h"
+
+namespace protog {
+
+// Emits a parser that is driven by the callbacks of a SAX style json parser. The callbacks implement the
+// state machine of the Graph and are shared by all backends, which only provide the glue to their parser.
+struct SaxWriter : public Writer {
+    virtual ~SaxWriter() {}
+
+    virtual void write(const Graph &graph, const char* proto_header) override {
+        auto name_lower = graph.root.desc->name();
+        std::transform(name_lower.begin(), name_lower.end(), name_lower.begin(), ::tolower);
+        cppTypeNames.clear();
+        const auto cpp_type = get_full_cpp_type_name(*graph.root.desc);
+        const auto res_name_prefix = name_lower + "_parser.pb";
+        streamedStrings = streamsStrings() && std::any_of(graph.string_nodes.begin(), graph.string_nodes.end(),
+                                                          [](const Node *node) { return node->stream; });
+        arrayIndexes.clear();
+        for (size_t i = 0; i < graph.array_nodes.size(); ++i) {
+            arrayIndexes[graph.array_nodes[i]] = i;
+        }
+        maxFrame = 0;
+        for (const auto &node : graph.object_nodes) {
+            maxFrame = std::max(maxFrame, node->frame);
+        }
+
+        const auto header_name = res_name_prefix + ".h";
+        FILE *header = openOutput(header_name);
+        printHeader(header, graph, name_lower.c_str(), cpp_type.c_str(), proto_header);
+        closeOutput(header, header_name);
+
+        const auto source_name = res_name_prefix + ".cc";
+        FILE *source = openOutput(source_name);
+        printSource(source, graph, name_lower.c_str(), cpp_type.c_str());
+        closeOutput(source, source_name);
+    }
+
+    // #include of the json parser
+    virtual void printBackendIncludes(FILE *file) = 0;
+    // members of the parser state that belong to the json parser
+    virtual void printBackendState(FILE *file, const char *t) = 0;
+    // expression for the bytes of state.chunk that the json parser has consumed, valid within callbacks
+    virtual const char *getConsumed() = 0;
+    // connects the json parser to the parser_impl_parse_* callbacks
+    virtual void printBackendCallbacks(FILE *file, const char *t) = 0;
+    // parser_init(msg, config), parser_free, parser_on_chunk, parser_complete, parser_reset and the error API
+    virtual void printBackendApiImpl(FILE *file, const char *t, const char *c) = 0;
+    // whether captured values of unknown keys are copied from the input, or appended as json by the backend
+    virtual bool capturesRawInput() {
+        return true;
+    }
+    // whether parser_on_chunk() runs the state machine, or only collects the input for parser_complete()
+    virtual bool parsesIncrementally() {
+        return false;
+    }
+    // whether the backend can decode the values of (protog.stream) fields ahead of the json parser
+    virtual bool streamsStrings() {
+        return false;
+    }
+
+    // set by write() if the message has streamed fields and the backend supports them
+    bool streamedStrings = false;
+    // set by write() to the deepest Node::frame, 0 if the message has no message fields
+    int maxFrame = 0;
+    // position of each array node in Graph::array_nodes, which is its index in config.keepItems
+    std::unordered_map<const Node *, size_t> arrayIndexes;
+    // C++ type of each message that has fields in the Graph, filled by get_cached_cpp_type_name()
+    std::unordered_map<const Descriptor *, std::string> cppTypeNames;
+
+    void printHeader(FILE *file, const Graph &graph, const char *t, const char *c, const char* h) {
+        fprintf(file, "#pragma once\n\n");
+        fprintf(file, "#include <chrono>\n\n");
+        fprintf(file, "#include \"%s\"\n\n", h);
+        printNamespaceBegin(file, graph);
+        fprintf(file, "typedef struct %s_parser_state_s *%s_parser_state_t;\n", t, t);
+        fprintf(file, "\n");
+        fprintf(file, "// results of parser_on_chunk_slice()\n");
+        fprintf(file, "enum {\n");
+        fprintf(file, "    %s_parser_ok = 0,\n", t);
+        fprintf(file, "    %s_parser_error = 1,\n", t);
+        fprintf(file, "    %s_parser_yield = 2,\n", t);
+        fprintf(file, "};\n");
+        fprintf(file, "\n");
+        fprintf(file, "struct %s_parser_stats_s {\n", t);
+        fprintf(file, "    uint64_t bytesParsed = 0;\n");
+        fprintf(file, "    uint64_t messagesCompleted = 0;\n");
+        fprintf(file, "    uint64_t messagesRejected = 0;\n");
+        fprintf(file, "    uint64_t unknownKeys = 0;\n");
+        fprintf(file, "    uint64_t skippedBytes = 0;\n");
+        fprintf(file, "    uint64_t allocations = 0;\n");
+        fprintf(file, "    uint64_t bytesAllocated = 0;\n");
+        fprintf(file, "    uint64_t latencyHistogram[64] = {}; // parses that took [2^i, 2^(i+1)) ns\n");
+        fprintf(file, "    // blocks of counters, at most the peak number of threads that collected stats at the same time\n");
+        fprintf(file, "    uint64_t threads = 0;\n");
+        fprintf(file, "};\n");
+        fprintf(file, "\n");
+        fprintf(file, "struct %s_parser_config_s {\n", t);
+        fprintf(file, "    bool checkInitialized = true;\n");
+        fprintf(file, "    // skip values of keys that are not part of the message instead of failing\n");
+        fprintf(file, "    bool ignoreUnknownKeys = false;\n");
+        fprintf(file, "    // like ignoreUnknownKeys, but keep each unknown key and its raw json value. It is appended\n");
+        fprintf(file, "    // to the message's unknown key field (see protog -u) or passed to unknownKeyCallback.\n");
+        fprintf(file, "    bool captureUnknownKeys = false;\n");
+        fprintf(file, "    void (*unknownKeyCallback)(void *ctx, ::google::protobuf::Message *msg, const char *json, size_t jsonLen) = nullptr;\n");
+        fprintf(file, "    void *unknownKeyCtx = nullptr;\n");
+        fprintf(file, "    // values of fields marked with (protog.stream) are passed to stringSink instead of the message, in\n");
+        fprintf(file, "    // one piece, or with streamStrings in pieces while they are decoded; last is set on the final call.\n");
+        fprintf(file, "    // streamStrings lets the yajl backend decode such values itself from the chunk, without buffering\n");
+        fprintf(file, "    // them. yajl reads the chunk in pieces then, and an empty string in place of each streamed value.\n");
+        fprintf(file, "    bool streamStrings = false;\n");
+        fprintf(file, "    void (*stringSink)(void *ctx, ::google::protobuf::Message *msg, int field, const char *data, size_t len, bool last) = nullptr;\n");
+        fprintf(file, "    void *stringSinkCtx = nullptr;\n");
+        fprintf(file, "    // apply the json as merge patch (RFC 7386) onto the message: null clears a field, objects merge\n");
+        fprintf(file, "    // recursively and arrays replace the current elements instead of being appended to them.\n");
+        fprintf(file, "    bool mergePatch = false;\n");
+        fprintf(file, "    // resource limits. The parse fails before a value beyond a limit is copied into the message.\n");
+        fprintf(file, "    size_t maxDepth = SIZE_MAX;\n");
+        fprintf(file, "    size_t maxStringLength = SIZE_MAX; // also bounds how much the parser buffers for a single token\n");
+        fprintf(file, "    size_t maxArrayLength = SIZE_MAX;\n");
+        fprintf(file, "    size_t maxTotalBytes = SIZE_MAX; // estimated bytes allocated for strings, items and sub messages\n");
+        fprintf(file, "    // abort the parse once it runs longer than timeBudget (zero means no limit), counted from the first\n");
+        fprintf(file, "    // chunk, or once it has seen more than maxEvents json events. The deadline is checked every 64 events\n");
+        fprintf(file, "    // and before each chunk that parser_on_chunk() parses.\n");
+        fprintf(file, "    std::chrono::nanoseconds timeBudget = std::chrono::nanoseconds::zero();\n");
+        fprintf(file, "    size_t maxEvents = SIZE_MAX;\n");
+        fprintf(file, "    // parser_on_chunk_slice() yields after feeding sliceBytes bytes or seeing sliceEvents events\n");
+        fprintf(file, "    size_t sliceBytes = SIZE_MAX;\n");
+        fprintf(file, "    size_t sliceEvents = SIZE_MAX;\n");
+        if (!graph.array_nodes.empty()) {
+            fprintf(file, "    // items kept of each repeated field, set with parser_config_keep_items(), the others are skipped\n");
+            fprintf(file, "    size_t keepItems[%zu] = {", graph.array_nodes.size());
+            for (size_t i = 0; i < graph.array_nodes.size(); ++i) {
+                const auto &constraints = graph.array_nodes[i]->constraints;
+                fprintf(file, "%s%s", i ? ", " : "", constraints.has_keep_items
+                        ? (std::to_string(constraints.keep_items) + "u").c_str() : "SIZE_MAX");
+            }
+            fprintf(file, "};\n");
+        }
+        fprintf(file, "    // add the counters of each parse to the totals reported by parser_stats()\n");
+        fprintf(file, "    bool collectStats = false;\n");
+        fprintf(file, "};\n");
+        fprintf(file, "\n");
+        fprintf(file, "%s %s_parser_easy(const std::string &json);\n", c, t);
+        fprintf(file, "%s %s_parser_easy(const char *buf, size_t bufLen);\n", c, t);
+        fprintf(file, "void %s_parser_patch_easy(%s &msg, const std::string &json);\n", t, c);
+        fprintf(file, "void %s_parser_patch_easy(%s &msg, const char *buf, size_t bufLen);\n", t, c);
+        fprintf(file, "\n");
+        fprintf(file, "%s_parser_state_t %s_parser_init(%s &msg);\n", t, t, c);
+        fprintf(file, "%s_parser_state_t %s_parser_init(%s &msg, const %s_parser_config_s &config);\n", t, t, c, t);
+        fprintf(file, "void %s_parser_free(%s_parser_state_t state);\n", t, t);
+        fprintf(file, "int %s_parser_on_chunk(%s_parser_state_t state, char *chunk, size_t chunkLen);\n", t, t);
+        fprintf(file, "int %s_parser_on_chunk_slice(%s_parser_state_t state, char *chunk, size_t chunkLen, size_t *offset);\n", t, t);
+        fprintf(file, "// Parses count documents on the calling thread, docs[i] into msgs[i], which is cleared first. Up to lanes\n");
+        fprintf(file, "// (at most 16) parser states take turns with slices of config.sliceBytes (1024 by default), and the input\n");
+        fprintf(file, "// and state of the next lane are prefetched meanwhile, so that the cache misses of one document overlap\n");
+        fprintf(file, "// with parsing the others. The prefetches are hints that only cover the state, the first line of the message\n");
+        fprintf(file, "// and the next slice. results[i] is 0, or 1 if docs[i] is rejected. Returns the number of rejected documents.\n");
+        if (!parsesIncrementally()) {
+            fprintf(file, "// This parser only reads complete documents, so they are parsed one after another and lanes is ignored.\n");
+        }
+        fprintf(file, "size_t %s_parser_parse_batch(char *const *docs, const size_t *docLens, %s *msgs, int *results, size_t count,\n", t, c);
+        fprintf(file, "                             const %s_parser_config_s &config, size_t lanes = 4);\n", t);
+        fprintf(file, "int %s_parser_complete(%s_parser_state_t state);\n", t, t);
+        fprintf(file, "int %s_parser_reset(%s_parser_state_t state);\n", t, t);
+        fprintf(file, "// Keeps the first items of the repeated field at path, e.g. \".my_list\" or \".my_list[].b\", and skips the\n");
+        fprintf(file, "// others without parsing them into the message. Returns 0, or 1 if there is no repeated field at path.\n");
+        fprintf(file, "int %s_parser_config_keep_items(%s_parser_config_s &config, const char *path, size_t items);\n", t, t);
+        fprintf(file, "// number of items that the current parse skipped because of keepItems\n");
+        fprintf(file, "size_t %s_parser_truncated_items(%s_parser_state_t state);\n", t, t);
+        fprintf(file, "char *%s_parser_get_error(%s_parser_state_t state);\n", t, t);
+        fprintf(file,
+                "char *%s_parser_get_error(%s_parser_state_t state, int verbose, const char *chunk, size_t chunkLen);\n",
+                t, t);
+        fprintf(file, "void %s_parser_free_error(%s_parser_state_t state, char *err);\n", t, t);
+        fprintf(file, "\n");
+        fprintf(file, "// Parses a document from a tape of its json events (see protog_tape.h) instead of the json itself,\n");
+        fprintf(file, "// like parser_on_chunk() followed by parser_complete(). The json is only needed to capture unknown keys, and\n");
+        fprintf(file, "// must be the document that the tape was recorded from.\n");
+        fprintf(file, "int %s_parser_replay(%s_parser_state_t state, const char *tape, size_t tapeLen, const char *json = nullptr,\n", t, t);
+        fprintf(file, "                    size_t jsonLen = 0);\n");
+        fprintf(file, "\n");
+        fprintf(file, "// Sums up the counters of all threads. Safe to call at any time from any thread.\n");
+        fprintf(file, "void %s_parser_stats(%s_parser_stats_s *stats);\n", t, t);
+        fprintf(file, "\n");
+        printNamespaceEnd(file, graph);
+    }
+
+    void printSource(FILE *file, const Graph &graph, const char *t, const char *c) {
+        printSourceIncludes(file, t);
+        printNamespaceBegin(file, graph);
+        printTypeDefinition(file, t, c);
+        fprintf(file, "namespace {\n\n");
+        printSourceImpl(file, graph, t, c);
+        printBackendCallbacks(file, t);
+        fprintf(file, "} // anonymous namespace\n\n");
+        printApiImpl(file, t, c);
+        printKeepItemsImpl(file, graph, t);
+        printReplayImpl(file, t);
+        printBackendApiImpl(file, t, c);
+        printStatsApiImpl(file, t);
+        printNamespaceEnd(file, graph);
+    }
+
+    void printSourceIncludes(FILE *file, const char *t) {
+        fprintf(file, "#include \"%s_parser.pb.h\"\n\n", t);
+        fprintf(file, "#include <stdlib.h>\n");
+        fprintf(file, "#include <stdio.h>\n");
+        fprintf(file, "#include <string.h>\n\n");
+        fprintf(file, "#include <algorithm>\n");
+        fprintf(file, "#include <atomic>\n");
+        fprintf(file, "#include <cstddef>\n");
+        fprintf(file, "#include <functional>\n");
+        fprintf(file, "#include <string>\n\n");
+        printBackendIncludes(file);
+        fprintf(file, "\n");
+        fprintf(file, "#ifndef PROTOG_UNLIKELY\n");
+        fprintf(file, "#if defined(__GNUC__)\n");
+        fprintf(file, "#define PROTOG_UNLIKELY(x) __builtin_expect(!!(x), 0)\n");
+        fprintf(file, "#else\n");
+        fprintf(file, "#define PROTOG_UNLIKELY(x) (x)\n");
+        fprintf(file, "#endif\n");
+        fprintf(file, "#endif\n");
+        fprintf(file, "\n");
+        fprintf(file, "#ifndef PROTOG_PREFETCH\n");
+        fprintf(file, "#if defined(__GNUC__)\n");
+        fprintf(file, "#define PROTOG_PREFETCH(p, rw) __builtin_prefetch((p), (rw))\n");
+        fprintf(file, "#else\n");
+        fprintf(file, "#define PROTOG_PREFETCH(p, rw) ((void)(p))\n");
+        fprintf(file, "#endif\n");
+        fprintf(file, "#endif\n");
+        fprintf(file, "\n");
+        // USDT probes are a single nop until a tracer attaches, so they can stay enabled in release builds.
+        fprintf(file, "#if defined(PROTOG_ENABLE_USDT) && defined(__has_include)\n");
+        fprintf(file, "#if __has_include(<sys/sdt.h>)\n");
+        fprintf(file, "#include <sys/sdt.h>\n");
+        fprintf(file, "#define PROTOG_PROBE3(name, a1, a2, a3) STAP_PROBE3(protog, name, a1, a2, a3)\n");
+        fprintf(file, "#define PROTOG_PROBE4(name, a1, a2, a3, a4) STAP_PROBE4(protog, name, a1, a2, a3, a4)\n");
+        fprintf(file, "#endif\n");
+        fprintf(file, "#endif\n");
+        fprintf(file, "#ifndef PROTOG_PROBE3\n");
+        fprintf(file, "#define PROTOG_PROBE3(name, a1, a2, a3) do { } while (0)\n");
+        fprintf(file, "#define PROTOG_PROBE4(name, a1, a2, a3, a4) do { } while (0)\n");
+        fprintf(file, "#endif\n");
+        fprintf(file, "\n");
+    }
+
+    void printTypeDefinition(FILE *file, const char *t, const char *c) {
+        fprintf(file, "struct %s_parser_state_s {\n", t);
+        fprintf(file, "    %s_parser_state_s(%s &req) : req(&req) { }\n\n", t, c);
+        fprintf(file, "    %s_parser_config_s config;\n", t);
+        fprintf(file, "    size_t location = 0;\n");
+        fprintf(file, "    %s *req; // rebound by parser_parse_batch()\n", c);
+        if (maxFrame > 0) {
+            fprintf(file, "    ::google::protobuf::Message *messages[%d]; // open nested message of each level below req\n", maxFrame);
+        }
+        fprintf(file, "    std::string error;\n");
+        fprintf(file, "    size_t events = 0;\n");
+        fprintf(file, "    size_t budgetEvents = 0; // events after which maxEvents and the deadline are checked again\n");
+        fprintf(file, "    size_t depth = 0;\n");
+        fprintf(file, "    size_t allocatedBytes = 0;\n");
+        fprintf(file, "    size_t chunkEvents = 0;\n");
+        fprintf(file, "    size_t idleBytes = 0;\n");
+        fprintf(file, "    bool started = false;\n");
+        fprintf(file, "    std::chrono::steady_clock::time_point deadline;\n");
+        fprintf(file, "    size_t offset = 0; // bytes fed before the current chunk\n\n");
+        fprintf(file, "    // stats\n");
+        fprintf(file, "    bool recorded = false;\n");
+        fprintf(file, "    std::chrono::steady_clock::time_point startTime;\n");
+        fprintf(file, "    size_t unknownKeys = 0;\n");
+        fprintf(file, "    size_t skipStart = 0;\n");
+        fprintf(file, "    size_t skippedBytes = 0;\n");
+        fprintf(file, "    size_t allocations = 0;\n");
+        fprintf(file, "    size_t truncatedItems = 0;\n\n");
+        fprintf(file, "    // unknown keys\n");
+        fprintf(file, "    const char *chunk = nullptr;\n");
+        fprintf(file, "    size_t chunkOffset = 0;\n");
+        fprintf(file, "    size_t skipLocation = 0;\n");
+        fprintf(file, "    size_t skipDepth = 0;\n");
+        fprintf(file, "    std::string *unknownTarget = nullptr;\n");
+        fprintf(file, "    ::google::protobuf::Message *unknownMsg = nullptr;\n");
+        fprintf(file, "    size_t unknownValueOffset = 0;\n");
+        fprintf(file, "    std::string unknownJson;\n\n");
+        fprintf(file, "    // tape replay\n");
+        fprintf(file, "    bool replaying = false;\n");
+        fprintf(file, "    size_t replayConsumed = 0; // end of the current token in the json of the tape\n\n");
+        fprintf(file, "    // streamed strings\n");
+        fprintf(file, "    char *chunkEnd = nullptr; // set while parser_on_chunk() runs\n");
+        fprintf(file, "    int streamPhase = 0; // 1 after the key, 2 in the string\n");
+        fprintf(file, "    int streamField = 0;\n");
+        fprintf(file, "    ::google::protobuf::Message *streamMsg = nullptr;\n");
+        fprintf(file, "    std::string *streamTarget = nullptr;\n");
+        fprintf(file, "    size_t streamMaxLength = 0;\n");
+        fprintf(file, "    const char *streamTooLong = nullptr;\n");
+        fprintf(file, "    size_t streamLen = 0;\n");
+        fprintf(file, "    char streamEscape[12];\n");
+        fprintf(file, "    size_t streamEscapeLen = 0;\n");
+        fprintf(file, "    int streamUtf8 = 0; // continuation bytes still expected\n");
+        fprintf(file, "    size_t streamBytes = 0; // bytes of the current chunk that were decoded as a streamed string\n\n");
+        printBackendState(file, t);
+        fprintf(file, "    void reset() {\n");
+        fprintf(file, "        location = 0;\n");
+        fprintf(file, "        req->Clear();\n");
+        fprintf(file, "        error.clear();\n");
+        fprintf(file, "        events = 0;\n");
+        fprintf(file, "        budgetEvents = 0;\n");
+        fprintf(file, "        depth = 0;\n");
+        fprintf(file, "        allocatedBytes = 0;\n");
+        fprintf(file, "        chunkEvents = 0;\n");
+        fprintf(file, "        idleBytes = 0;\n");
+        fprintf(file, "        started = false;\n");
+        fprintf(file, "        offset = 0;\n");
+        fprintf(file, "        recorded = false;\n");
+        fprintf(file, "        unknownKeys = 0;\n");
+        fprintf(file, "        skippedBytes = 0;\n");
+        fprintf(file, "        allocations = 0;\n");
+        fprintf(file, "        truncatedItems = 0;\n");
+        fprintf(file, "        skipDepth = 0;\n");
+        fprintf(file, "        unknownTarget = nullptr;\n");
+        fprintf(file, "        replaying = false;\n");
+        fprintf(file, "        streamPhase = 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "};\n");
+        fprintf(file, "\n");
+    }
+
+    void printSourceImpl(FILE *file, const Graph &graph, const char *t, const char *c) {
+        printErrorImpl(file, t);
+        printStatsImpl(file, t);
+        printStartImpl(file, t);
+        printBudgetImpl(file, t);
+        printUnknownKeyImpl(file, t);
+        printSkipItemImpl(file, graph, t);
+        if (streamedStrings) {
+            printStreamImpl(file, t);
+        }
+        printNullImpl(file, graph, t, c, graph.null_nodes);
+        printPodImpl(file, graph, t, c, "boolean", "int", graph.bool_nodes);
+        printPodImpl(file, graph, t, c, "integer", "long long", graph.long_nodes);
+        printPodImpl(file, graph, t, c, "double", "double", graph.double_nodes);
+        printStringImpl(file, graph, t, c, graph.string_nodes);
+        printMapStartImpl(file, graph, graph.object_nodes, t, c);
+        printMapKeyImpl(file, graph, t, c, graph.object_nodes);
+        printMapEndImpl(file, graph, t, c, graph.object_nodes);
+        printArrayStartImpl(file, graph, t, c, graph.array_nodes);
+        printArrayEndImpl(file, graph, t, c, graph.array_nodes);
+    }
+
+    void printErrorImpl(FILE *file, const char *t) {
+        fprintf(file, "static size_t %s_parser_impl_consumed(const %s_parser_state_s &state) {\n", t, t);
+        fprintf(file, "    return state.replaying ? state.replayConsumed : %s;\n", getConsumed());
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static size_t %s_parser_impl_offset(const %s_parser_state_s &state) {\n", t, t);
+        fprintf(file, "    return state.offset + (state.chunk ? %s_parser_impl_consumed(state) : 0);\n", t);
+        fprintf(file, "}\n\n");
+
+        // Cancels the parse. The json parser stops calling back and parser_get_error() reports the message.
+        fprintf(file, "static int %s_parser_impl_fail(%s_parser_state_s &state, const char *error) {\n", t, t);
+        fprintf(file, "    PROTOG_PROBE4(error, \"%s\", state.location, %s_parser_impl_offset(state), error);\n", t, t);
+        fprintf(file, "    state.error = error;\n");
+        fprintf(file, "    return 0;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printStatsImpl(FILE *file, const char *t) {
+        // Every thread owns a block of counters that is linked into a global list on first use and never
+        // freed. Only the owner writes to a block, so counting needs no atomic read-modify-write and
+        // parser_stats() can read all blocks without locks. When a thread exits, its block is released
+        // and the next new thread takes it over instead of allocating one. A block keeps its counts,
+        // so it holds the retired totals of its previous owners and the list only grows to the peak
+        // number of threads.
+        fprintf(file, "struct %s_parser_thread_stats_s {\n", t);
+        fprintf(file, "    std::atomic<uint64_t> bytesParsed{0};\n");
+        fprintf(file, "    std::atomic<uint64_t> messagesCompleted{0};\n");
+        fprintf(file, "    std::atomic<uint64_t> messagesRejected{0};\n");
+        fprintf(file, "    std::atomic<uint64_t> unknownKeys{0};\n");
+        fprintf(file, "    std::atomic<uint64_t> skippedBytes{0};\n");
+        fprintf(file, "    std::atomic<uint64_t> allocations{0};\n");
+        fprintf(file, "    std::atomic<uint64_t> bytesAllocated{0};\n");
+        fprintf(file, "    std::atomic<uint64_t> latencyHistogram[64];\n");
+        fprintf(file, "    std::atomic<bool> inUse{true};\n");
+        fprintf(file, "    %s_parser_thread_stats_s *next = nullptr;\n", t);
+        fprintf(file, "\n");
+        fprintf(file, "    %s_parser_thread_stats_s() {\n", t);
+        fprintf(file, "        for (auto &bucket : latencyHistogram) {\n");
+        fprintf(file, "            bucket.store(0, std::memory_order_relaxed);\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "};\n\n");
+
+        fprintf(file, "static std::atomic<%s_parser_thread_stats_s *> %s_parser_impl_all_stats{nullptr};\n\n", t, t);
+
+        fprintf(file, "struct %s_parser_thread_stats_owner_s {\n", t);
+        fprintf(file, "    %s_parser_thread_stats_s *stats = nullptr;\n", t);
+        fprintf(file, "\n");
+        fprintf(file, "    ~%s_parser_thread_stats_owner_s() {\n", t);
+        fprintf(file, "        if (stats) {\n");
+        fprintf(file, "            stats->inUse.store(false, std::memory_order_release);\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "};\n\n");
+
+        fprintf(file, "static %s_parser_thread_stats_s *%s_parser_impl_claim_stats() {\n", t, t);
+        fprintf(file, "    for (auto *block = %s_parser_impl_all_stats.load(std::memory_order_acquire); block; block = block->next) {\n", t);
+        fprintf(file, "        bool inUse = false;\n");
+        fprintf(file, "        if (!block->inUse.load(std::memory_order_relaxed) &&\n");
+        fprintf(file, "            block->inUse.compare_exchange_strong(inUse, true, std::memory_order_acquire)) {\n");
+        fprintf(file, "            return block;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    auto *block = new %s_parser_thread_stats_s();\n", t);
+        fprintf(file, "    block->next = %s_parser_impl_all_stats.load(std::memory_order_relaxed);\n", t);
+        fprintf(file, "    while (!%s_parser_impl_all_stats.compare_exchange_weak(block->next, block, std::memory_order_release)) {\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return block;\n");
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static %s_parser_thread_stats_s &%s_parser_impl_thread_stats() {\n", t, t);
+        fprintf(file, "    static thread_local %s_parser_thread_stats_owner_s owner;\n", t);
+        fprintf(file, "    if (!owner.stats) {\n");
+        fprintf(file, "        owner.stats = %s_parser_impl_claim_stats();\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return *owner.stats;\n");
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static void %s_parser_impl_count(std::atomic<uint64_t> &counter, uint64_t value) {\n", t);
+        fprintf(file, "    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);\n");
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static void %s_parser_impl_record(%s_parser_state_s &state, bool completed) {\n", t, t);
+        fprintf(file, "    if (!state.config.collectStats || state.recorded) {\n");
+        fprintf(file, "        return;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    state.recorded = true;\n");
+        fprintf(file, "    %s_parser_thread_stats_s &stats = %s_parser_impl_thread_stats();\n", t, t);
+        fprintf(file, "    %s_parser_impl_count(stats.bytesParsed, state.offset);\n", t);
+        fprintf(file, "    %s_parser_impl_count(completed ? stats.messagesCompleted : stats.messagesRejected, 1);\n", t);
+        fprintf(file, "    %s_parser_impl_count(stats.unknownKeys, state.unknownKeys);\n", t);
+        fprintf(file, "    %s_parser_impl_count(stats.skippedBytes, state.skippedBytes);\n", t);
+        fprintf(file, "    %s_parser_impl_count(stats.allocations, state.allocations);\n", t);
+        fprintf(file, "    %s_parser_impl_count(stats.bytesAllocated, state.allocatedBytes);\n", t);
+        fprintf(file, "    const auto elapsed = std::chrono::steady_clock::now() - state.startTime;\n");
+        fprintf(file, "    const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();\n");
+        fprintf(file, "    size_t bucket = 0;\n");
+        fprintf(file, "    while (bucket < 63 && (ns >> (bucket + 1)) != 0) {\n");
+        fprintf(file, "        ++bucket;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    %s_parser_impl_count(stats.latencyHistogram[bucket], 1);\n", t);
+        fprintf(file, "}\n\n");
+    }
+
+    // steady_clock::now() costs more than most events, so the callbacks only compare the event count with
+    // budgetEvents and check the clock every 64 events
+    void printBudgetImpl(FILE *file, const char *t) {
+        fprintf(file, "static int %s_parser_impl_check_deadline(%s_parser_state_s &state) {\n", t, t);
+        fprintf(file, "    if (PROTOG_UNLIKELY(state.config.timeBudget.count() != 0) && std::chrono::steady_clock::now() > state.deadline) {\n");
+        fprintf(file, "        return %s_parser_impl_fail(state, \"Parse exceeds timeBudget\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+        fprintf(file, "static int %s_parser_impl_check_budget(%s_parser_state_s &state) {\n", t, t);
+        fprintf(file, "    if (PROTOG_UNLIKELY(state.events > state.config.maxEvents)) {\n");
+        fprintf(file, "        return %s_parser_impl_fail(state, \"Parse exceeds maxEvents\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (!%s_parser_impl_check_deadline(state)) {\n", t);
+        fprintf(file, "        return 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    state.budgetEvents = state.config.maxEvents;\n");
+        fprintf(file, "    if (state.config.timeBudget.count() != 0) {\n");
+        fprintf(file, "        state.budgetEvents = std::min(state.budgetEvents, state.events + 64);\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    // called when the first input of a parse arrives
+    void printStartImpl(FILE *file, const char *t) {
+        fprintf(file, "static void %s_parser_impl_start(%s_parser_state_s &state) {\n", t, t);
+        fprintf(file, "    if (state.started) {\n");
+        fprintf(file, "        return;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    state.started = true;\n");
+        fprintf(file, "    if (state.config.timeBudget.count() != 0) {\n");
+        fprintf(file, "        state.deadline = std::chrono::steady_clock::now() + state.config.timeBudget;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (state.config.collectStats) {\n");
+        fprintf(file, "        state.startTime = std::chrono::steady_clock::now();\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    PROTOG_PROBE3(parse_start, \"%s\", state.location, state.offset);\n", t);
+        fprintf(file, "}\n\n");
+    }
+
+    void printUnknownKeyImpl(FILE *file, const char *t) {
+        // Values of unknown keys are not parsed into the message. The parser enters the reserved skip state
+        // and counts nesting until the value is complete. If the key is captured, the raw bytes of the value
+        // are copied from the input chunks (found through the parser's byte offsets), so they are never re-encoded.
+        fprintf(file, "static void %s_parser_impl_skip_value(%s_parser_state_s &state, size_t skipState, const unsigned char *key,\n", t, t);
+        fprintf(file, "                                      size_t keyLen, ::google::protobuf::Message *msg, std::string *target) {\n");
+        fprintf(file, "    state.skipLocation = state.location;\n");
+        fprintf(file, "    state.location = skipState;\n");
+        fprintf(file, "    state.skipDepth = 0;\n");
+        fprintf(file, "    ++state.unknownKeys;\n");
+        fprintf(file, "    if (state.config.collectStats) {\n");
+        fprintf(file, "        state.skipStart = %s_parser_impl_offset(state);\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (!state.config.captureUnknownKeys || (!target && !state.config.unknownKeyCallback)) {\n");
+        fprintf(file, "        return;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    state.unknownMsg = msg;\n");
+        fprintf(file, "    if (!target) {\n");
+        fprintf(file, "        target = &state.unknownJson;\n");
+        fprintf(file, "        target->clear();\n");
+        fprintf(file, "    } else if (!target->empty()) {\n");
+        fprintf(file, "        target->push_back(',');\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    target->push_back('\"');\n");
+        fprintf(file, "    for (size_t i = 0; i < keyLen; ++i) {\n");
+        fprintf(file, "        const unsigned char k = key[i];\n");
+        fprintf(file, "        if (k == '\"' || k == '\\\\') {\n");
+        fprintf(file, "            target->push_back('\\\\');\n");
+        fprintf(file, "            target->push_back(k);\n");
+        fprintf(file, "        } else if (k < 0x20) {\n");
+        fprintf(file, "            char esc[8];\n");
+        fprintf(file, "            snprintf(esc, sizeof(esc), \"\\\\u%%04x\", k);\n");
+        fprintf(file, "            target->append(esc);\n");
+        fprintf(file, "        } else {\n");
+        fprintf(file, "            target->push_back(k);\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    target->append(\"\\\":\");\n");
+        fprintf(file, "    state.unknownTarget = target;\n");
+        fprintf(file, "    state.unknownValueOffset = target->size();\n");
+        fprintf(file, "    state.chunkOffset = %s_parser_impl_consumed(state);\n", t);
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static int %s_parser_impl_skip_end(%s_parser_state_s &state) {\n", t, t);
+        fprintf(file, "    state.location = state.skipLocation;\n");
+        fprintf(file, "    if (state.config.collectStats) {\n");
+        fprintf(file, "        state.skippedBytes += %s_parser_impl_offset(state) - state.skipStart;\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    std::string *target = state.unknownTarget;\n");
+        fprintf(file, "    if (!target) {\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    state.unknownTarget = nullptr;\n");
+        if (capturesRawInput()) {
+            fprintf(file, "    if (state.chunk) {\n");
+            fprintf(file, "        const size_t end = %s_parser_impl_consumed(state);\n", t);
+            fprintf(file, "        target->append(state.chunk + state.chunkOffset, end - state.chunkOffset);\n");
+            fprintf(file, "    }\n");
+        }
+        fprintf(file, "    // drop the separator between key and value\n");
+        fprintf(file, "    size_t pos = state.unknownValueOffset;\n");
+        fprintf(file, "    while (pos < target->size() && strchr(\" \\t\\r\\n:\", (*target)[pos])) {\n");
+        fprintf(file, "        ++pos;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    target->erase(state.unknownValueOffset, pos - state.unknownValueOffset);\n");
+        fprintf(file, "    if (PROTOG_UNLIKELY((state.allocatedBytes += target->size() - state.unknownValueOffset) > state.config.maxTotalBytes)) {\n");
+        fprintf(file, "        return %s_parser_impl_fail(state, \"Message exceeds maxTotalBytes\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (target == &state.unknownJson) {\n");
+        fprintf(file, "        state.config.unknownKeyCallback(state.config.unknownKeyCtx, state.unknownMsg, target->data(), target->size());\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    // An object item beyond keepItems has started. Its keys and values are skipped like the value of an unknown key.
+    void printSkipItemImpl(FILE *file, const Graph &graph, const char *t) {
+        if (std::none_of(graph.object_nodes.begin(), graph.object_nodes.end(),
+                         [](const Node *node) { return node->field && node->field->is_repeated(); })) {
+            return;
+        }
+        fprintf(file, "static void %s_parser_impl_skip_item(%s_parser_state_s &state, size_t skipState) {\n", t, t);
+        fprintf(file, "    state.skipLocation = state.location;\n");
+        fprintf(file, "    state.location = skipState;\n");
+        fprintf(file, "    state.skipDepth = 1;\n");
+        fprintf(file, "    state.unknownTarget = nullptr;\n");
+        fprintf(file, "    if (state.config.collectStats) {\n");
+        fprintf(file, "        state.skipStart = %s_parser_impl_offset(state);\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printKeepItemsImpl(FILE *file, const Graph &graph, const char *t) {
+        fprintf(file, "int %s_parser_config_keep_items(%s_parser_config_s &config, const char *path, size_t items) {\n", t, t);
+        if (!graph.array_nodes.empty()) {
+            fprintf(file, "    static const char *const paths[] = {\n");
+            for (const auto &node : graph.array_nodes) {
+                fprintf(file, "        \"%s\",\n", node->full_name().c_str());
+            }
+            fprintf(file, "    };\n");
+            fprintf(file, "    for (size_t i = 0; i < %zu; ++i) {\n", graph.array_nodes.size());
+            fprintf(file, "        if (strcmp(paths[i], path) == 0) {\n");
+            fprintf(file, "            config.keepItems[i] = items;\n");
+            fprintf(file, "            return 0;\n");
+            fprintf(file, "        }\n");
+            fprintf(file, "    }\n");
+        } else {
+            fprintf(file, "    (void)config;\n");
+            fprintf(file, "    (void)path;\n");
+            fprintf(file, "    (void)items;\n");
+        }
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "size_t %s_parser_truncated_items(%s_parser_state_t state) {\n", t, t);
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    return state->truncatedItems;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+    }
+
+    // Streamed strings are decoded from the chunk ahead of yajl, which then only reads an empty string.
+    void printStreamImpl(FILE *file, const char *t) {
+        // passes decoded bytes of the streamed string on to stringSink or the field
+        fprintf(file, "static int %s_parser_impl_stream_out(%s_parser_state_s &state, const char *data, size_t len) {\n", t, t);
+        fprintf(file, "    if (len == 0) {\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (PROTOG_UNLIKELY((state.streamLen += len) > state.streamMaxLength)) {\n");
+        fprintf(file, "        return %s_parser_impl_fail(state, state.streamLen > state.config.maxStringLength ? \"String exceeds maxStringLength\" : state.streamTooLong);\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (state.config.stringSink) {\n");
+        fprintf(file, "        state.config.stringSink(state.config.stringSinkCtx, state.streamMsg, state.streamField, data, len, false);\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (PROTOG_UNLIKELY((state.allocatedBytes += len) > state.config.maxTotalBytes)) {\n");
+        fprintf(file, "        return %s_parser_impl_fail(state, \"Message exceeds maxTotalBytes\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    state.streamTarget->append(data, len);\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+        fprintf(file, "static int %s_parser_impl_stream_codepoint(%s_parser_state_s &state, uint32_t cp) {\n", t, t);
+        fprintf(file, "    char utf8[4];\n");
+        fprintf(file, "    size_t len = 1;\n");
+        fprintf(file, "    if (cp < 0x80) {\n");
+        fprintf(file, "        utf8[0] = static_cast<char>(cp);\n");
+        fprintf(file, "    } else if (cp < 0x800) {\n");
+        fprintf(file, "        utf8[0] = static_cast<char>(0xc0 | (cp >> 6));\n");
+        fprintf(file, "        utf8[1] = static_cast<char>(0x80 | (cp & 0x3f));\n");
+        fprintf(file, "        len = 2;\n");
+        fprintf(file, "    } else if (cp < 0x10000) {\n");
+        fprintf(file, "        utf8[0] = static_cast<char>(0xe0 | (cp >> 12));\n");
+        fprintf(file, "        utf8[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));\n");
+        fprintf(file, "        utf8[2] = static_cast<char>(0x80 | (cp & 0x3f));\n");
+        fprintf(file, "        len = 3;\n");
+        fprintf(file, "    } else {\n");
+        fprintf(file, "        utf8[0] = static_cast<char>(0xf0 | (cp >> 18));\n");
+        fprintf(file, "        utf8[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3f));\n");
+        fprintf(file, "        utf8[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));\n");
+        fprintf(file, "        utf8[3] = static_cast<char>(0x80 | (cp & 0x3f));\n");
+        fprintf(file, "        len = 4;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return %s_parser_impl_stream_out(state, utf8, len);\n", t);
+        fprintf(file, "}\n\n");
+        fprintf(file, "static uint32_t %s_parser_impl_stream_hex(const char *hex) {\n", t);
+        fprintf(file, "    uint32_t v = 0;\n");
+        fprintf(file, "    for (int i = 0; i < 4; ++i) {\n");
+        fprintf(file, "        v = (v << 4) | static_cast<uint32_t>(hex[i] <= '9' ? hex[i] - '0' : (hex[i] | 0x20) - 'a' + 10);\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return v;\n");
+        fprintf(file, "}\n\n");
+        // Adds c to the escape sequence in state.streamEscape and decodes the sequence once it is complete. Like
+        // yajl, a high surrogate is combined with the escape after it and replaced with '?' if there is none.
+        // Returns 2 if c does not belong to the sequence and has to be read again, 0 if the escape is invalid.
+        fprintf(file, "static int %s_parser_impl_stream_escape(%s_parser_state_s &state, char c) {\n", t, t);
+        fprintf(file, "    char *const esc = state.streamEscape;\n");
+        fprintf(file, "    size_t &len = state.streamEscapeLen;\n");
+        fprintf(file, "    if (len == 6 || len == 7) { // after a high surrogate\n");
+        fprintf(file, "        if (c != (len == 6 ? '\\\\' : 'u')) {\n");
+        fprintf(file, "            const bool restart = len == 7; // the backslash starts another escape\n");
+        fprintf(file, "            len = 0;\n");
+        fprintf(file, "            if (!%s_parser_impl_stream_out(state, \"?\", 1)) {\n", t);
+        fprintf(file, "                return 0;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            if (!restart) {\n");
+        fprintf(file, "                return 2;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            esc[len++] = '\\\\';\n");
+        fprintf(file, "            return %s_parser_impl_stream_escape(state, c);\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        esc[len++] = c;\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    esc[len++] = c;\n");
+        fprintf(file, "    if (len == 2 && c != 'u') {\n");
+        fprintf(file, "        static const char names[] = \"\\\"\\\\/bfnrt\";\n");
+        fprintf(file, "        static const char values[] = \"\\\"\\\\/\\b\\f\\n\\r\\t\";\n");
+        fprintf(file, "        const char *name = c ? strchr(names, c) : nullptr;\n");
+        fprintf(file, "        len = 0;\n");
+        fprintf(file, "        if (PROTOG_UNLIKELY(!name)) {\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"Invalid escape in string\");\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        return %s_parser_impl_stream_out(state, values + (name - names), 1);\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    const char lower = static_cast<char>(c | 0x20);\n");
+        fprintf(file, "    if (len > 2 && PROTOG_UNLIKELY(!((c >= '0' && c <= '9') || (lower >= 'a' && lower <= 'f')))) {\n");
+        fprintf(file, "        len = 0;\n");
+        fprintf(file, "        return %s_parser_impl_fail(state, \"Invalid escape in string\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (len == 6) {\n");
+        fprintf(file, "        const uint32_t cp = %s_parser_impl_stream_hex(esc + 2);\n", t);
+        fprintf(file, "        if ((cp & 0xfc00) == 0xd800) {\n");
+        fprintf(file, "            return 1;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        len = 0;\n");
+        fprintf(file, "        return %s_parser_impl_stream_codepoint(state, cp);\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (len == 12) {\n");
+        fprintf(file, "        const uint32_t high = %s_parser_impl_stream_hex(esc + 2);\n", t);
+        fprintf(file, "        const uint32_t low = %s_parser_impl_stream_hex(esc + 8);\n", t);
+        fprintf(file, "        len = 0;\n");
+        fprintf(file, "        if ((low & 0xfc00) != 0xdc00) {\n");
+        fprintf(file, "            return %s_parser_impl_stream_out(state, \"?\", 1) && %s_parser_impl_stream_codepoint(state, low);\n", t, t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        return %s_parser_impl_stream_codepoint(state, 0x10000 + ((high - 0xd800) << 10) + (low - 0xdc00));\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+        // Decodes the raw json of a streamed string in [p, end), which yajl does not read. Returns the end of the
+        // decoded bytes, which is end unless the closing quote is found, or nullptr if the string is invalid.
+        fprintf(file, "static const char *%s_parser_impl_stream(%s_parser_state_s &state, const char *p, const char *end) {\n", t, t);
+        fprintf(file, "    while (state.streamPhase == 2 && p < end) {\n");
+        fprintf(file, "        if (state.streamEscapeLen) {\n");
+        fprintf(file, "            const int rc = %s_parser_impl_stream_escape(state, *p);\n", t);
+        fprintf(file, "            if (!rc) {\n");
+        fprintf(file, "                return nullptr;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            if (rc == 1) {\n");
+        fprintf(file, "                ++p;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            continue;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        // plain bytes are passed on in runs\n");
+        fprintf(file, "        const char *const run = p;\n");
+        fprintf(file, "        while (p < end) {\n");
+        fprintf(file, "            const unsigned char c = static_cast<unsigned char>(*p);\n");
+        fprintf(file, "            if (c == '\"' || c == '\\\\' || c < 0x20) {\n");
+        fprintf(file, "                break;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            if (state.streamUtf8) {\n");
+        fprintf(file, "                if (PROTOG_UNLIKELY((c & 0xc0) != 0x80)) {\n");
+        fprintf(file, "                    %s_parser_impl_fail(state, \"Invalid UTF-8 in string\");\n", t);
+        fprintf(file, "                    return nullptr;\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                --state.streamUtf8;\n");
+        fprintf(file, "            } else if (c >= 0x80) {\n");
+        fprintf(file, "                if (PROTOG_UNLIKELY(c < 0xc2 || c > 0xf4)) {\n");
+        fprintf(file, "                    %s_parser_impl_fail(state, \"Invalid UTF-8 in string\");\n", t);
+        fprintf(file, "                    return nullptr;\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                state.streamUtf8 = c < 0xe0 ? 1 : c < 0xf0 ? 2 : 3;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            ++p;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (!%s_parser_impl_stream_out(state, run, p - run)) {\n", t);
+        fprintf(file, "            return nullptr;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (p == end) {\n");
+        fprintf(file, "            break;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        const unsigned char c = static_cast<unsigned char>(*p);\n");
+        fprintf(file, "        if (PROTOG_UNLIKELY(c < 0x20 || state.streamUtf8)) {\n");
+        fprintf(file, "            %s_parser_impl_fail(state, c < 0x20 ? \"Invalid character in string\" : \"Invalid UTF-8 in string\");\n", t);
+        fprintf(file, "            return nullptr;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (c == '\\\\') {\n");
+        fprintf(file, "            state.streamEscape[0] = '\\\\';\n");
+        fprintf(file, "            state.streamEscapeLen = 1;\n");
+        fprintf(file, "        } else {\n");
+        fprintf(file, "            state.streamPhase = 0; // closing quote\n");
+        fprintf(file, "            if (state.config.stringSink) {\n");
+        fprintf(file, "                state.config.stringSink(state.config.stringSinkCtx, state.streamMsg, state.streamField, \"\", 0, true);\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        ++p;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return p;\n");
+        fprintf(file, "}\n\n");
+        // Called after the key of a streamed string. parser_on_chunk() decodes the value from the chunk.
+        fprintf(file, "static void %s_parser_impl_stream_begin(%s_parser_state_s &state, ::google::protobuf::Message *msg, int field,\n", t, t);
+        fprintf(file, "                                       std::string *target, size_t maxLength, const char *tooLong) {\n");
+        fprintf(file, "    state.streamPhase = 1;\n");
+        fprintf(file, "    state.streamField = field;\n");
+        fprintf(file, "    state.streamMsg = msg;\n");
+        fprintf(file, "    state.streamTarget = target;\n");
+        fprintf(file, "    state.streamMaxLength = std::min(maxLength, state.config.maxStringLength);\n");
+        fprintf(file, "    state.streamTooLong = tooLong;\n");
+        fprintf(file, "    state.streamLen = 0;\n");
+        fprintf(file, "    state.streamEscapeLen = 0;\n");
+        fprintf(file, "    state.streamUtf8 = 0;\n");
+        fprintf(file, "    if (target) {\n");
+        fprintf(file, "        ++state.allocations;\n");
+        fprintf(file, "        target->clear();\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "}\n");
+    }
+
+    void printSkipValueStateImpl(FILE *file, const Graph &graph, const char *t) {
+        fprintf(file, "        case %d: // skip unknown value\n", graph.skipState);
+        fprintf(file, "            if (state.skipDepth == 0) {\n");
+        fprintf(file, "                return %s_parser_impl_skip_end(state);\n", t);
+        fprintf(file, "            }\n");
+        fprintf(file, "            break;\n");
+    }
+
+    void printSkipStartStateImpl(FILE *file, const Graph &graph) {
+        fprintf(file, "        case %d: // skip unknown value\n", graph.skipState);
+        fprintf(file, "            ++state.skipDepth;\n");
+        fprintf(file, "            break;\n");
+    }
+
+    void printSkipEndStateImpl(FILE *file, const Graph &graph, const char *t) {
+        fprintf(file, "        case %d: // skip unknown value\n", graph.skipState);
+        fprintf(file, "            if (--state.skipDepth == 0) {\n");
+        fprintf(file, "                return %s_parser_impl_skip_end(state);\n", t);
+        fprintf(file, "            }\n");
+        fprintf(file, "            break;\n");
+    }
+
+    void printNullImpl(FILE* file, const Graph &graph, const char* t, const char* c, const std::vector<Node*>& nodes) {
+        fprintf(file, "static int %s_parser_impl_parse_null(void *ctx) {\n", t);
+        printCallbackPrologue(file, t);
+        fprintf(file, "    switch (state.location) {\n");
+        for (const auto& node : nodes) {
+            assert(node);
+            printNullStateImpl(file, *node);
+        }
+        printSkipValueStateImpl(file, graph, t);
+        fprintf(file, "        default:\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"Unexpected null\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printNullStateImpl(FILE* file, const Node& node) {
+        const auto msg = get_message(node);
+        fprintf(file, "        case %d: // key %s\n", node.state, node.full_name().c_str());
+        fprintf(file, "            %s->clear_%s();\n", msg.c_str(), node.name);
+        fprintf(file, "            state.location = %d;\n", node.parent->state);
+        fprintf(file, "            break;\n");
+    }
+
+    void printPodImpl(FILE* file, const Graph &graph, const char* t, const char* c, const char* p, const char* pt,
+                      const std::vector<Node*>& nodes) {
+        fprintf(file, "static int %s_parser_impl_parse_%s(void *ctx, %s v) {\n", t, p, pt);
+        printCallbackPrologue(file, t);
+        fprintf(file, "    switch (state.location) {\n");
+        for (const auto& node : nodes) {
+            assert(node);
+            printPodStateImpl(file, *node, t);
+        }
+        printSkipValueStateImpl(file, graph, t);
+        fprintf(file, "        default:\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"Unexpected %s\");\n", t, p);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printPodStateImpl(FILE* file, const Node& node, const char* t) {
+        const auto msg = get_message(node);
+        fprintf(file, "        case %d: // key %s\n", node.state, node.full_name().c_str());
+        if (printItemTruncation(file, node)) {
+            fprintf(file, "                break;\n");
+            fprintf(file, "            }\n");
+        }
+        if (node.type != NodeType::BOOL) {
+            printValueConstraints(file, node, t);
+        }
+        printItemConstraints(file, node, t);
+        if (node.field->is_repeated()) {
+            printAllocLimit(file, t, std::to_string(get_cpp_type_size(*node.field)).c_str());
+        }
+        fprintf(file, "            %s->", msg.c_str());
+        if (node.field->is_repeated()) {
+            fprintf(file, "add");
+        } else {
+            fprintf(file, "set");
+        }
+        fprintf(file, "_%s(", node.name);
+        if (node.field->type() == FieldDescriptor::TYPE_ENUM) {
+            const auto enum_type = get_full_cpp_type_name(*node.field->enum_type());
+            fprintf(file, "\n                    static_cast<%s>(v)", enum_type.c_str());
+        } else {
+            fprintf(file, "v");
+        }
+        fprintf(file, ");\n");
+        if (!node.field->is_repeated()) { // in case of array, the closing bracket will clean up
+            fprintf(file, "            state.location = %d;\n", node.parent->state);
+        }
+        fprintf(file, "            break;\n");
+    }
+
+    void printStringImpl(FILE* file, const Graph &graph, const char* t, const char* c, const std::vector<Node*>& nodes) {
+        fprintf(file, "static int %s_parser_impl_parse_string(void *ctx, const unsigned char *v, size_t vLen) {\n", t);
+        printCallbackPrologue(file, t);
+        printStringLimit(file, t, "vLen");
+        fprintf(file, "    std::string *target = nullptr;\n");
+        fprintf(file, "    switch (state.location) {\n");
+        for (const auto& node : nodes) {
+            assert(node);
+            printStringStateImpl(file, *node, t);
+        }
+        printSkipValueStateImpl(file, graph, t);
+        fprintf(file, "        default:\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"Unexpected string\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (target) {\n");
+        fprintf(file, "        ++state.allocations;\n");
+        fprintf(file, "        if (PROTOG_UNLIKELY((state.allocatedBytes += vLen) > state.config.maxTotalBytes)) {\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"Message exceeds maxTotalBytes\");\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        target->resize(vLen, '\\0');\n");
+        fprintf(file, "        memcpy(const_cast<char*>(target->c_str()), v, vLen);\n");
+        fprintf(file, "        const_cast<char*>(target->c_str())[vLen] = '\\0';\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printStringStateImpl(FILE* file, const Node& node, const char* t) {
+        const auto msg = get_message(node);
+        const char* verb = node.field->is_repeated() ? "add" : "mutable";
+        fprintf(file, "        case %d: // key %s\n", node.state, node.full_name().c_str());
+        if (node.stream) {
+            printStreamedStringStateImpl(file, node);
+        }
+        if (printItemTruncation(file, node)) {
+            fprintf(file, "                break;\n");
+            fprintf(file, "            }\n");
+        }
+        printStringConstraints(file, node, t);
+        printItemConstraints(file, node, t);
+        if (node.stream) {
+            fprintf(file, "            if (state.config.stringSink) {\n");
+            fprintf(file, "                state.config.stringSink(state.config.stringSinkCtx, %s, %d,\n", get_frame(node.frame).c_str(),
+                    node.field->number());
+            fprintf(file, "                                        reinterpret_cast<const char *>(v), vLen, true);\n");
+            fprintf(file, "                state.location = %d;\n", node.parent->state);
+            fprintf(file, "                break;\n");
+            fprintf(file, "            }\n");
+        }
+        fprintf(file, "            target = %s->%s_%s();\n", msg.c_str(), verb, node.name);
+        if (!node.field->is_repeated()) { // in case of array, the closing bracket will clean up
+            fprintf(file, "            state.location = %d;\n", node.parent->state);
+        }
+        fprintf(file, "            break;\n");
+    }
+
+    void printStreamedStringStateImpl(FILE* file, const Node& node) {
+        if (!streamedStrings) {
+            return;
+        }
+        fprintf(file, "            if (state.streamPhase == 2) { // the empty string that yajl reads in place of a streamed value\n");
+        fprintf(file, "                state.location = %d;\n", node.parent->state);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            }\n");
+    }
+
+    void printMapStartImpl(FILE *file, const Graph &graph, const std::vector<Node *> &nodes, const char *t, const char *c) {
+        fprintf(file, "static int %s_parser_impl_parse_start_map(void *ctx) {\n", t);
+        printCallbackPrologue(file, t);
+        printDepthLimit(file, t);
+        fprintf(file, "    switch (state.location) {\n");
+        for (const auto& node : nodes) {
+            assert(node);
+            printMapStartStateImpl(file, graph, *node, t);
+        }
+        printSkipStartStateImpl(file, graph);
+        fprintf(file, "        default:\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"Unexpected object\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    PROTOG_PROBE3(object_enter, \"%s\", state.location, %s_parser_impl_offset(state));\n", t, t);
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printMapStartStateImpl(FILE* file, const Graph &graph, const Node& node, const char* t) {
+        if (!node.parent) {
+            fprintf(file, "        case 0: // map .\n");
+            fprintf(file, "            state.location = %d;\n", node.state);
+            fprintf(file, "            break;\n");
+        } else {
+            const auto msg = get_message(*node.parent);
+            const char* verb = node.field->is_repeated() ? "add" : "mutable";
+            fprintf(file, "        case %d: // map %s\n", node.parent->state, node.full_name().c_str());
+            if (printItemTruncation(file, *node.parent)) {
+                fprintf(file, "                %s_parser_impl_skip_item(state, %d);\n", t, graph.skipState);
+                fprintf(file, "                break;\n");
+                fprintf(file, "            }\n");
+            }
+            printItemConstraints(file, *node.parent, t);
+            printAllocLimit(file, t, ("sizeof(" + get_cached_cpp_type_name(*node.field->message_type()) + ")").c_str());
+            if (node.state != node.parent->state) { // see Graph::minimize()
+                fprintf(file, "            state.location = %d;\n", node.state);
+            }
+            fprintf(file, "            state.messages[%d] = %s->%s_%s();\n", node.frame - 1, msg.c_str(), verb, node.name);
+            fprintf(file, "            break;\n");
+        }
+    }
+
+    // FNV-1a, computed by protog for the case labels and by the parser for each key it reads. Unlike
+    // std::hash<std::string> it needs no std::string copy of the key and does not depend on the standard library.
+    static uint64_t hashKey(const std::string &key) {
+        uint64_t hash = 14695981039346656037ull;
+        for (const unsigned char c : key) {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void printMapKeyImpl(FILE* file, const Graph &graph, const char* t, const char* c, const std::vector<Node*>& nodes) {
+        fprintf(file, "static inline uint64_t %s_parser_impl_hash_key(const unsigned char *key, size_t keyLen) {\n", t);
+        fprintf(file, "    uint64_t hash = 14695981039346656037ull;\n");
+        fprintf(file, "    for (size_t i = 0; i < keyLen; ++i) {\n");
+        fprintf(file, "        hash = (hash ^ key[i]) * 1099511628211ull;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return hash;\n");
+        fprintf(file, "}\n\n");
+        fprintf(file, "static int %s_parser_impl_parse_map_key(void *ctx, const unsigned char *key_, size_t keyLen) {\n", t);
+        printCallbackPrologue(file, t);
+        printStringLimit(file, t, "keyLen");
+        fprintf(file, "    const auto hash = %s_parser_impl_hash_key(key_, keyLen);\n", t);
+        fprintf(file, "    switch (state.location) {\n");
+        for (const auto& node : nodes) {
+            assert(node);
+            printMapKeyStateImpl(file, graph, *node, t);
+        }
+        fprintf(file, "        case %d: // skip unknown value\n", graph.skipState);
+        fprintf(file, "            break;\n");
+        fprintf(file, "        default:\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"Unexpected key\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printMapKeyStateImpl(FILE* file, const Graph &graph, const Node& node, const char* t) {
+        fprintf(file, "        case %d: // map %s\n", node.state, node.full_name().c_str());
+        fprintf(file, "            switch (hash) {\n");
+        for (const auto& child : node.children) {
+            const size_t len = strlen(child->name);
+            fprintf(file, "                case %lluull: // %s\n", static_cast<unsigned long long>(hashKey(child->name)),
+                    child->name);
+            // the hash only picks the candidate, an unknown key with the same hash must not land in the field
+            fprintf(file, "                    if (PROTOG_UNLIKELY(keyLen != %zu || memcmp(key_, \"%s\", %zu) != 0)) {\n",
+                    len, child->name, len);
+            fprintf(file, "                        goto unknown_key_%d;\n", node.state);
+            fprintf(file, "                    }\n");
+            fprintf(file, "                    state.location = %d;\n", child->state);
+            if (streamedStrings && child->stream) {
+                printStreamBegin(file, *child, t);
+            }
+            fprintf(file, "                    break;\n");
+        }
+        fprintf(file, "                default:\n");
+        if (!node.children.empty()) {
+            fprintf(file, "                unknown_key_%d:\n", node.state);
+        }
+        fprintf(file, "                    if (!state.config.ignoreUnknownKeys && !state.config.captureUnknownKeys) {\n");
+        fprintf(file, "                        return %s_parser_impl_fail(state, \"Invalid key in %s\");\n", t, node.full_name().c_str());
+        fprintf(file, "                    }\n");
+        if (node.unknown_field) {
+            const auto msg = get_message(node.frame, *node.unknown_field->containing_type());
+            fprintf(file, "                    %s_parser_impl_skip_value(state, %d, key_, keyLen,\n", t, graph.skipState);
+            fprintf(file, "                            %s, %s->mutable_%s());\n",
+                    get_frame(node.frame).c_str(), msg.c_str(), node.unknown_field->name().c_str());
+        } else {
+            fprintf(file, "                    %s_parser_impl_skip_value(state, %d, key_, keyLen, %s, nullptr);\n", t, graph.skipState,
+                    get_frame(node.frame).c_str());
+        }
+        fprintf(file, "                    break;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            break;\n");
+    }
+
+    void printStreamBegin(FILE* file, const Node& node, const char* t) {
+        const auto msg = get_message(node);
+        const auto max_length = node.constraints.has_max_length
+                                ? std::to_string(node.constraints.max_length) + "ull" : std::string("SIZE_MAX");
+        fprintf(file, "                    if (state.config.streamStrings && state.chunkEnd) {\n");
+        fprintf(file, "                        %s_parser_impl_stream_begin(state, %s, %d,\n", t, get_frame(node.frame).c_str(),
+                node.field->number());
+        fprintf(file, "                                state.config.stringSink ? nullptr : %s->mutable_%s(),\n",
+                msg.c_str(), node.name);
+        fprintf(file, "                                %s, \"Value of %s is too long\");\n", max_length.c_str(), node.full_name().c_str());
+        fprintf(file, "                    }\n");
+    }
+
+    void printMapEndImpl(FILE* file, const Graph &graph, const char* t, const char* c, const std::vector<Node*>& nodes) {
+        fprintf(file, "static int %s_parser_impl_parse_end_map(void *ctx) {\n", t);
+        printCallbackPrologue(file, t);
+        fprintf(file, "    --state.depth;\n");
+        fprintf(file, "    PROTOG_PROBE3(object_exit, \"%s\", state.location, %s_parser_impl_offset(state));\n", t, t);
+        fprintf(file, "    switch (state.location) {\n");
+        for (const auto& node : nodes) {
+            assert(node);
+            printMapEndStateImpl(file, *node, t);
+        }
+        printSkipEndStateImpl(file, graph, t);
+        fprintf(file, "        default:\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"Unexpected end of object\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printMapEndStateImpl(FILE* file, const Node& node, const char* t) {
+        if (!node.parent || !node.parent->parent) {
+            fprintf(file, "        case %d: // map .\n", node.state);
+            printCheckInitialized(file, node);
+            printMinItemsOfChildren(file, node, t);
+            fprintf(file, "            state.location = 0;\n");
+            fprintf(file, "            break;\n");
+        } else {
+            fprintf(file, "        case %d: // map %s\n", node.state, node.full_name().c_str());
+            printCheckInitialized(file, node);
+            printMinItemsOfChildren(file, node, t);
+            assert(node.parent && node.parent->parent);
+            if (node.parent && node.parent->parent && node.parent->parent->type == NodeType::ARRAY) {
+                if (node.state != node.parent->state) {
+                    fprintf(file, "            state.location = %d;\n", node.parent->state);
+                }
+            } else {
+                fprintf(file, "            state.location = %d;\n", node.parent->parent->state);
+            }
+            fprintf(file, "            break;\n");
+        }
+    }
+
+    // key node of a repeated field; the array's end fails early, the end of the enclosing object also catches a
+    // document that leaves the array out
+    void printMinItems(FILE* file, const Node& node, const char* t) {
+        if (!node.constraints.has_min_items || node.constraints.min_items == 0) {
+            return;
+        }
+        fprintf(file, "            if (PROTOG_UNLIKELY(static_cast<size_t>(%s->%s_size()) < %llu)) {\n",
+                get_message(node).c_str(), node.name, static_cast<unsigned long long>(node.constraints.min_items));
+        printFail(file, t, node, "has too few items");
+        fprintf(file, "            }\n");
+    }
+
+    void printMinItemsOfChildren(FILE* file, const Node& node, const char* t) {
+        for (const auto& child : node.children) {
+            if (child->type == NodeType::ARRAY) {
+                printMinItems(file, *child, t);
+            }
+        }
+    }
+
+    void printCheckInitialized(FILE* file, const Node& node) {
+        fprintf(file, "            if (state.config.checkInitialized) {\n");
+        fprintf(file, "                %s->CheckInitialized();\n", get_frame(node.frame).c_str());
+        fprintf(file, "            }\n");
+    }
+
+    void printArrayStartImpl(FILE* file, const Graph &graph, const char* t, const char* c, const std::vector<Node*>& nodes) {
+        fprintf(file, "static int %s_parser_impl_parse_start_array(void *ctx) {\n", t);
+        printCallbackPrologue(file, t);
+        printDepthLimit(file, t);
+        fprintf(file, "    switch (state.location) {\n");
+        for (const auto& node : nodes) {
+            assert(node);
+            printArrayStartStateImpl(file, *node);
+        }
+        printSkipStartStateImpl(file, graph);
+        fprintf(file, "        default:\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"Unexpected array\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printArrayStartStateImpl(FILE* file, const Node& node) {
+        assert(node.children.size() == 1);
+        const auto msg = get_message(node);
+        fprintf(file, "        case %d: // key %s\n", node.state, node.full_name().c_str());
+        fprintf(file, "            if (state.config.mergePatch) {\n");
+        fprintf(file, "                %s->clear_%s();\n", msg.c_str(), node.name);
+        fprintf(file, "            }\n");
+        fprintf(file, "            state.location = %d;\n", node.children[0]->state);
+        fprintf(file, "            break;\n");
+    }
+
+    void printArrayEndImpl(FILE* file, const Graph &graph, const char* t, const char* c, const std::vector<Node*>& nodes) {
+        fprintf(file, "static int %s_parser_impl_parse_end_array(void *ctx) {\n", t);
+        printCallbackPrologue(file, t);
+        fprintf(file, "    --state.depth;\n");
+        fprintf(file, "    switch (state.location) {\n");
+        for (const auto& node : nodes) {
+            assert(node);
+            printArrayEndStateImpl(file, *node, t);
+        }
+        printSkipEndStateImpl(file, graph, t);
+        fprintf(file, "        default:\n");
+        fprintf(file, "            return %s_parser_impl_fail(state, \"Unexpected end of array\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printArrayEndStateImpl(FILE* file, const Node& node, const char* t) {
+        // TODO: fix arrays in root object case?!
+        assert(node.parent);
+        assert(node.children.size() == 1);
+        fprintf(file, "        case %d: // key %s\n", node.children[0]->state, node.full_name().c_str());
+        printMinItems(file, node, t);
+        fprintf(file, "            state.location = %d;\n", node.parent->state);
+        fprintf(file, "            break;\n");
+    }
+
+    void printCallbackPrologue(FILE* file, const char* t) {
+        fprintf(file, "    %s_parser_state_s &state = *static_cast<%s_parser_state_t>(ctx);\n", t, t);
+        fprintf(file, "    if (PROTOG_UNLIKELY(++state.events > state.budgetEvents) && !%s_parser_impl_check_budget(state)) {\n", t);
+        fprintf(file, "        return 0;\n");
+        fprintf(file, "    }\n");
+    }
+
+    void printDepthLimit(FILE* file, const char* t) {
+        fprintf(file, "    if (PROTOG_UNLIKELY(++state.depth > state.config.maxDepth)) {\n");
+        fprintf(file, "        return %s_parser_impl_fail(state, \"Nesting exceeds maxDepth\");\n", t);
+        fprintf(file, "    }\n");
+    }
+
+    void printStringLimit(FILE* file, const char* t, const char* len) {
+        fprintf(file, "    if (PROTOG_UNLIKELY(%s > state.config.maxStringLength)) {\n", len);
+        fprintf(file, "        return %s_parser_impl_fail(state, \"String exceeds maxStringLength\");\n", t);
+        fprintf(file, "    }\n");
+    }
+
+    void printAllocLimit(FILE* file, const char* t, const char* bytes) {
+        fprintf(file, "            ++state.allocations;\n");
+        fprintf(file, "            if (PROTOG_UNLIKELY((state.allocatedBytes += %s) > state.config.maxTotalBytes)) {\n", bytes);
+        fprintf(file, "                return %s_parser_impl_fail(state, \"Message exceeds maxTotalBytes\");\n", t);
+        fprintf(file, "            }\n");
+    }
+
+    void printFail(FILE* file, const char* t, const Node& node, const char* what) {
+        fprintf(file, "                return %s_parser_impl_fail(state, \"Value of %s %s\");\n", t, node.full_name().c_str(), what);
+    }
+
+    void printValueConstraints(FILE* file, const Node& node, const char* t) {
+        const auto& constraints = node.constraints;
+        if (constraints.has_min_value) {
+            fprintf(file, "            if (PROTOG_UNLIKELY(v < %.17g)) {\n", constraints.min_value);
+            printFail(file, t, node, "is too small");
+            fprintf(file, "            }\n");
+        }
+        if (constraints.has_max_value) {
+            fprintf(file, "            if (PROTOG_UNLIKELY(v > %.17g)) {\n", constraints.max_value);
+            printFail(file, t, node, "is too large");
+            fprintf(file, "            }\n");
+        }
+    }
+
+    void printStringConstraints(FILE* file, const Node& node, const char* t) {
+        const auto& constraints = node.constraints;
+        if (constraints.has_min_length) {
+            fprintf(file, "            if (PROTOG_UNLIKELY(vLen < %llu)) {\n", static_cast<unsigned long long>(constraints.min_length));
+            printFail(file, t, node, "is too short");
+            fprintf(file, "            }\n");
+        }
+        if (constraints.has_max_length) {
+            fprintf(file, "            if (PROTOG_UNLIKELY(vLen > %llu)) {\n", static_cast<unsigned long long>(constraints.max_length));
+            printFail(file, t, node, "is too long");
+            fprintf(file, "            }\n");
+        }
+        if (!constraints.prefix.empty()) {
+            fprintf(file, "            if (PROTOG_UNLIKELY(vLen < %zu || memcmp(v, %s, %zu) != 0)) {\n",
+                    constraints.prefix.size(), get_c_string_literal(constraints.prefix).c_str(), constraints.prefix.size());
+            printFail(file, t, node, "has the wrong prefix");
+            fprintf(file, "            }\n");
+        }
+        if (!constraints.suffix.empty()) {
+            fprintf(file, "            if (PROTOG_UNLIKELY(vLen < %zu || memcmp(v + vLen - %zu, %s, %zu) != 0)) {\n",
+                    constraints.suffix.size(), constraints.suffix.size(), get_c_string_literal(constraints.suffix).c_str(),
+                    constraints.suffix.size());
+            printFail(file, t, node, "has the wrong suffix");
+            fprintf(file, "            }\n");
+        }
+        if (!constraints.allowed_chars.empty()) {
+            unsigned long long allowed[4] = {0, 0, 0, 0};
+            for (const unsigned char ch : constraints.allowed_chars) {
+                allowed[ch >> 6] |= 1ull << (ch & 63);
+            }
+            fprintf(file, "            for (size_t i = 0; i < vLen; ++i) {\n");
+            fprintf(file, "                static const unsigned long long allowed[4] = {0x%llxull, 0x%llxull, 0x%llxull, 0x%llxull};\n",
+                    allowed[0], allowed[1], allowed[2], allowed[3]);
+            fprintf(file, "                if (PROTOG_UNLIKELY(!((allowed[v[i] >> 6] >> (v[i] & 63)) & 1))) {\n");
+            fprintf(file, "    ");
+            printFail(file, t, node, "contains characters that are not allowed");
+            fprintf(file, "                }\n");
+            fprintf(file, "            }\n");
+        }
+    }
+
+    // Opens the branch for an item beyond keepItems, which the caller skips and closes. Items are counted by the
+    // size of the field, so a merge patch that replaces the array keeps as many as a parse into a new message.
+    bool printItemTruncation(FILE* file, const Node& node) {
+        if (!node.field->is_repeated()) {
+            return false;
+        }
+        fprintf(file, "            if (PROTOG_UNLIKELY(static_cast<size_t>(%s->%s_size()) >= state.config.keepItems[%zu])) {\n",
+                get_message(node).c_str(), node.name, arrayIndexes.at(node.parent));
+        fprintf(file, "                ++state.truncatedItems;\n");
+        return true;
+    }
+
+    // checked before an item is added, so a repeated field never grows beyond its limit
+    void printItemConstraints(FILE* file, const Node& node, const char* t) {
+        if (!node.field->is_repeated()) {
+            return;
+        }
+        const auto msg = get_message(node);
+        fprintf(file, "            if (PROTOG_UNLIKELY(static_cast<size_t>(%s->%s_size()) >= state.config.maxArrayLength)) {\n",
+                msg.c_str(), node.name);
+        fprintf(file, "                return %s_parser_impl_fail(state, \"Value of %s exceeds maxArrayLength\");\n", t, node.full_name().c_str());
+        fprintf(file, "            }\n");
+        if (node.constraints.has_max_items) {
+            fprintf(file, "            if (PROTOG_UNLIKELY(%s->%s_size() >= %llu)) {\n",
+                    msg.c_str(), node.name, static_cast<unsigned long long>(node.constraints.max_items));
+            printFail(file, t, *node.parent, "has too many items"); // the key node, like min_items
+            fprintf(file, "            }\n");
+        }
+    }
+
+    void printApiImpl(FILE *file, const char *t, const char *c) {
+        fprintf(file, "%s %s_parser_easy(const std::string &json) {\n", c, t);
+        fprintf(file, "    return %s_parser_easy(json.c_str(), json.size());\n", t);
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "%s %s_parser_easy(const char *buf, size_t bufLen) {\n", c, t);
+        fprintf(file, "    %s msg;\n", c);
+        fprintf(file, "    %s_parser_state_t state = %s_parser_init(msg);\n", t, t);
+        fprintf(file, "\n");
+        fprintf(file, "    int rc = %s_parser_on_chunk(state, const_cast<char*>(buf), bufLen);\n", t);
+        fprintf(file, "    if (rc != 0) {\n");
+        fprintf(file, "        char *err = %s_parser_get_error(state);\n", t);
+        fprintf(file, "        throw std::runtime_error(err);\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "\n");
+        fprintf(file, "    rc = %s_parser_complete(state);\n", t);
+        fprintf(file, "    if (rc != 0) {\n");
+        fprintf(file, "        char *err = %s_parser_get_error(state);\n", t);
+        fprintf(file, "        throw std::runtime_error(err);\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "\n");
+        fprintf(file, "    %s_parser_free(state);\n", t);
+        fprintf(file, "\n");
+        fprintf(file, "    return msg;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "void %s_parser_patch_easy(%s &msg, const std::string &json) {\n", t, c);
+        fprintf(file, "    %s_parser_patch_easy(msg, json.c_str(), json.size());\n", t);
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "void %s_parser_patch_easy(%s &msg, const char *buf, size_t bufLen) {\n", t, c);
+        fprintf(file, "    %s_parser_config_s config;\n", t);
+        fprintf(file, "    config.mergePatch = true;\n");
+        fprintf(file, "    %s_parser_state_t state = %s_parser_init(msg, config);\n", t, t);
+        fprintf(file, "\n");
+        fprintf(file, "    int rc = %s_parser_on_chunk(state, const_cast<char*>(buf), bufLen);\n", t);
+        fprintf(file, "    if (rc == 0) {\n");
+        fprintf(file, "        rc = %s_parser_complete(state);\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (rc != 0) {\n");
+        fprintf(file, "        char *err = %s_parser_get_error(state);\n", t);
+        fprintf(file, "        const std::runtime_error ex(err);\n");
+        fprintf(file, "        %s_parser_free_error(state, err);\n", t);
+        fprintf(file, "        %s_parser_free(state);\n", t);
+        fprintf(file, "        throw ex;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "\n");
+        fprintf(file, "    %s_parser_free(state);\n", t);
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "%s_parser_state_t %s_parser_init(%s &msg) {\n", t, t, c);
+        fprintf(file, "    return %s_parser_init(msg, %s_parser_config_s());\n", t, t);
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "int %s_parser_on_chunk_slice(%s_parser_state_t state, char *chunk, size_t chunkLen, size_t *offset) {\n", t, t);
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    assert(offset && *offset <= chunkLen);\n");
+        fprintf(file, "    const size_t events = state->events;\n");
+        fprintf(file, "    size_t fed = 0;\n");
+        fprintf(file, "    while (*offset < chunkLen) {\n");
+        fprintf(file, "        if (fed >= state->config.sliceBytes || state->events - events >= state->config.sliceEvents) {\n");
+        fprintf(file, "            return %s_parser_yield;\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        size_t len = std::min(chunkLen - *offset, state->config.sliceBytes - fed);\n");
+        fprintf(file, "        if (state->config.sliceEvents != SIZE_MAX) {\n");
+        fprintf(file, "            len = std::min(len, static_cast<size_t>(64)); // the parser can only be paused between calls\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (%s_parser_on_chunk(state, chunk + *offset, len) != 0) {\n", t);
+        fprintf(file, "            return %s_parser_error;\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        *offset += len;\n");
+        fprintf(file, "        fed += len;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return %s_parser_ok;\n", t);
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        printBatchImpl(file, t, c);
+    }
+
+    // Interleaves several documents on one thread. Each lane is a parser state that is rebound to the message of
+    // its next document; its slice runs while the lines of the following lane's slice are being fetched.
+    void printBatchImpl(FILE *file, const char *t, const char *c) {
+        if (!parsesIncrementally()) {
+            printSequentialBatchImpl(file, t, c);
+            return;
+        }
+        fprintf(file, "static void %s_parser_impl_prefetch_lane(%s_parser_state_t state, const char *doc, size_t len) {\n", t, t);
+        fprintf(file, "    PROTOG_PREFETCH(state, 1);\n");
+        fprintf(file, "    PROTOG_PREFETCH(state->req, 1);\n");
+        fprintf(file, "    for (size_t i = 0; i < std::min(len, state->config.sliceBytes); i += 64) {\n");
+        fprintf(file, "        PROTOG_PREFETCH(doc + i, 0);\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "size_t %s_parser_parse_batch(char *const *docs, const size_t *docLens, %s *msgs, int *results, size_t count,\n", t, c);
+        fprintf(file, "                             const %s_parser_config_s &config, size_t lanes) {\n", t);
+        fprintf(file, "    struct lane_s {\n");
+        fprintf(file, "        %s_parser_state_t state;\n", t);
+        fprintf(file, "        size_t doc;\n");
+        fprintf(file, "        size_t offset;\n");
+        fprintf(file, "    } lane[16];\n");
+        fprintf(file, "    lanes = std::max(static_cast<size_t>(1), std::min(std::min(lanes, count), static_cast<size_t>(16)));\n");
+        fprintf(file, "    if (count == 0) {\n");
+        fprintf(file, "        return 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    %s_parser_config_s laneConfig = config;\n", t);
+        fprintf(file, "    if (laneConfig.sliceBytes == SIZE_MAX) {\n");
+        fprintf(file, "        laneConfig.sliceBytes = 1024;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    const auto start = [&](lane_s &l, size_t doc) {\n");
+        fprintf(file, "        l.state->req = &msgs[doc];\n");
+        fprintf(file, "        %s_parser_reset(l.state);\n", t);
+        fprintf(file, "        l.doc = doc;\n");
+        fprintf(file, "        l.offset = 0;\n");
+        fprintf(file, "    };\n");
+        fprintf(file, "    size_t next = 0;\n");
+        fprintf(file, "    for (size_t i = 0; i < lanes; ++i) {\n");
+        fprintf(file, "        lane[i].state = %s_parser_init(msgs[next], laneConfig);\n", t);
+        fprintf(file, "        start(lane[i], next++);\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    size_t failed = 0;\n");
+        fprintf(file, "    size_t active = lanes;\n");
+        fprintf(file, "    while (active > 0) {\n");
+        fprintf(file, "        for (size_t i = 0; i < lanes; ++i) {\n");
+        fprintf(file, "            lane_s &l = lane[i];\n");
+        fprintf(file, "            if (l.doc == SIZE_MAX) {\n");
+        fprintf(file, "                continue;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            const lane_s &ahead = lane[i + 1 == lanes ? 0 : i + 1];\n");
+        fprintf(file, "            if (ahead.doc != SIZE_MAX) {\n");
+        fprintf(file, "                %s_parser_impl_prefetch_lane(ahead.state, docs[ahead.doc] + ahead.offset, docLens[ahead.doc] - ahead.offset);\n", t);
+        fprintf(file, "            }\n");
+        fprintf(file, "            const int rc = %s_parser_on_chunk_slice(l.state, docs[l.doc], docLens[l.doc], &l.offset);\n", t);
+        fprintf(file, "            if (rc == %s_parser_yield) {\n", t);
+        fprintf(file, "                continue;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            const int result = rc == %s_parser_ok && %s_parser_complete(l.state) == 0 ? 0 : 1;\n", t, t);
+        fprintf(file, "            results[l.doc] = result;\n");
+        fprintf(file, "            failed += result;\n");
+        fprintf(file, "            if (next < count) {\n");
+        fprintf(file, "                start(l, next++);\n");
+        fprintf(file, "            } else {\n");
+        fprintf(file, "                l.doc = SIZE_MAX;\n");
+        fprintf(file, "                --active;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    for (size_t i = 0; i < lanes; ++i) {\n");
+        fprintf(file, "        %s_parser_free(lane[i].state);\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return failed;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+    }
+
+    // Backends that parse in parser_complete() have nothing to interleave, a document is parsed in one go.
+    void printSequentialBatchImpl(FILE *file, const char *t, const char *c) {
+        fprintf(file, "size_t %s_parser_parse_batch(char *const *docs, const size_t *docLens, %s *msgs, int *results, size_t count,\n", t, c);
+        fprintf(file, "                             const %s_parser_config_s &config, size_t) {\n", t);
+        fprintf(file, "    if (count == 0) {\n");
+        fprintf(file, "        return 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    %s_parser_state_t state = %s_parser_init(msgs[0], config);\n", t, t);
+        fprintf(file, "    size_t failed = 0;\n");
+        fprintf(file, "    for (size_t i = 0; i < count; ++i) {\n");
+        fprintf(file, "        state->req = &msgs[i];\n");
+        fprintf(file, "        %s_parser_reset(state);\n", t);
+        fprintf(file, "        const int rc = %s_parser_on_chunk(state, docs[i], docLens[i]);\n", t);
+        fprintf(file, "        results[i] = rc == 0 && %s_parser_complete(state) == 0 ? 0 : 1;\n", t);
+        fprintf(file, "        failed += results[i];\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    %s_parser_free(state);\n", t);
+        fprintf(file, "    return failed;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+    }
+
+    // Reads the records of a tape, in the format of protog_tape.h, and calls the callbacks of the state machine.
+    void printReplayImpl(FILE *file, const char *t) {
+        fprintf(file, "int %s_parser_replay(%s_parser_state_t state, const char *tape, size_t tapeLen, const char *json,\n", t, t);
+        fprintf(file, "                    size_t jsonLen) {\n");
+        fprintf(file, "    assert(state);\n");
+        fprintf(file, "    if (!state->error.empty()) {\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    %s_parser_impl_start(*state);\n", t);
+        fprintf(file, "    const char *p = tape;\n");
+        fprintf(file, "    const char *const end = tape + tapeLen;\n");
+        fprintf(file, "    uint32_t tapeJsonLen = 0;\n");
+        fprintf(file, "    size_t nesting = 0;\n");
+        fprintf(file, "    size_t records = 0;\n");
+        fprintf(file, "    int ok = 1;\n");
+        fprintf(file, "    if (tapeLen >= 8) {\n");
+        fprintf(file, "        memcpy(&tapeJsonLen, tape + 4, 4);\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (tapeLen < 8 || memcmp(tape, \"PGT1\", 4) != 0) {\n");
+        fprintf(file, "        ok = %s_parser_impl_fail(*state, \"Not a protog tape\");\n", t);
+        if (capturesRawInput()) {
+            fprintf(file, "    } else if (state->config.captureUnknownKeys && !json) {\n");
+            fprintf(file, "        ok = %s_parser_impl_fail(*state, \"Capturing unknown keys needs the json of the tape\");\n", t);
+        } else {
+            fprintf(file, "    } else if (state->config.captureUnknownKeys) {\n");
+            fprintf(file, "        ok = %s_parser_impl_fail(*state, \"Unknown keys can not be captured from a tape\");\n", t);
+        }
+        fprintf(file, "    } else if (json && jsonLen != tapeJsonLen) {\n");
+        fprintf(file, "        ok = %s_parser_impl_fail(*state, \"Tape does not match the json\");\n", t);
+        fprintf(file, "    } else {\n");
+        fprintf(file, "        p += 8;\n");
+        fprintf(file, "        state->replayConsumed = 0;\n");
+        fprintf(file, "        state->chunk = json;\n");
+        fprintf(file, "        state->chunkOffset = 0;\n");
+        fprintf(file, "        state->replaying = true;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    while (ok && p < end) {\n");
+        fprintf(file, "        // each record starts with its type and the json offset behind the token\n");
+        fprintf(file, "        if (PROTOG_UNLIKELY(end - p < 5)) {\n");
+        fprintf(file, "            ok = %s_parser_impl_fail(*state, \"Truncated tape\");\n", t);
+        fprintf(file, "            break;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        const char type = *p;\n");
+        fprintf(file, "        uint32_t consumed;\n");
+        fprintf(file, "        memcpy(&consumed, p + 1, 4);\n");
+        fprintf(file, "        // raw values of unknown keys are copied from the json between these offsets\n");
+        fprintf(file, "        if (PROTOG_UNLIKELY(consumed < state->replayConsumed || consumed > tapeJsonLen)) {\n");
+        fprintf(file, "            ok = %s_parser_impl_fail(*state, \"Corrupt tape\");\n", t);
+        fprintf(file, "            break;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        state->replayConsumed = consumed;\n");
+        fprintf(file, "        p += 5;\n");
+        fprintf(file, "        ++records;\n");
+        fprintf(file, "        size_t payload = 0;\n");
+        fprintf(file, "        if (type == 3 || type == 4) {\n");
+        fprintf(file, "            payload = 8;\n");
+        fprintf(file, "        } else if (type == 5 || type == 6) {\n");
+        fprintf(file, "            uint32_t len = 0;\n");
+        fprintf(file, "            if (end - p >= 4) {\n");
+        fprintf(file, "                memcpy(&len, p, 4);\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            payload = 4 + static_cast<size_t>(len);\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (PROTOG_UNLIKELY(static_cast<size_t>(end - p) < payload)) {\n");
+        fprintf(file, "            ok = %s_parser_impl_fail(*state, \"Truncated tape\");\n", t);
+        fprintf(file, "            break;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        switch (type) {\n");
+        fprintf(file, "            case 0:\n");
+        fprintf(file, "                ok = %s_parser_impl_parse_null(state);\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            case 1:\n");
+        fprintf(file, "            case 2:\n");
+        fprintf(file, "                ok = %s_parser_impl_parse_boolean(state, type == 2);\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            case 3: {\n");
+        fprintf(file, "                long long v;\n");
+        fprintf(file, "                memcpy(&v, p, 8);\n");
+        fprintf(file, "                ok = %s_parser_impl_parse_integer(state, v);\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            case 4: {\n");
+        fprintf(file, "                double v;\n");
+        fprintf(file, "                memcpy(&v, p, 8);\n");
+        fprintf(file, "                ok = %s_parser_impl_parse_double(state, v);\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            case 5:\n");
+        fprintf(file, "                ok = %s_parser_impl_parse_string(state, reinterpret_cast<const unsigned char *>(p + 4), payload - 4);\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            case 6:\n");
+        fprintf(file, "                ok = %s_parser_impl_parse_map_key(state, reinterpret_cast<const unsigned char *>(p + 4), payload - 4);\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            case 7:\n");
+        fprintf(file, "                ++nesting;\n");
+        fprintf(file, "                ok = %s_parser_impl_parse_start_map(state);\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            case 9:\n");
+        fprintf(file, "                ++nesting;\n");
+        fprintf(file, "                ok = %s_parser_impl_parse_start_array(state);\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "            case 8:\n");
+        fprintf(file, "            case 10:\n");
+        fprintf(file, "                if (PROTOG_UNLIKELY(nesting-- == 0)) {\n");
+        fprintf(file, "                    ok = %s_parser_impl_fail(*state, \"Corrupt tape\");\n", t);
+        fprintf(file, "                } else {\n");
+        fprintf(file, "                    ok = type == 8 ? %s_parser_impl_parse_end_map(state) : %s_parser_impl_parse_end_array(state);\n", t, t);
+        fprintf(file, "                }\n");
+        fprintf(file, "                break;\n");
+        fprintf(file, "            default:\n");
+        fprintf(file, "                ok = %s_parser_impl_fail(*state, \"Corrupt tape\");\n", t);
+        fprintf(file, "                break;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        p += payload;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (ok && (nesting != 0 || records == 0)) {\n");
+        fprintf(file, "        ok = %s_parser_impl_fail(*state, \"Truncated tape\");\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    state->replaying = false;\n");
+        fprintf(file, "    state->chunk = nullptr;\n");
+        fprintf(file, "    state->offset += tapeJsonLen;\n");
+        fprintf(file, "    PROTOG_PROBE4(parse_end, \"%s\", state->location, state->offset, ok);\n", t);
+        fprintf(file, "    %s_parser_impl_record(*state, ok);\n", t);
+        fprintf(file, "    return !ok;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printStatsApiImpl(FILE *file, const char *t) {
+        fprintf(file, "void %s_parser_stats(%s_parser_stats_s *stats) {\n", t, t);
+        fprintf(file, "    assert(stats);\n");
+        fprintf(file, "    *stats = %s_parser_stats_s();\n", t);
+        fprintf(file, "    for (auto *block = %s_parser_impl_all_stats.load(std::memory_order_acquire); block; block = block->next) {\n", t);
+        fprintf(file, "        stats->bytesParsed += block->bytesParsed.load(std::memory_order_relaxed);\n");
+        fprintf(file, "        stats->messagesCompleted += block->messagesCompleted.load(std::memory_order_relaxed);\n");
+        fprintf(file, "        stats->messagesRejected += block->messagesRejected.load(std::memory_order_relaxed);\n");
+        fprintf(file, "        stats->unknownKeys += block->unknownKeys.load(std::memory_order_relaxed);\n");
+        fprintf(file, "        stats->skippedBytes += block->skippedBytes.load(std::memory_order_relaxed);\n");
+        fprintf(file, "        stats->allocations += block->allocations.load(std::memory_order_relaxed);\n");
+        fprintf(file, "        stats->bytesAllocated += block->bytesAllocated.load(std::memory_order_relaxed);\n");
+        fprintf(file, "        for (size_t i = 0; i < 64; ++i) {\n");
+        fprintf(file, "            stats->latencyHistogram[i] += block->latencyHistogram[i].load(std::memory_order_relaxed);\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        ++stats->threads;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "}\n\n");
+    }
+
+    static void printNamespaceBegin(FILE *file, const Graph &graph) {
+        const auto ns = split(graph.fileDesc->package(), '.');
+        for (auto it = ns.begin(); it != ns.end(); ++it) {
+            fprintf(file, "namespace %s {\n", it->c_str());
+        }
+        fprintf(file, "\n");
+    }
+
+    static void printNamespaceEnd(FILE *file, const Graph &graph) {
+        const auto ns = split(graph.fileDesc->package(), '.');
+        for (auto it = ns.rbegin(); it != ns.rend(); ++it) {
+            fprintf(file, "} // namespace %s\n", it->c_str());
+        }
+    }
+
+    static size_t get_cpp_type_size(const FieldDescriptor& field) {
+        switch (field.cpp_type()) {
+            case FieldDescriptor::CPPTYPE_BOOL:
+                return 1;
+            case FieldDescriptor::CPPTYPE_INT64:
+            case FieldDescriptor::CPPTYPE_UINT64:
+            case FieldDescriptor::CPPTYPE_DOUBLE:
+                return 8;
+            default:
+                return 4;
+        }
+    }
+
+    static std::string get_c_string_literal(const std::string& str) {
+        std::string literal = "\"";
+        for (const unsigned char ch : str) {
+            if (ch == '"' || ch == '\\') {
+                literal += '\\';
+                literal += ch;
+            } else if (ch < 0x20 || ch >= 0x7f) {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\%03o", ch);
+                literal += esc;
+            } else {
+                literal += ch;
+            }
+        }
+        return literal + "\"";
+    }
+
+    template <typename Descriptor>
+    static std::string get_full_cpp_type_name(const Descriptor& desc) {
+        return "::" + replace_all(desc.full_name(), ".", "::");
+    }
+
+    // Values are written to the message of the innermost open object. Its nesting level is known for every
+    // node, so instead of a stack of messages the state holds one slot per level, which is set when an object
+    // of that level starts. The root message is *state.req, and messages without message fields need no slots.
+    static std::string get_frame(int frame) {
+        return frame == 0 ? "state.req" : "state.messages[" + std::to_string(frame - 1) + "]";
+    }
+
+    // the message that a field or item node belongs to, with its type
+    std::string get_message(int frame, const Descriptor &desc) {
+        return frame == 0 ? "state.req" : "static_cast<" + get_cached_cpp_type_name(desc) + " *>(" + get_frame(frame) + ")";
+    }
+
+    std::string get_message(const Node &node) {
+        return get_message(node.frame, *node.desc);
+    }
+
+    // every field node prints the type of its message, so the names are only built once per message
+    const std::string &get_cached_cpp_type_name(const Descriptor &desc) {
+        auto it = cppTypeNames.find(&desc);
+        if (it == cppTypeNames.end()) {
+            it = cppTypeNames.emplace(&desc, get_full_cpp_type_name(desc)).first;
+        }
+        return it->second;
+    }
+
+    // generated parsers of large schemas are hundreds of megabytes, which are written in few large blocks
+    static FILE *openOutput(const std::string &name) {
+        FILE *file = fopen(name.c_str(), "w");
+        if (!file) {
+            throw std::runtime_error("Unable to create " + name);
+        }
+        setvbuf(file, nullptr, _IOFBF, 1 << 20);
+        return file;
+    }
+
+    static void closeOutput(FILE *file, const std::string &name) {
+        if (ferror(file) | fclose(file)) {
+            throw std::runtime_error("Unable to write " + name);
+        }
+    }
+};
+
+} // namespace protog
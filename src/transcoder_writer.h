@@ -0,0 +1,709 @@
+#pragma once
+
+#include "sax_writer.h"
+
+namespace protog {
+
+// Emits a transcoder that writes messages in protobuf wire format as json, without creating message objects.
+// Every object node of the Graph becomes a function that switches over the field numbers of its message and
+// writes the keys from precomputed literals. The json is what the generated parsers read: keys are the field
+// names, enums and 64 bit integers are numbers, and bytes are written like strings. Bytes that are not part of
+// valid UTF-8, which the parsers would reject, are written as \u00XX escapes and read back as U+00XX, so only
+// strings and bytes that are valid UTF-8 survive a round trip unchanged.
+struct TranscoderWriter : public Writer {
+    virtual ~TranscoderWriter() {}
+
+    virtual void write(const Graph &graph, const char *) override {
+        auto name_lower = graph.root.desc->name();
+        std::transform(name_lower.begin(), name_lower.end(), name_lower.begin(), ::tolower);
+        const auto res_name_prefix = name_lower + "_json.pb";
+
+        const auto header_name = res_name_prefix + ".h";
+        FILE *header = SaxWriter::openOutput(header_name);
+        printHeader(header, graph, name_lower.c_str());
+        SaxWriter::closeOutput(header, header_name);
+
+        const auto source_name = res_name_prefix + ".cc";
+        FILE *source = SaxWriter::openOutput(source_name);
+        printSource(source, graph, name_lower.c_str());
+        SaxWriter::closeOutput(source, source_name);
+    }
+
+    void printHeader(FILE *file, const Graph &graph, const char *t) {
+        fprintf(file, "#pragma once\n\n");
+        fprintf(file, "#include <stddef.h>\n\n");
+        fprintf(file, "#include <string>\n\n");
+        SaxWriter::printNamespaceBegin(file, graph);
+        fprintf(file, "// Appends a %s in protobuf wire format to json, as json. Returns 0, or 1 without appending\n",
+                graph.root.desc->full_name().c_str());
+        fprintf(file, "// anything if the wire format is malformed or nests messages deeper than maxDepth.\n");
+        fprintf(file, "int %s_json_transcode(const char *wire, size_t wireLen, std::string &json, size_t maxDepth = 100);\n", t);
+        fprintf(file, "std::string %s_json_transcode_easy(const std::string &wire);\n", t);
+        fprintf(file, "\n");
+        SaxWriter::printNamespaceEnd(file, graph);
+    }
+
+    void printSource(FILE *file, const Graph &graph, const char *t) {
+        fprintf(file, "#include \"%s_json.pb.h\"\n\n", t);
+        fprintf(file, "#include <math.h>\n");
+        fprintf(file, "#include <stdint.h>\n");
+        fprintf(file, "#include <stdio.h>\n");
+        fprintf(file, "#include <stdlib.h>\n");
+        fprintf(file, "#include <string.h>\n\n");
+        fprintf(file, "#include <algorithm>\n");
+        fprintf(file, "#include <stdexcept>\n");
+        fprintf(file, "#include <string>\n");
+        fprintf(file, "#include <vector>\n\n");
+        SaxWriter::printNamespaceBegin(file, graph);
+        fprintf(file, "namespace {\n\n");
+        printWireImpl(file, t);
+        printJsonImpl(file, graph, t);
+        printMergeImpl(file, t);
+        for (const auto &node : graph.object_nodes) {
+            fprintf(file, "static int %s_json_impl_message_%d(const unsigned char *p, const unsigned char *end, std::string &out, size_t depth);\n",
+                    t, node->state);
+        }
+        fprintf(file, "\n");
+        for (const auto &node : graph.object_nodes) {
+            printMessageImpl(file, *node, t);
+        }
+        fprintf(file, "} // anonymous namespace\n\n");
+        printApiImpl(file, graph, t);
+        SaxWriter::printNamespaceEnd(file, graph);
+    }
+
+    void printWireImpl(FILE *file, const char *t) {
+        fprintf(file, "static inline int %s_json_impl_varint(const unsigned char *&p, const unsigned char *end, uint64_t &v) {\n", t);
+        fprintf(file, "    if (p < end && *p < 0x80) {\n");
+        fprintf(file, "        v = *p++;\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    v = 0;\n");
+        fprintf(file, "    for (int shift = 0; shift < 64 && p < end; shift += 7) {\n");
+        fprintf(file, "        const unsigned char b = *p++;\n");
+        fprintf(file, "        v |= static_cast<uint64_t>(b & 0x7f) << shift;\n");
+        fprintf(file, "        if (b < 0x80) {\n");
+        fprintf(file, "            return 1;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 0;\n");
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static inline int %s_json_impl_length(const unsigned char *&p, const unsigned char *end, uint64_t &len) {\n", t);
+        fprintf(file, "    return %s_json_impl_varint(p, end, len) && len <= static_cast<uint64_t>(end - p);\n", t);
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static inline int %s_json_impl_fixed32(const unsigned char *&p, const unsigned char *end, uint32_t &v) {\n", t);
+        fprintf(file, "    if (end - p < 4) {\n");
+        fprintf(file, "        return 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    v = static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 | static_cast<uint32_t>(p[2]) << 16 |\n");
+        fprintf(file, "        static_cast<uint32_t>(p[3]) << 24;\n");
+        fprintf(file, "    p += 4;\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static inline int %s_json_impl_fixed64(const unsigned char *&p, const unsigned char *end, uint64_t &v) {\n", t);
+        fprintf(file, "    uint32_t lo, hi;\n");
+        fprintf(file, "    if (!%s_json_impl_fixed32(p, end, lo) || !%s_json_impl_fixed32(p, end, hi)) {\n", t, t);
+        fprintf(file, "        return 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    v = static_cast<uint64_t>(hi) << 32 | lo;\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static inline int64_t %s_json_impl_zigzag(uint64_t v) {\n", t);
+        fprintf(file, "    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);\n");
+        fprintf(file, "}\n\n");
+
+        // skips the value of a field that is not part of the message, including groups
+        fprintf(file, "static int %s_json_impl_skip(const unsigned char *&p, const unsigned char *end, uint64_t tag, size_t depth) {\n", t);
+        fprintf(file, "    uint64_t v;\n");
+        fprintf(file, "    uint32_t v32;\n");
+        fprintf(file, "    if ((tag >> 3) == 0) {\n");
+        fprintf(file, "        return 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    switch (tag & 7) {\n");
+        fprintf(file, "        case 0:\n");
+        fprintf(file, "            return %s_json_impl_varint(p, end, v);\n", t);
+        fprintf(file, "        case 1:\n");
+        fprintf(file, "            return %s_json_impl_fixed64(p, end, v);\n", t);
+        fprintf(file, "        case 2:\n");
+        fprintf(file, "            if (!%s_json_impl_length(p, end, v)) {\n", t);
+        fprintf(file, "                return 0;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            p += v;\n");
+        fprintf(file, "            return 1;\n");
+        fprintf(file, "        case 3:\n");
+        fprintf(file, "            while (depth > 1 && %s_json_impl_varint(p, end, v)) {\n", t);
+        fprintf(file, "                if ((v & 7) == 4) {\n");
+        fprintf(file, "                    return (v >> 3) == (tag >> 3);\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                if (!%s_json_impl_skip(p, end, v, depth - 1)) {\n", t);
+        fprintf(file, "                    return 0;\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            return 0;\n");
+        fprintf(file, "        case 5:\n");
+        fprintf(file, "            return %s_json_impl_fixed32(p, end, v32);\n", t);
+        fprintf(file, "        default:\n");
+        fprintf(file, "            return 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printJsonImpl(FILE *file, const Graph &graph, const char *t) {
+        fprintf(file, "static const char %s_json_impl_digits[] =\n", t);
+        for (int row = 0; row < 5; ++row) {
+            fprintf(file, "    \"");
+            for (int i = row * 20; i < row * 20 + 20; ++i) {
+                fprintf(file, "%02d", i);
+            }
+            fprintf(file, "\"%s\n", row == 4 ? ";" : "");
+        }
+        fprintf(file, "\n");
+
+        fprintf(file, "static inline void %s_json_impl_uint(std::string &out, uint64_t v) {\n", t);
+        fprintf(file, "    char buf[20];\n");
+        fprintf(file, "    char *p = buf + sizeof(buf);\n");
+        fprintf(file, "    while (v >= 100) {\n");
+        fprintf(file, "        p -= 2;\n");
+        fprintf(file, "        memcpy(p, %s_json_impl_digits + (v %% 100) * 2, 2);\n", t);
+        fprintf(file, "        v /= 100;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (v >= 10) {\n");
+        fprintf(file, "        p -= 2;\n");
+        fprintf(file, "        memcpy(p, %s_json_impl_digits + v * 2, 2);\n", t);
+        fprintf(file, "    } else {\n");
+        fprintf(file, "        *--p = static_cast<char>('0' + v);\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    out.append(p, buf + sizeof(buf) - p);\n");
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static inline void %s_json_impl_int(std::string &out, int64_t v) {\n", t);
+        fprintf(file, "    if (v < 0) {\n");
+        fprintf(file, "        out.push_back('-');\n");
+        fprintf(file, "        %s_json_impl_uint(out, 0 - static_cast<uint64_t>(v));\n", t);
+        fprintf(file, "    } else {\n");
+        fprintf(file, "        %s_json_impl_uint(out, static_cast<uint64_t>(v));\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "}\n\n");
+
+        // Integral values are written as integers, others with 15 (float: 6) significant digits if those read
+        // back to the same value, and with 17 (float: 9) otherwise. json has no nan and infinity.
+        if (hasFieldType(graph, FieldDescriptor::TYPE_DOUBLE)) {
+            fprintf(file, "static void %s_json_impl_double(std::string &out, uint64_t bits) {\n", t);
+            fprintf(file, "    double d;\n");
+            fprintf(file, "    memcpy(&d, &bits, sizeof(d));\n");
+            fprintf(file, "    if (!isfinite(d)) {\n");
+            fprintf(file, "        out.append(\"null\", 4);\n");
+            fprintf(file, "        return;\n");
+            fprintf(file, "    }\n");
+            fprintf(file, "    if (fabs(d) < 1e15 && d == static_cast<double>(static_cast<int64_t>(d)) && !(d == 0 && signbit(d))) {\n");
+            fprintf(file, "        %s_json_impl_int(out, static_cast<int64_t>(d));\n", t);
+            fprintf(file, "        return;\n");
+            fprintf(file, "    }\n");
+            fprintf(file, "    char buf[32];\n");
+            fprintf(file, "    int n = snprintf(buf, sizeof(buf), \"%%.15g\", d);\n");
+            fprintf(file, "    if (strtod(buf, nullptr) != d) {\n");
+            fprintf(file, "        n = snprintf(buf, sizeof(buf), \"%%.17g\", d);\n");
+            fprintf(file, "    }\n");
+            fprintf(file, "    out.append(buf, n);\n");
+            fprintf(file, "}\n\n");
+        }
+        if (hasFieldType(graph, FieldDescriptor::TYPE_FLOAT)) {
+            fprintf(file, "static void %s_json_impl_float(std::string &out, uint32_t bits) {\n", t);
+            fprintf(file, "    float f;\n");
+            fprintf(file, "    memcpy(&f, &bits, sizeof(f));\n");
+            fprintf(file, "    if (!isfinite(f)) {\n");
+            fprintf(file, "        out.append(\"null\", 4);\n");
+            fprintf(file, "        return;\n");
+            fprintf(file, "    }\n");
+            fprintf(file, "    if (fabsf(f) < 1e7f && f == static_cast<float>(static_cast<int32_t>(f)) && !(f == 0 && signbit(f))) {\n");
+            fprintf(file, "        %s_json_impl_int(out, static_cast<int32_t>(f));\n", t);
+            fprintf(file, "        return;\n");
+            fprintf(file, "    }\n");
+            fprintf(file, "    char buf[32];\n");
+            fprintf(file, "    int n = snprintf(buf, sizeof(buf), \"%%.6g\", f);\n");
+            fprintf(file, "    if (strtof(buf, nullptr) != f) {\n");
+            fprintf(file, "        n = snprintf(buf, sizeof(buf), \"%%.9g\", f);\n");
+            fprintf(file, "    }\n");
+            fprintf(file, "    out.append(buf, n);\n");
+            fprintf(file, "}\n\n");
+        }
+
+        // the second character of the escape sequence of each byte, 0 for bytes that are copied and '8' for
+        // bytes that are copied if they belong to valid UTF-8
+        fprintf(file, "static const char %s_json_impl_escapes[256] = {\n", t);
+        for (int row = 0; row < 256; row += 16) {
+            fprintf(file, "   ");
+            for (int ch = row; ch < row + 16; ++ch) {
+                fprintf(file, " %s,", getEscapeLiteral(ch));
+            }
+            fprintf(file, "\n");
+        }
+        fprintf(file, "};\n\n");
+
+        // length of the UTF-8 sequence at s, 0 if it is invalid: overlong forms, surrogates and code points
+        // above U+10FFFF are rejected like by the strictest of the parsers
+        fprintf(file, "static size_t %s_json_impl_utf8_len(const unsigned char *s, const unsigned char *end) {\n", t);
+        fprintf(file, "    const unsigned char c = *s;\n");
+        fprintf(file, "    size_t n = 2;\n");
+        fprintf(file, "    unsigned char lo = 0x80;\n");
+        fprintf(file, "    unsigned char hi = 0xbf;\n");
+        fprintf(file, "    if (c >= 0xe0 && c <= 0xef) {\n");
+        fprintf(file, "        n = 3;\n");
+        fprintf(file, "        lo = c == 0xe0 ? 0xa0 : lo;\n");
+        fprintf(file, "        hi = c == 0xed ? 0x9f : hi;\n");
+        fprintf(file, "    } else if (c >= 0xf0 && c <= 0xf4) {\n");
+        fprintf(file, "        n = 4;\n");
+        fprintf(file, "        lo = c == 0xf0 ? 0x90 : lo;\n");
+        fprintf(file, "        hi = c == 0xf4 ? 0x8f : hi;\n");
+        fprintf(file, "    } else if (c < 0xc2 || c > 0xdf) {\n");
+        fprintf(file, "        return 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (static_cast<size_t>(end - s) < n || s[1] < lo || s[1] > hi) {\n");
+        fprintf(file, "        return 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    for (size_t i = 2; i < n; ++i) {\n");
+        fprintf(file, "        if ((s[i] & 0xc0) != 0x80) {\n");
+        fprintf(file, "            return 0;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return n;\n");
+        fprintf(file, "}\n\n");
+
+        // strings and bytes are copied as they are, apart from the escapes json needs and bytes that are not UTF-8
+        fprintf(file, "static void %s_json_impl_string(std::string &out, const unsigned char *s, size_t len) {\n", t);
+        fprintf(file, "    const unsigned char *end = s + len;\n");
+        fprintf(file, "    const unsigned char *run = s;\n");
+        fprintf(file, "    out.push_back('\"');\n");
+        fprintf(file, "    for (; s < end; ++s) {\n");
+        fprintf(file, "        char esc = %s_json_impl_escapes[*s];\n", t);
+        fprintf(file, "        if (!esc) {\n");
+        fprintf(file, "            continue;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (esc == '8') {\n");
+        fprintf(file, "            const size_t n = %s_json_impl_utf8_len(s, end);\n", t);
+        fprintf(file, "            if (n) {\n");
+        fprintf(file, "                s += n - 1;\n");
+        fprintf(file, "                continue;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            esc = 'u';\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        out.append(reinterpret_cast<const char *>(run), s - run);\n");
+        fprintf(file, "        if (esc == 'u') {\n");
+        fprintf(file, "            char u[6] = {'\\\\', 'u', '0', '0', \"0123456789abcdef\"[*s >> 4], \"0123456789abcdef\"[*s & 15]};\n");
+        fprintf(file, "            out.append(u, sizeof(u));\n");
+        fprintf(file, "        } else {\n");
+        fprintf(file, "            const char e[2] = {'\\\\', esc};\n");
+        fprintf(file, "            out.append(e, sizeof(e));\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        run = s + 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    out.append(reinterpret_cast<const char *>(run), end - run);\n");
+        fprintf(file, "    out.push_back('\"');\n");
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "struct %s_json_impl_object_s {\n", t);
+        fprintf(file, "    %s_json_impl_object_s(std::string &out, unsigned char *seen) : out(out), start(out.size()), seen(seen) {\n", t);
+        fprintf(file, "        out.push_back('{');\n");
+        fprintf(file, "    }\n\n");
+        fprintf(file, "    std::string &out;\n");
+        fprintf(file, "    size_t start;\n");
+        fprintf(file, "    unsigned char *seen; // per field of the message, whether its key was written\n");
+        fprintf(file, "    size_t current = SIZE_MAX; // field that was written last, its array is still open if repeated\n");
+        fprintf(file, "    bool repeated = false;\n");
+        fprintf(file, "    bool first = true;\n");
+        fprintf(file, "};\n\n");
+
+        // Keys are passed with a leading comma, which the first member skips. Returns 0 if the field appeared
+        // before, which the single pass can not merge.
+        fprintf(file, "static inline int %s_json_impl_member(%s_json_impl_object_s &obj, size_t index, bool repeated, const char *key, size_t keyLen) {\n", t, t);
+        fprintf(file, "    if (index == obj.current) {\n");
+        fprintf(file, "        if (!repeated) {\n");
+        fprintf(file, "            return 0;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        obj.out.push_back(',');\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (obj.seen[index]) {\n");
+        fprintf(file, "        return 0;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    obj.seen[index] = 1;\n");
+        fprintf(file, "    if (obj.repeated) {\n");
+        fprintf(file, "        obj.out.push_back(']');\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    obj.out.append(key + obj.first, keyLen - obj.first);\n");
+        fprintf(file, "    if (repeated) {\n");
+        fprintf(file, "        obj.out.push_back('[');\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    obj.current = index;\n");
+        fprintf(file, "    obj.repeated = repeated;\n");
+        fprintf(file, "    obj.first = false;\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "static inline void %s_json_impl_end(%s_json_impl_object_s &obj) {\n", t, t);
+        fprintf(file, "    if (obj.repeated) {\n");
+        fprintf(file, "        obj.out.push_back(']');\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    obj.out.push_back('}');\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printMergeImpl(FILE *file, const char *t) {
+        fprintf(file, "enum {\n");
+        fprintf(file, "    %s_json_impl_keep_all = 0, // repeated fields\n", t);
+        fprintf(file, "    %s_json_impl_keep_last = 1, // scalars\n", t);
+        fprintf(file, "    %s_json_impl_keep_merged = 2, // messages\n", t);
+        fprintf(file, "};\n\n");
+        fprintf(file, "struct %s_json_impl_field_s {\n", t);
+        fprintf(file, "    uint64_t number;\n");
+        fprintf(file, "    int keep;\n");
+        fprintf(file, "};\n\n");
+        fprintf(file, "typedef int (*%s_json_impl_message_f)(const unsigned char *p, const unsigned char *end, std::string &out, size_t depth);\n\n", t);
+
+        // A field may appear several times in the wire format, e.g. when messages were concatenated: the last
+        // scalar wins, messages are merged and items are appended. The single pass gives up when a field
+        // appears again, and the message is rewritten with all occurrences of each field in one place.
+        fprintf(file, "static int %s_json_impl_merge(const unsigned char *p, const unsigned char *end, std::string &out, size_t depth,\n", t);
+        fprintf(file, "                             const %s_json_impl_field_s *fields, size_t fieldCount, %s_json_impl_message_f message) {\n", t, t);
+        fprintf(file, "    struct record_s {\n");
+        fprintf(file, "        size_t field;\n");
+        fprintf(file, "        size_t order; // index of the first record of the field\n");
+        fprintf(file, "        const unsigned char *begin;\n");
+        fprintf(file, "        const unsigned char *value;\n");
+        fprintf(file, "        const unsigned char *end;\n");
+        fprintf(file, "    };\n");
+        fprintf(file, "    std::vector<record_s> records;\n");
+        fprintf(file, "    std::vector<size_t> order(fieldCount, SIZE_MAX);\n");
+        fprintf(file, "    while (p < end) {\n");
+        fprintf(file, "        const unsigned char *begin = p;\n");
+        fprintf(file, "        uint64_t tag;\n");
+        fprintf(file, "        if (!%s_json_impl_varint(p, end, tag)) {\n", t);
+        fprintf(file, "            return 0;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        const unsigned char *value = p;\n");
+        fprintf(file, "        if (!%s_json_impl_skip(p, end, tag, depth)) {\n", t);
+        fprintf(file, "            return 0;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        size_t field = 0;\n");
+        fprintf(file, "        while (field < fieldCount && fields[field].number != tag >> 3) {\n");
+        fprintf(file, "            ++field;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (field == fieldCount || (fields[field].keep == %s_json_impl_keep_merged && (tag & 7) != 2)) {\n", t);
+        fprintf(file, "            continue;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (order[field] == SIZE_MAX) {\n");
+        fprintf(file, "            order[field] = records.size();\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        records.push_back(record_s{field, order[field], begin, value, p});\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    std::stable_sort(records.begin(), records.end(), [](const record_s &a, const record_s &b) {\n");
+        fprintf(file, "        return a.order < b.order;\n");
+        fprintf(file, "    });\n");
+        fprintf(file, "    std::string merged;\n");
+        fprintf(file, "    for (size_t i = 0, j = 0; i < records.size(); i = j) {\n");
+        fprintf(file, "        while (j < records.size() && records[j].field == records[i].field) {\n");
+        fprintf(file, "            ++j;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        switch (fields[records[i].field].keep) {\n");
+        fprintf(file, "            case %s_json_impl_keep_all:\n", t);
+        fprintf(file, "                for (size_t k = i; k < j; ++k) {\n");
+        fprintf(file, "                    merged.append(reinterpret_cast<const char *>(records[k].begin), records[k].end - records[k].begin);\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                break;\n");
+        fprintf(file, "            case %s_json_impl_keep_last:\n", t);
+        fprintf(file, "                merged.append(reinterpret_cast<const char *>(records[j - 1].begin), records[j - 1].end - records[j - 1].begin);\n");
+        fprintf(file, "                break;\n");
+        fprintf(file, "            default: {\n");
+        fprintf(file, "                // the concatenation of messages is their merge\n");
+        fprintf(file, "                std::string payload;\n");
+        fprintf(file, "                for (size_t k = i; k < j; ++k) {\n");
+        fprintf(file, "                    const unsigned char *q = records[k].value;\n");
+        fprintf(file, "                    uint64_t len;\n");
+        fprintf(file, "                    %s_json_impl_length(q, records[k].end, len);\n", t);
+        fprintf(file, "                    payload.append(reinterpret_cast<const char *>(q), len);\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                merged.append(reinterpret_cast<const char *>(records[i].begin), records[i].value - records[i].begin);\n");
+        fprintf(file, "                for (uint64_t len = payload.size(); ; len >>= 7) {\n");
+        fprintf(file, "                    if (len < 0x80) {\n");
+        fprintf(file, "                        merged.push_back(static_cast<char>(len));\n");
+        fprintf(file, "                        break;\n");
+        fprintf(file, "                    }\n");
+        fprintf(file, "                    merged.push_back(static_cast<char>(0x80 | (len & 0x7f)));\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                merged.append(payload);\n");
+        fprintf(file, "                break;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    const unsigned char *data = reinterpret_cast<const unsigned char *>(merged.data());\n");
+        fprintf(file, "    return message(data, data + merged.size(), out, depth);\n");
+        fprintf(file, "}\n\n");
+    }
+
+    void printMessageImpl(FILE *file, const Node &node, const char *t) {
+        const auto &msgDesc = node.field ? *node.field->message_type() : *node.desc;
+        const size_t fieldCount = node.children.size() + (node.unknown_field ? 1 : 0);
+        if (fieldCount > 0) {
+            fprintf(file, "static const %s_json_impl_field_s %s_json_impl_fields_%d[] = {\n", t, t, node.state);
+            for (const auto &child : node.children) {
+                const char *keep = child->type == NodeType::ARRAY ? "all"
+                                   : child->type == NodeType::OUTSIDE_OBJECT ? "merged" : "last";
+                fprintf(file, "    {%d, %s_json_impl_keep_%s}, // %s\n", child->field->number(), t, keep,
+                        child->name);
+            }
+            if (node.unknown_field) {
+                fprintf(file, "    {%d, %s_json_impl_keep_last}, // %s\n", node.unknown_field->number(), t,
+                        node.unknown_field->name().c_str());
+            }
+            fprintf(file, "};\n\n");
+        }
+
+        fprintf(file, "// %s (%s)\n", node.full_name().c_str(), msgDesc.full_name().c_str());
+        fprintf(file, "static int %s_json_impl_message_%d(const unsigned char *p, const unsigned char *end, std::string &out, size_t depth) {\n",
+                t, node.state);
+        fprintf(file, "    if (depth == 0) {\n");
+        fprintf(file, "        return 0;\n");
+        fprintf(file, "    }\n");
+        if (fieldCount > 0) {
+            fprintf(file, "    const unsigned char *const begin = p;\n");
+        }
+        fprintf(file, "    unsigned char seen[%zu] = {};\n", std::max<size_t>(fieldCount, 1));
+        fprintf(file, "    %s_json_impl_object_s obj(out, seen);\n", t);
+        fprintf(file, "    while (p < end) {\n");
+        fprintf(file, "        uint64_t tag;\n");
+        fprintf(file, "        if (!%s_json_impl_varint(p, end, tag)) {\n", t);
+        fprintf(file, "            return 0;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        switch (tag >> 3) {\n");
+        for (size_t i = 0; i < node.children.size(); ++i) {
+            printFieldImpl(file, *node.children[i], i, t);
+        }
+        if (node.unknown_field) {
+            // holds the captured unknown keys with their values, see protog -u
+            fprintf(file, "            case %d: { // %s\n", node.unknown_field->number(), node.unknown_field->name().c_str());
+            fprintf(file, "                uint64_t len;\n");
+            fprintf(file, "                if ((tag & 7) != 2) {\n");
+            printSkip(file, t, "                    ");
+            fprintf(file, "                }\n");
+            fprintf(file, "                if (!%s_json_impl_length(p, end, len)) {\n", t);
+            fprintf(file, "                    return 0;\n");
+            fprintf(file, "                }\n");
+            fprintf(file, "                if (len > 0) {\n");
+            fprintf(file, "                    if (!%s_json_impl_member(obj, %zu, false, \",\", 1)) {\n", t, node.children.size());
+            fprintf(file, "                        goto merge;\n");
+            fprintf(file, "                    }\n");
+            fprintf(file, "                    out.append(reinterpret_cast<const char *>(p), len);\n");
+            fprintf(file, "                }\n");
+            fprintf(file, "                p += len;\n");
+            fprintf(file, "                break;\n");
+            fprintf(file, "            }\n");
+        }
+        fprintf(file, "            default:\n");
+        fprintf(file, "                if (!%s_json_impl_skip(p, end, tag, depth)) {\n", t);
+        fprintf(file, "                    return 0;\n");
+        fprintf(file, "                }\n");
+        fprintf(file, "                break;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    %s_json_impl_end(obj);\n", t);
+        fprintf(file, "    return 1;\n");
+        if (fieldCount > 0) {
+            fprintf(file, "merge:\n");
+            fprintf(file, "    out.resize(obj.start);\n");
+            fprintf(file, "    return %s_json_impl_merge(begin, end, out, depth, %s_json_impl_fields_%d, %zu, %s_json_impl_message_%d);\n",
+                    t, t, node.state, fieldCount, t, node.state);
+        }
+        fprintf(file, "}\n\n");
+    }
+
+    void printFieldImpl(FILE *file, const Node &node, size_t index, const char *t) {
+        const bool repeated = node.type == NodeType::ARRAY;
+        const Node &value = repeated ? *node.children.front() : node;
+        const int wireType = getWireType(*node.field);
+        const std::string key = std::string(",\"") + node.name + "\":";
+        const auto key_literal = SaxWriter::get_c_string_literal(key);
+
+        fprintf(file, "            case %d: { // %s\n", node.field->number(), node.name);
+        if (repeated && wireType != 2) {
+            // numeric items can be packed
+            fprintf(file, "                if ((tag & 7) == 2) {\n");
+            fprintf(file, "                    uint64_t len;\n");
+            fprintf(file, "                    if (!%s_json_impl_length(p, end, len)) {\n", t);
+            fprintf(file, "                        return 0;\n");
+            fprintf(file, "                    }\n");
+            fprintf(file, "                    if (len == 0) {\n");
+            fprintf(file, "                        break;\n");
+            fprintf(file, "                    }\n");
+            fprintf(file, "                    const unsigned char *const items = p + len;\n");
+            fprintf(file, "                    if (!%s_json_impl_member(obj, %zu, true, %s, %zu)) {\n", t, index,
+                    key_literal.c_str(), key.size());
+            fprintf(file, "                        goto merge;\n");
+            fprintf(file, "                    }\n");
+            fprintf(file, "                    for (;;) {\n");
+            printValue(file, value, "items", t, "                        ");
+            fprintf(file, "                        if (p == items) {\n");
+            fprintf(file, "                            break;\n");
+            fprintf(file, "                        }\n");
+            fprintf(file, "                        out.push_back(',');\n");
+            fprintf(file, "                    }\n");
+            fprintf(file, "                    break;\n");
+            fprintf(file, "                }\n");
+        }
+        fprintf(file, "                if ((tag & 7) != %d) {\n", wireType);
+        printSkip(file, t, "                    ");
+        fprintf(file, "                }\n");
+        fprintf(file, "                if (!%s_json_impl_member(obj, %zu, %s, %s, %zu)) {\n", t, index,
+                repeated ? "true" : "false", key_literal.c_str(), key.size());
+        fprintf(file, "                    goto merge;\n");
+        fprintf(file, "                }\n");
+        printValue(file, value, "end", t, "                ");
+        fprintf(file, "                break;\n");
+        fprintf(file, "            }\n");
+    }
+
+    // reads a single value of the node's field from p and writes it as json
+    void printValue(FILE *file, const Node &node, const char *end, const char *t, const char *indent) {
+        const auto &field = *node.field;
+        if (node.type == NodeType::OUTSIDE_OBJECT || node.type == NodeType::STRING) {
+            fprintf(file, "%suint64_t len;\n", indent);
+            fprintf(file, "%sif (!%s_json_impl_length(p, %s, len)) {\n", indent, t, end);
+            fprintf(file, "%s    return 0;\n", indent);
+            fprintf(file, "%s}\n", indent);
+            if (node.type == NodeType::STRING) {
+                fprintf(file, "%s%s_json_impl_string(out, p, len);\n", indent, t);
+            } else {
+                fprintf(file, "%sif (!%s_json_impl_message_%d(p, p + len, out, depth - 1)) {\n", indent, t,
+                        node.children.front()->state);
+                fprintf(file, "%s    return 0;\n", indent);
+                fprintf(file, "%s}\n", indent);
+            }
+            fprintf(file, "%sp += len;\n", indent);
+            return;
+        }
+
+        const int wireType = getWireType(field);
+        const char *read = wireType == 0 ? "varint" : wireType == 1 ? "fixed64" : "fixed32";
+        fprintf(file, "%s%s v;\n", indent, wireType == 5 ? "uint32_t" : "uint64_t");
+        fprintf(file, "%sif (!%s_json_impl_%s(p, %s, v)) {\n", indent, t, read, end);
+        fprintf(file, "%s    return 0;\n", indent);
+        fprintf(file, "%s}\n", indent);
+        switch (field.type()) {
+            case FieldDescriptor::TYPE_BOOL:
+                fprintf(file, "%sv ? out.append(\"true\", 4) : out.append(\"false\", 5);\n", indent);
+                break;
+            case FieldDescriptor::TYPE_INT32:
+            case FieldDescriptor::TYPE_SFIXED32:
+            case FieldDescriptor::TYPE_ENUM:
+                fprintf(file, "%s%s_json_impl_int(out, static_cast<int32_t>(v));\n", indent, t);
+                break;
+            case FieldDescriptor::TYPE_INT64:
+            case FieldDescriptor::TYPE_SFIXED64:
+                fprintf(file, "%s%s_json_impl_int(out, static_cast<int64_t>(v));\n", indent, t);
+                break;
+            case FieldDescriptor::TYPE_UINT32:
+                fprintf(file, "%s%s_json_impl_uint(out, static_cast<uint32_t>(v));\n", indent, t);
+                break;
+            case FieldDescriptor::TYPE_UINT64:
+            case FieldDescriptor::TYPE_FIXED32:
+            case FieldDescriptor::TYPE_FIXED64:
+                fprintf(file, "%s%s_json_impl_uint(out, v);\n", indent, t);
+                break;
+            case FieldDescriptor::TYPE_SINT32:
+                fprintf(file, "%s%s_json_impl_int(out, static_cast<int32_t>(%s_json_impl_zigzag(static_cast<uint32_t>(v))));\n",
+                        indent, t, t);
+                break;
+            case FieldDescriptor::TYPE_SINT64:
+                fprintf(file, "%s%s_json_impl_int(out, %s_json_impl_zigzag(v));\n", indent, t, t);
+                break;
+            case FieldDescriptor::TYPE_FLOAT:
+                fprintf(file, "%s%s_json_impl_float(out, v);\n", indent, t);
+                break;
+            case FieldDescriptor::TYPE_DOUBLE:
+                fprintf(file, "%s%s_json_impl_double(out, v);\n", indent, t);
+                break;
+            default:
+                throw std::runtime_error("Unsupported protobuf type " + std::to_string(static_cast<int>(field.type())));
+        }
+    }
+
+    // a field with an unexpected wire type is skipped like an unknown field
+    void printSkip(FILE *file, const char *t, const char *indent) {
+        fprintf(file, "%sif (!%s_json_impl_skip(p, end, tag, depth)) {\n", indent, t);
+        fprintf(file, "%s    return 0;\n", indent);
+        fprintf(file, "%s}\n", indent);
+        fprintf(file, "%sbreak;\n", indent);
+    }
+
+    void printApiImpl(FILE *file, const Graph &graph, const char *t) {
+        fprintf(file, "int %s_json_transcode(const char *wire, size_t wireLen, std::string &json, size_t maxDepth) {\n", t);
+        fprintf(file, "    const size_t size = json.size();\n");
+        fprintf(file, "    const unsigned char *p = reinterpret_cast<const unsigned char *>(wire);\n");
+        fprintf(file, "    if (!%s_json_impl_message_%d(p, p + wireLen, json, maxDepth)) {\n", t, graph.root.state);
+        fprintf(file, "        json.resize(size);\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 0;\n");
+        fprintf(file, "}\n\n");
+
+        fprintf(file, "std::string %s_json_transcode_easy(const std::string &wire) {\n", t);
+        fprintf(file, "    std::string json;\n");
+        fprintf(file, "    json.reserve(wire.size() * 2);\n");
+        fprintf(file, "    if (%s_json_transcode(wire.data(), wire.size(), json) != 0) {\n", t);
+        fprintf(file, "        throw std::runtime_error(\"Malformed wire format of %s\");\n", graph.root.desc->full_name().c_str());
+        fprintf(file, "    }\n");
+        fprintf(file, "    return json;\n");
+        fprintf(file, "}\n\n");
+    }
+
+    static bool hasFieldType(const Graph &graph, FieldDescriptor::Type type) {
+        return std::any_of(graph.all_nodes.begin(), graph.all_nodes.end(), [type](const Node *node) {
+            return node->field && node->field->type() == type;
+        });
+    }
+
+    static int getWireType(const FieldDescriptor &field) {
+        switch (field.type()) {
+            case FieldDescriptor::TYPE_FIXED64:
+            case FieldDescriptor::TYPE_SFIXED64:
+            case FieldDescriptor::TYPE_DOUBLE:
+                return 1;
+            case FieldDescriptor::TYPE_STRING:
+            case FieldDescriptor::TYPE_BYTES:
+            case FieldDescriptor::TYPE_MESSAGE:
+                return 2;
+            case FieldDescriptor::TYPE_FIXED32:
+            case FieldDescriptor::TYPE_SFIXED32:
+            case FieldDescriptor::TYPE_FLOAT:
+                return 5;
+            default:
+                return 0;
+        }
+    }
+
+    static const char *getEscapeLiteral(int ch) {
+        switch (ch) {
+            case '"':
+                return "'\"'";
+            case '\\':
+                return "'\\\\'";
+            case '\b':
+                return "'b'";
+            case '\f':
+                return "'f'";
+            case '\n':
+                return "'n'";
+            case '\r':
+                return "'r'";
+            case '\t':
+                return "'t'";
+            default:
+                return ch < 0x20 ? "'u'" : ch >= 0x80 ? "'8'" : "0";
+        }
+    }
+};
+
+} // namespace protog
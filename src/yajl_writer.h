@@ -1,362 +1,40 @@
 #pragma once
 
-#include "parser.h"
-#include "writer.h"
+#include "sax_writer.h"
 
 namespace protog {
 
-struct YajlWriter : public Writer {
+// Backend for yajl 2.x. The parser_impl_parse_* callbacks are passed to yajl as yajl_callbacks.
+struct YajlWriter : public SaxWriter {
     virtual ~YajlWriter() {}
 
-    virtual void write(const Graph &graph, const char* proto_header) override {
-        auto name_lower = graph.root.desc->name();
-        std::transform(name_lower.begin(), name_lower.end(), name_lower.begin(), ::tolower);
-        const auto cpp_type = get_full_cpp_type_name(*graph.root.desc);
-        const auto res_name_prefix = name_lower + "_parser.pb";
-
-        const auto header_name = res_name_prefix + ".h";
-        FILE *header = fopen(header_name.c_str(), "w");
-        printHeader(header, graph, name_lower.c_str(), cpp_type.c_str(), proto_header);
-        fclose(header);
-
-        const auto source_name = res_name_prefix + ".cc";
-        FILE *source = fopen(source_name.c_str(), "w");
-        printSource(source, graph, name_lower.c_str(), cpp_type.c_str());
-        fclose(source);
-    }
-
-    void printHeader(FILE *file, const Graph &graph, const char *t, const char *c, const char* h) {
-        fprintf(file, "#pragma once\n\n");
-        fprintf(file, "#include \"%s\"\n\n", h);
-        printNamespaceBegin(file, graph);
-        fprintf(file, "typedef struct %s_parser_state_s *%s_parser_state_t;\n", t, t);
-        fprintf(file, "\n");
-        fprintf(file, "%s %s_parser_easy(const std::string &json);\n", c, t);
-        fprintf(file, "%s %s_parser_easy(const char *buf, size_t bufLen);\n", c, t);
-        fprintf(file, "\n");
-        fprintf(file, "%s_parser_state_t %s_parser_init(%s &msg);\n", t, t, c);
-        fprintf(file, "void %s_parser_free(%s_parser_state_t state);\n", t, t);
-        fprintf(file, "int %s_parser_on_chunk(%s_parser_state_t state, char *chunk, size_t chunkLen);\n", t, t);
-        fprintf(file, "int %s_parser_complete(%s_parser_state_t state);\n", t, t);
-        fprintf(file, "int %s_parser_reset(%s_parser_state_t state);\n", t, t);
-        fprintf(file, "char *%s_parser_get_error(%s_parser_state_t state);\n", t, t);
-        fprintf(file,
-                "char *%s_parser_get_error(%s_parser_state_t state, int verbose, const char *chunk, size_t chunkLen);\n",
-                t, t);
-        fprintf(file, "void %s_parser_free_error(%s_parser_state_t state, char *err);\n", t, t);
-        fprintf(file, "\n");
-        printNamespaceEnd(file, graph);
-    }
-
-    void printSource(FILE *file, const Graph &graph, const char *t, const char *c) {
-        printSourceIncludes(file, t);
-        printNamespaceBegin(file, graph);
-        printTypeDefinition(file, t, c);
-        fprintf(file, "namespace {\n\n");
-        printSourceImpl(file, graph, t, c);
-        printYajlCallbacks(file, t);
-        fprintf(file, "} // anonymous namespace\n\n");
-        printApiImpl(file, t, c);
-        printNamespaceEnd(file, graph);
-    }
-
-    void printSourceIncludes(FILE *file, const char *t) {
-        fprintf(file, "#include \"%s_parser.pb.h\"\n\n", t);
-        fprintf(file, "#include <stdlib.h>\n");
-        fprintf(file, "#include <stdio.h>\n\n");
-        fprintf(file, "#include <functional>\n");
-        fprintf(file, "#include <string>\n\n");
+    virtual void printBackendIncludes(FILE *file) override {
         fprintf(file, "#include <yajl/yajl_parse.h>\n");
-        fprintf(file, "\n");
     }
 
-    void printTypeDefinition(FILE *file, const char *t, const char *c) {
-        fprintf(file, "struct %s_parser_config_s {\n", t);
-        fprintf(file, "    bool checkInitialized;\n");
-        fprintf(file, "};\n");
-        fprintf(file, "\n");
-        fprintf(file, "struct %s_parser_state_s {\n", t);
-        fprintf(file, "    %s_parser_state_s(%s &req) : req(req) { }\n\n", t, c);
-        fprintf(file, "    %s_parser_config_s config;\n", t);
+    virtual void printBackendState(FILE *file, const char *t) override {
         fprintf(file, "    yajl_handle handle = NULL;\n");
-        fprintf(file, "    size_t location = 0;\n");
-        fprintf(file, "    %s &req;\n", c);
-        fprintf(file, "    std::vector<::google::protobuf::Message *> msgStack;\n\n");
-        fprintf(file, "    void reset() {\n");
-        fprintf(file, "        location = 0;\n");
-        fprintf(file, "        req.Clear();\n");
-        fprintf(file, "        msgStack.clear();\n");
-        fprintf(file, "    }\n");
-        fprintf(file, "};\n");
-        fprintf(file, "\n");
+        fprintf(file, "    // blocks freed by yajl, reused by the next handle after reset\n");
+        fprintf(file, "    void *yajlBlocks[16];\n");
+        fprintf(file, "    size_t yajlBlockCount = 0;\n");
+        fprintf(file, "    size_t chunkBase = 0; // offset in the chunk of the piece that yajl parses\n\n");
     }
 
-    void printSourceImpl(FILE *file, const Graph &graph, const char *t, const char *c) {
-        printNullImpl(file, t, c, graph.null_nodes);
-        printPodImpl(file, t, c, "boolean", "int", graph.bool_nodes);
-        printPodImpl(file, t, c, "integer", "long long", graph.long_nodes);
-        printPodImpl(file, t, c, "double", "double", graph.double_nodes);
-        printStringImpl(file, t, c, graph.string_nodes);
-        printMapStartImpl(file, graph.object_nodes, t, c);
-        printMapKeyImpl(file, t, c, graph.object_nodes);
-        printMapEndImpl(file, t, c, graph.object_nodes);
-        printArrayStartImpl(file, t, c, graph.array_nodes);
-        printArrayEndImpl(file, t, c, graph.array_nodes);
+    virtual const char *getConsumed() override {
+        return "state.chunkBase + yajl_get_bytes_consumed(state.handle)";
     }
 
-    void printNullImpl(FILE* file, const char* t, const char* c, const std::vector<Node*>& nodes) {
-        fprintf(file, "static int %s_parser_impl_parse_null(void *ctx) {\n", t);
-        fprintf(file, "    %s_parser_state_s &state = *static_cast<%s_parser_state_t>(ctx);\n", t, t);
-        fprintf(file, "    switch (state.location) {\n");
-        for (const auto& node : nodes) {
-            assert(node);
-            printNullStateImpl(file, *node);
-        }
-        fprintf(file, "        default:\n");
-        fprintf(file, "            fprintf(stderr, \"State %%zu does not allow null\\n\", state.location);\n");
-        fprintf(file, "            exit(1);\n");
-        fprintf(file, "    }\n");
-        fprintf(file, "    return 1;\n");
-        fprintf(file, "}\n\n");
+    // yajl can be fed a chunk in pieces, so a value can be decoded from the chunk instead of by yajl
+    virtual bool streamsStrings() override {
+        return true;
     }
 
-    void printNullStateImpl(FILE* file, const Node& node) {
-        const auto cpp_type = get_full_cpp_type_name(*node.desc);
-        fprintf(file, "        case %d: // key %s\n", node.state, node.full_name.c_str());
-        fprintf(file, "            static_cast<%s *>(state.msgStack.back())->clear_%s();\n", cpp_type.c_str(), node.name.c_str());
-        fprintf(file, "            state.location = %d;\n", node.parent->state);
-        fprintf(file, "            break;\n");
-    }
-
-    void printPodImpl(FILE* file, const char* t, const char* c, const char* p, const char* pt, const std::vector<Node*>& nodes) {
-        fprintf(file, "static int %s_parser_impl_parse_%s(void *ctx, %s v) {\n", t, p, pt);
-        fprintf(file, "    %s_parser_state_s &state = *static_cast<%s_parser_state_t>(ctx);\n", t, t);
-        fprintf(file, "    switch (state.location) {\n");
-        for (const auto& node : nodes) {
-            assert(node);
-            printPodStateImpl(file, *node);
-        }
-        fprintf(file, "        default:\n");
-        fprintf(file, "            fprintf(stderr, \"State %%zu does not allow %s\\n\", state.location);\n", p);
-        fprintf(file, "            exit(1);\n");
-        fprintf(file, "    }\n");
-        fprintf(file, "    return 1;\n");
-        fprintf(file, "}\n\n");
-    }
-
-    void printPodStateImpl(FILE* file, const Node& node) {
-        const auto cpp_type = get_full_cpp_type_name(*node.desc);
-        fprintf(file, "        case %d: // key %s\n", node.state, node.full_name.c_str());
-        fprintf(file, "            static_cast<%s *>(state.msgStack.back())->", cpp_type.c_str());
-        if (node.field->is_repeated()) {
-            fprintf(file, "add");
-        } else {
-            fprintf(file, "set");
-        }
-        fprintf(file, "_%s(", node.name.c_str());
-        if (node.field->type() == FieldDescriptor::TYPE_ENUM) {
-            const auto enum_type = get_full_cpp_type_name(*node.field->enum_type());
-            fprintf(file, "\n                    static_cast<%s>(v)", enum_type.c_str());
-        } else {
-            fprintf(file, "v");
-        }
-        fprintf(file, ");\n");
-        if (!node.field->is_repeated()) { // in case of array, the closing bracket will clean up
-            fprintf(file, "            state.location = %d;\n", node.parent->state);
-        }
-        fprintf(file, "            break;\n");
-    }
-
-    void printStringImpl(FILE* file, const char* t, const char* c, const std::vector<Node*>& nodes) {
-        fprintf(file, "static int %s_parser_impl_parse_string(void *ctx, const unsigned char *v, size_t vLen) {\n", t);
-        fprintf(file, "    %s_parser_state_s &state = *static_cast<%s_parser_state_t>(ctx);\n", t, t);
-        fprintf(file, "    std::string *target = nullptr;\n");
-        fprintf(file, "    switch (state.location) {\n");
-        for (const auto& node : nodes) {
-            assert(node);
-            printStringStateImpl(file, *node);
-        }
-        fprintf(file, "        default:\n");
-        fprintf(file, "            fprintf(stderr, \"State %%zu does not allow string\\n\", state.location);\n");
-        fprintf(file, "            exit(1);\n");
-        fprintf(file, "    }\n");
-        fprintf(file, "    if (target) {\n");
-        fprintf(file, "        target->resize(vLen, '\\0');\n");
-        fprintf(file, "        memcpy(const_cast<char*>(target->c_str()), v, vLen);\n");
-        fprintf(file, "        const_cast<char*>(target->c_str())[vLen] = '\\0';\n");
-        fprintf(file, "    }\n");
-        fprintf(file, "    return 1;\n");
-        fprintf(file, "}\n\n");
-    }
-
-    void printStringStateImpl(FILE* file, const Node& node) {
-        const auto cpp_type = get_full_cpp_type_name(*node.desc);
-        const char* verb = node.field->is_repeated() ? "add" : "mutable";
-        fprintf(file, "        case %d: // key %s\n", node.state, node.full_name.c_str());
-        fprintf(file, "            target = static_cast<%s *>(state.msgStack.back())->%s_%s();\n", cpp_type.c_str(), verb, node.name.c_str());
-        if (!node.field->is_repeated()) { // in case of array, the closing bracket will clean up
-            fprintf(file, "            state.location = %d;\n", node.parent->state);
-        }
-        fprintf(file, "            break;\n");
-    }
-
-    void printMapStartImpl(FILE *file, const std::vector<Node *> &nodes, const char *t, const char *c) {
-        fprintf(file, "static int %s_parser_impl_parse_start_map(void *ctx) {\n", t);
-        fprintf(file, "    %s_parser_state_s &state = *static_cast<%s_parser_state_t>(ctx);\n", t, t);
-        fprintf(file, "    switch (state.location) {\n");
-        for (const auto& node : nodes) {
-            assert(node);
-            printMapStartStateImpl(file, *node, t);
-        }
-        fprintf(file, "        default:\n");
-        fprintf(file, "            fprintf(stderr, \"State %%zu does not allow object\\n\", state.location);\n");
-        fprintf(file, "            exit(1);\n");
-        fprintf(file, "    }\n");
-        fprintf(file, "    return 1;\n");
-        fprintf(file, "}\n\n");
-    }
-
-    void printMapStartStateImpl(FILE* file, const Node& node, const char* t) {
-        if (!node.parent) {
-            fprintf(file, "        case 0: // map .\n");
-            fprintf(file, "            state.location = %d;\n", node.state);
-            fprintf(file, "            assert(state.msgStack.empty());\n");
-            fprintf(file, "            state.msgStack.push_back(&state.req);\n");
-            fprintf(file, "            break;\n");
-        } else {
-            const auto cpp_type = get_full_cpp_type_name(*node.desc);
-            const char* verb = node.field->is_repeated() ? "add" : "mutable";
-            fprintf(file, "        case %d: // map %s\n", node.parent->state, node.full_name.c_str());
-            fprintf(file, "            state.location = %d;\n", node.state);
-            fprintf(file, "            state.msgStack.push_back(static_cast<%s *>(state.msgStack.back())->%s_%s());\n", cpp_type.c_str(), verb, node.name.c_str());
-            fprintf(file, "            break;\n");
-        }
-    }
-
-    void printMapKeyImpl(FILE* file, const char* t, const char* c, const std::vector<Node*>& nodes) {
-        fprintf(file, "static int %s_parser_impl_parse_map_key(void *ctx, const unsigned char *key_, size_t keyLen) {\n", t);
-        fprintf(file, "    const auto key = std::string{reinterpret_cast<const char *>(key_), keyLen};\n");
-        fprintf(file, "    %s_parser_state_s &state = *static_cast<%s_parser_state_t>(ctx);\n", t, t);
-        fprintf(file, "    const auto hash = std::hash<std::string>()(key);\n");
-        fprintf(file, "    switch (state.location) {\n");
-        for (const auto& node : nodes) {
-            assert(node);
-            printMapKeyStateImpl(file, *node);
-        }
-        fprintf(file, "        default:\n");
-        fprintf(file, "            fprintf(stderr, \"Location %%zu does not allow the key %%s\\n\", state.location, key.c_str());\n");
-        fprintf(file, "            exit(1);\n");
-        fprintf(file, "    }\n");
-        fprintf(file, "    return 1;\n");
-        fprintf(file, "}\n\n");
-    }
-
-    void printMapKeyStateImpl(FILE* file, const Node& node) {
-        fprintf(file, "        case %d: // map %s\n", node.state, node.full_name.c_str());
-        fprintf(file, "            switch (hash) {\n");
-        for (const auto& child : node.children) {
-            const auto hash = std::hash<std::string>()(child->name);
-            fprintf(file, "                case %zuu: // %s\n", hash, child->name.c_str());
-            fprintf(file, "                    state.location = %d;\n", child->state);
-            fprintf(file, "                    break;\n");
-        }
-        fprintf(file, "                default:\n");
-        fprintf(file, "                    fprintf(stderr, \"Invalid key %s for %%s\\n\", key.c_str());\n", node.full_name.c_str());
-        fprintf(file, "                    exit(1);\n");
-        fprintf(file, "            }\n");
-        fprintf(file, "            break;\n");
-    }
-
-    void printMapEndImpl(FILE* file, const char* t, const char* c, const std::vector<Node*>& nodes) {
-        fprintf(file, "static int %s_parser_impl_parse_end_map(void *ctx) {\n", t);
-        fprintf(file, "    %s_parser_state_s &state = *static_cast<%s_parser_state_t>(ctx);\n", t, t);
-        fprintf(file, "    if (state.config.checkInitialized) {\n");
-        fprintf(file, "        state.msgStack.back()->CheckInitialized();\n");
-        fprintf(file, "    }\n");
-        fprintf(file, "    switch (state.location) {\n");
-        for (const auto& node : nodes) {
-            assert(node);
-            printMapEndStateImpl(file, *node);
-        }
-        fprintf(file, "        default:\n");
-        fprintf(file, "            fprintf(stderr, \"State %%zu does not allow closing object\\n\", state.location);\n");
-        fprintf(file, "            exit(1);\n");
-        fprintf(file, "    }\n");
-        fprintf(file, "    return 1;\n");
-        fprintf(file, "}\n\n");
-    }
-
-    void printMapEndStateImpl(FILE* file, const Node& node) {
-        if (!node.parent || !node.parent->parent) {
-            fprintf(file, "        case %d: // map .\n", node.state);
-            fprintf(file, "            state.location = 0;\n");
-            fprintf(file, "            state.msgStack.pop_back();\n");
-            fprintf(file, "            assert(state.msgStack.empty());\n");
-            fprintf(file, "            break;\n");
-        } else {
-            const auto cpp_type = get_full_cpp_type_name(*node.desc);
-            fprintf(file, "        case %d: // map %s\n", node.state, node.full_name.c_str());
-            assert(node.parent && node.parent->parent);
-            if (node.parent && node.parent->parent && node.parent->parent->type == NodeType::ARRAY) {
-                fprintf(file, "            state.location = %d;\n", node.parent->state);
-            } else {
-                fprintf(file, "            state.location = %d;\n", node.parent->parent->state);
-            }
-            fprintf(file, "            state.msgStack.pop_back();\n");
-            fprintf(file, "            break;\n");
-        }
+    virtual bool parsesIncrementally() override {
+        return true;
     }
 
-    void printArrayStartImpl(FILE* file, const char* t, const char* c, const std::vector<Node*>& nodes) {
-        fprintf(file, "static int %s_parser_impl_parse_start_array(void *ctx) {\n", t);
-        fprintf(file, "    %s_parser_state_s &state = *static_cast<%s_parser_state_t>(ctx);\n", t, t);
-        fprintf(file, "    switch (state.location) {\n");
-        for (const auto& node : nodes) {
-            assert(node);
-            printArrayStartStateImpl(file, *node);
-        }
-        fprintf(file, "        default:\n");
-        fprintf(file, "            fprintf(stderr, \"State %%zu does not allow array\\n\", state.location);\n");
-        fprintf(file, "            exit(1);\n");
-        fprintf(file, "    }\n");
-        fprintf(file, "    return 1;\n");
-        fprintf(file, "}\n\n");
-    }
-
-    void printArrayStartStateImpl(FILE* file, const Node& node) {
-        assert(node.children.size() == 1);
-        fprintf(file, "        case %d: // key %s\n", node.state, node.full_name.c_str());
-        fprintf(file, "            state.location = %d;\n", node.children[0]->state);
-        fprintf(file, "            break;\n");
-    }
-
-    void printArrayEndImpl(FILE* file, const char* t, const char* c, const std::vector<Node*>& nodes) {
-        fprintf(file, "static int %s_parser_impl_parse_end_array(void *ctx) {\n", t);
-        fprintf(file, "    %s_parser_state_s &state = *static_cast<%s_parser_state_t>(ctx);\n", t, t);
-        fprintf(file, "    switch (state.location) {\n");
-        for (const auto& node : nodes) {
-            assert(node);
-            printArrayEndStateImpl(file, *node);
-        }
-        fprintf(file, "        default:\n");
-        fprintf(file, "            fprintf(stderr, \"State %%zu does not allow closing array\\n\", state.location);\n");
-        fprintf(file, "            exit(1);\n");
-        fprintf(file, "    }\n");
-        fprintf(file, "    return 1;\n");
-        fprintf(file, "}\n\n");
-    }
-
-    void printArrayEndStateImpl(FILE* file, const Node& node) {
-        // TODO: fix arrays in root object case?!
-        assert(node.parent);
-        assert(node.children.size() == 1);
-        fprintf(file, "        case %d: // key %s\n", node.children[0]->state, node.full_name.c_str());
-        fprintf(file, "            state.location = %d;\n", node.parent->state);
-        fprintf(file, "            break;\n");
-    }
-
-    void printYajlCallbacks(FILE *file, const char *t) {
-        fprintf(file, "static yajl_callbacks %s_parser_impl_callbacks = {\n", t);
+    virtual void printBackendCallbacks(FILE *file, const char *t) override {
+        fprintf(file, "static const yajl_callbacks %s_parser_impl_callbacks = {\n", t);
         fprintf(file, "        %s_parser_impl_parse_null,\n", t);
         fprintf(file, "        %s_parser_impl_parse_boolean,\n", t);
         fprintf(file, "        %s_parser_impl_parse_integer,\n", t);
@@ -371,44 +49,82 @@ struct YajlWriter : public Writer {
         fprintf(file, "};\n\n");
     }
 
-    void printApiImpl(FILE *file, const char *t, const char *c) {
-        fprintf(file, "%s %s_parser_easy(const std::string &json) {\n", c, t);
-        fprintf(file, "    return %s_parser_easy(json.c_str(), json.size());\n", t);
+    virtual void printBackendApiImpl(FILE *file, const char *t, const char *c) override {
+        // yajl allocates its handle, lexer and buffers anew for every document. The blocks are cached in the
+        // state when yajl frees them, so that a reused state parses without touching the heap. Each block
+        // starts with its capacity, padded to keep the alignment of malloc.
+        fprintf(file, "static void *%s_parser_impl_yajl_malloc(void *ctx, size_t size) {\n", t);
+        fprintf(file, "    auto &state = *static_cast<%s_parser_state_t>(ctx);\n", t);
+        fprintf(file, "    size_t best = state.yajlBlockCount;\n");
+        fprintf(file, "    for (size_t i = 0; i < state.yajlBlockCount; ++i) {\n");
+        fprintf(file, "        const size_t capacity = *static_cast<size_t *>(state.yajlBlocks[i]);\n");
+        fprintf(file, "        if (capacity >= size && (best == state.yajlBlockCount || capacity < *static_cast<size_t *>(state.yajlBlocks[best]))) {\n");
+        fprintf(file, "            best = i;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (best != state.yajlBlockCount) {\n");
+        fprintf(file, "        char *block = static_cast<char *>(state.yajlBlocks[best]);\n");
+        fprintf(file, "        state.yajlBlocks[best] = state.yajlBlocks[--state.yajlBlockCount];\n");
+        fprintf(file, "        return block + alignof(std::max_align_t);\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    char *block = static_cast<char *>(malloc(alignof(std::max_align_t) + size));\n");
+        fprintf(file, "    if (!block) {\n");
+        fprintf(file, "        return NULL;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    *reinterpret_cast<size_t *>(block) = size;\n");
+        fprintf(file, "    return block + alignof(std::max_align_t);\n");
         fprintf(file, "}\n");
         fprintf(file, "\n");
-        fprintf(file, "%s %s_parser_easy(const char *buf, size_t bufLen) {\n", c, t);
-        fprintf(file, "    %s msg;\n", c);
-        fprintf(file, "    %s_parser_state_t state = %s_parser_init(msg);\n", t, t);
-        fprintf(file, "\n");
-        fprintf(file, "    int rc = %s_parser_on_chunk(state, const_cast<char*>(buf), bufLen);\n", t);
-        fprintf(file, "    if (rc != 0) {\n");
-        fprintf(file, "        char *err = %s_parser_get_error(state);\n", t);
-        fprintf(file, "        throw std::runtime_error(err);\n");
+        fprintf(file, "static void %s_parser_impl_yajl_free(void *ctx, void *ptr) {\n", t);
+        fprintf(file, "    if (!ptr) {\n");
+        fprintf(file, "        return;\n");
         fprintf(file, "    }\n");
-        fprintf(file, "\n");
-        fprintf(file, "    rc = %s_parser_complete(state);\n", t);
-        fprintf(file, "    if (rc != 0) {\n");
-        fprintf(file, "        char *err = %s_parser_get_error(state);\n", t);
-        fprintf(file, "        throw std::runtime_error(err);\n");
+        fprintf(file, "    auto &state = *static_cast<%s_parser_state_t>(ctx);\n", t);
+        fprintf(file, "    char *block = static_cast<char *>(ptr) - alignof(std::max_align_t);\n");
+        fprintf(file, "    const size_t maxBlocks = sizeof(state.yajlBlocks) / sizeof(state.yajlBlocks[0]);\n");
+        fprintf(file, "    if (state.yajlBlockCount < maxBlocks) {\n");
+        fprintf(file, "        state.yajlBlocks[state.yajlBlockCount++] = block;\n");
+        fprintf(file, "    } else {\n");
+        fprintf(file, "        free(block);\n");
         fprintf(file, "    }\n");
-        fprintf(file, "\n");
-        fprintf(file, "    %s_parser_free(state);\n", t);
-        fprintf(file, "\n");
-        fprintf(file, "    return msg;\n");
         fprintf(file, "}\n");
         fprintf(file, "\n");
-        fprintf(file, "%s_parser_state_t %s_parser_init(%s &msg) {\n", t, t, c);
-        fprintf(file, "    %s_parser_state_t state = new %s_parser_state_s(msg);\n", t, t);
-        fprintf(file, "    state->config.checkInitialized = true;\n");
+        fprintf(file, "static void *%s_parser_impl_yajl_realloc(void *ctx, void *ptr, size_t size) {\n", t);
+        fprintf(file, "    if (!ptr) {\n");
+        fprintf(file, "        return %s_parser_impl_yajl_malloc(ctx, size);\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    const size_t capacity = *reinterpret_cast<size_t *>(static_cast<char *>(ptr) - alignof(std::max_align_t));\n");
+        fprintf(file, "    if (capacity >= size) {\n");
+        fprintf(file, "        return ptr;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    void *resized = %s_parser_impl_yajl_malloc(ctx, size);\n", t);
+        fprintf(file, "    if (resized) {\n");
+        fprintf(file, "        memcpy(resized, ptr, capacity);\n");
+        fprintf(file, "        %s_parser_impl_yajl_free(ctx, ptr);\n", t);
+        fprintf(file, "    }\n");
+        fprintf(file, "    return resized;\n");
+        fprintf(file, "}\n");
         fprintf(file, "\n");
-        fprintf(file, "    yajl_handle handle = yajl_alloc(&%s_parser_impl_callbacks, NULL, state);\n", t);
+        fprintf(file, "static yajl_handle %s_parser_impl_alloc_handle(%s_parser_state_t state) {\n", t, t);
+        fprintf(file, "    yajl_alloc_funcs allocFuncs = {\n");
+        fprintf(file, "            %s_parser_impl_yajl_malloc,\n", t);
+        fprintf(file, "            %s_parser_impl_yajl_realloc,\n", t);
+        fprintf(file, "            %s_parser_impl_yajl_free,\n", t);
+        fprintf(file, "            state,\n");
+        fprintf(file, "    };\n");
+        fprintf(file, "    yajl_handle handle = yajl_alloc(&%s_parser_impl_callbacks, &allocFuncs, state);\n", t);
         fprintf(file, "    yajl_config(handle, yajl_allow_comments, 0);\n");
         fprintf(file, "    yajl_config(handle, yajl_dont_validate_strings, 0);\n");
         fprintf(file, "    yajl_config(handle, yajl_allow_trailing_garbage, 0);\n");
         fprintf(file, "    yajl_config(handle, yajl_allow_multiple_values, 0);\n");
         fprintf(file, "    yajl_config(handle, yajl_allow_partial_values, 0);\n");
-        fprintf(file, "    state->handle = handle;\n");
+        fprintf(file, "    return handle;\n");
+        fprintf(file, "}\n");
         fprintf(file, "\n");
+        fprintf(file, "%s_parser_state_t %s_parser_init(%s &msg, const %s_parser_config_s &config) {\n", t, t, c, t);
+        fprintf(file, "    %s_parser_state_t state = new %s_parser_state_s(msg);\n", t, t);
+        fprintf(file, "    state->config = config;\n");
+        fprintf(file, "    state->handle = %s_parser_impl_alloc_handle(state);\n", t);
         fprintf(file, "    return state;\n");
         fprintf(file, "}\n");
         fprintf(file, "\n");
@@ -418,22 +134,82 @@ struct YajlWriter : public Writer {
         fprintf(file, "        if (state->handle) {\n");
         fprintf(file, "            yajl_free(state->handle);\n");
         fprintf(file, "        }\n");
+        fprintf(file, "        for (size_t i = 0; i < state->yajlBlockCount; ++i) {\n");
+        fprintf(file, "            free(state->yajlBlocks[i]);\n");
+        fprintf(file, "        }\n");
         fprintf(file, "        delete state;\n");
         fprintf(file, "    }\n");
         fprintf(file, "}\n");
         fprintf(file, "\n");
+        if (streamedStrings) {
+            printStreamChunkImpl(file, t);
+        }
         fprintf(file, "int %s_parser_on_chunk(%s_parser_state_t state, char *chunk, size_t chunkLen) {\n", t, t);
         fprintf(file, "    assert(state);\n");
         fprintf(file, "    assert(state->handle);\n");
+        fprintf(file, "    if (!state->error.empty()) {\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    %s_parser_impl_start(*state);\n", t);
         fprintf(file, "    const unsigned char *uChunk = reinterpret_cast<const unsigned char *>(chunk);\n");
-        fprintf(file, "    int stat = yajl_parse(state->handle, uChunk, chunkLen);\n");
+        fprintf(file, "    state->chunk = chunk;\n");
+        fprintf(file, "    state->chunkEnd = chunk + chunkLen;\n");
+        fprintf(file, "    state->chunkOffset = 0;\n");
+        fprintf(file, "    int stat = yajl_status_ok;\n");
+        fprintf(file, "    // tokens that span chunks, like long strings, do not reach the callbacks until they end\n");
+        fprintf(file, "    if (!%s_parser_impl_check_deadline(*state)) {\n", t);
+        fprintf(file, "        stat = yajl_status_error;\n");
+        if (streamedStrings) {
+            fprintf(file, "    } else if (state->config.streamStrings) {\n");
+            fprintf(file, "        stat = %s_parser_impl_stream_chunk(*state, chunk, chunkLen) ? yajl_status_ok : yajl_status_error;\n", t);
+        }
+        fprintf(file, "    } else {\n");
+        fprintf(file, "        stat = yajl_parse(state->handle, uChunk, chunkLen);\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (state->unknownTarget) { // captured value continues in the next chunk\n");
+        fprintf(file, "        state->unknownTarget->append(chunk + state->chunkOffset, chunkLen - state->chunkOffset);\n");
+        fprintf(file, "        const size_t captured = state->unknownTarget->size() - state->unknownValueOffset;\n");
+        fprintf(file, "        if (stat == yajl_status_ok && state->allocatedBytes + captured > state->config.maxTotalBytes) {\n");
+        fprintf(file, "            state->error = \"Message exceeds maxTotalBytes\";\n");
+        fprintf(file, "            stat = yajl_status_error;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    state->chunk = nullptr;\n");
+        fprintf(file, "    state->chunkEnd = nullptr;\n");
+        fprintf(file, "    state->offset += chunkLen;\n");
+        fprintf(file, "    // A token that spans chunks is buffered by yajl until it is complete. Chunks without any\n");
+        fprintf(file, "    // event only extend such a token, so stop feeding them once they exceed the string limit.\n");
+        if (streamedStrings) {
+            fprintf(file, "    // streamed strings are decoded without yajl and limited by their own length checks\n");
+            fprintf(file, "    const size_t yajlBytes = chunkLen - (state->config.streamStrings ? state->streamBytes : 0);\n");
+        } else {
+            fprintf(file, "    const size_t yajlBytes = chunkLen;\n");
+        }
+        fprintf(file, "    state->idleBytes = state->events == state->chunkEvents ? state->idleBytes + yajlBytes : 0;\n");
+        fprintf(file, "    state->chunkEvents = state->events;\n");
+        fprintf(file, "    if (stat == yajl_status_ok && state->idleBytes > state->config.maxStringLength) {\n");
+        fprintf(file, "        state->error = \"String exceeds maxStringLength\";\n");
+        fprintf(file, "        stat = yajl_status_error;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    if (stat != yajl_status_ok) {\n");
+        fprintf(file, "        if (state->error.empty()) { // rejected by yajl itself\n");
+        fprintf(file, "            PROTOG_PROBE4(error, \"%s\", state->location, state->offset, \"Invalid json\");\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        PROTOG_PROBE4(parse_end, \"%s\", state->location, state->offset, 0);\n", t);
+        fprintf(file, "        %s_parser_impl_record(*state, false);\n", t);
+        fprintf(file, "    }\n");
         fprintf(file, "    return stat != yajl_status_ok;\n");
         fprintf(file, "}\n");
         fprintf(file, "\n");
         fprintf(file, "int %s_parser_complete(%s_parser_state_t state) {\n", t, t);
         fprintf(file, "    assert(state);\n");
         fprintf(file, "    assert(state->handle);\n");
+        fprintf(file, "    if (!state->error.empty()) {\n");
+        fprintf(file, "        return 1;\n");
+        fprintf(file, "    }\n");
         fprintf(file, "    int stat = yajl_complete_parse(state->handle);\n");
+        fprintf(file, "    PROTOG_PROBE4(parse_end, \"%s\", state->location, state->offset, stat == yajl_status_ok);\n", t);
+        fprintf(file, "    %s_parser_impl_record(*state, stat == yajl_status_ok);\n", t);
         fprintf(file, "    return stat != yajl_status_ok;\n");
         fprintf(file, "}\n");
         fprintf(file, "\n");
@@ -442,6 +218,9 @@ struct YajlWriter : public Writer {
         fprintf(file, "    assert(state->handle);\n");
         fprintf(file, "    if (state && state->handle) {\n");
         fprintf(file, "        state->reset();\n");
+        fprintf(file, "        // yajl cannot rewind a handle, it would reject the next document as trailing garbage\n");
+        fprintf(file, "        yajl_free(state->handle);\n");
+        fprintf(file, "        state->handle = %s_parser_impl_alloc_handle(state);\n", t);
         fprintf(file, "    }\n");
         fprintf(file, "    return 0;\n");
         fprintf(file, "}\n");
@@ -454,6 +233,9 @@ struct YajlWriter : public Writer {
         fprintf(file, "                                  size_t chunkLen) {\n");
         fprintf(file, "    assert(state);\n");
         fprintf(file, "    assert(state->handle);\n");
+        fprintf(file, "    if (state && !state->error.empty()) {\n");
+        fprintf(file, "        return strdup(state->error.c_str());\n");
+        fprintf(file, "    }\n");
         fprintf(file, "    const unsigned char *uChunk = reinterpret_cast<const unsigned char *>(chunk);\n");
         fprintf(file, "    unsigned char *err = nullptr;\n");
         fprintf(file, "    if (state && state->handle) {\n");
@@ -465,30 +247,87 @@ struct YajlWriter : public Writer {
         fprintf(file, "void %s_parser_free_error(%s_parser_state_t state, char *err) {\n", t, t);
         fprintf(file, "    assert(state);\n");
         fprintf(file, "    assert(state->handle);\n");
-        fprintf(file, "    if (state && state->handle) {\n");
+        fprintf(file, "    if (state && !state->error.empty()) {\n");
+        fprintf(file, "        free(err);\n");
+        fprintf(file, "    } else if (state && state->handle) {\n");
         fprintf(file, "        yajl_free_error(state->handle, reinterpret_cast<unsigned char *>(err));\n");
         fprintf(file, "    }\n");
         fprintf(file, "}\n\n");
     }
 
-    void printNamespaceBegin(FILE *file, const Graph &graph) {
-        const auto ns = split(graph.fileDesc->package(), '.');
-        for (auto it = ns.begin(); it != ns.end(); ++it) {
-            fprintf(file, "namespace %s {\n", it->c_str());
-        }
+    // With streamStrings, yajl parses the chunk in pieces that end after keys. When the key of a streamed field
+    // was the last token, the separator goes to yajl, then an empty string in place of the value, whose raw json
+    // is decoded from the chunk instead. yajl resumes behind its closing quote, so the chunk is read only once
+    // and left as it is.
+    void printStreamChunkImpl(FILE *file, const char *t) {
+        fprintf(file, "static int %s_parser_impl_feed(%s_parser_state_s &state, const char *piece, size_t len, size_t base) {\n", t, t);
+        fprintf(file, "    state.chunkBase = base;\n");
+        fprintf(file, "    const yajl_status stat = yajl_parse(state.handle, reinterpret_cast<const unsigned char *>(piece), len);\n");
+        fprintf(file, "    state.chunkBase = 0;\n");
+        fprintf(file, "    return stat == yajl_status_ok;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "// end of the next piece: the first colon behind a quote, i.e. behind a key\n");
+        fprintf(file, "static size_t %s_parser_impl_next_key_end(const char *chunk, size_t pos, size_t len) {\n", t);
+        fprintf(file, "    const size_t begin = pos;\n");
+        fprintf(file, "    while (const void *found = memchr(chunk + pos, ':', len - pos)) {\n");
+        fprintf(file, "        const size_t colon = static_cast<const char *>(found) - chunk;\n");
+        fprintf(file, "        size_t q = colon;\n");
+        fprintf(file, "        while (q > begin && (chunk[q - 1] == ' ' || chunk[q - 1] == '\\t' || chunk[q - 1] == '\\r' || chunk[q - 1] == '\\n')) {\n");
+        fprintf(file, "            --q;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (q > begin && chunk[q - 1] == '\"') {\n");
+        fprintf(file, "            return colon;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        pos = colon + 1;\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return len;\n");
+        fprintf(file, "}\n");
+        fprintf(file, "\n");
+        fprintf(file, "static int %s_parser_impl_stream_chunk(%s_parser_state_s &state, const char *chunk, size_t len) {\n", t, t);
+        fprintf(file, "    state.streamBytes = 0;\n");
+        fprintf(file, "    size_t pos = 0;\n");
+        fprintf(file, "    while (pos < len) {\n");
+        fprintf(file, "        if (state.streamPhase == 2) {\n");
+        fprintf(file, "            const char *next = %s_parser_impl_stream(state, chunk + pos, chunk + len);\n", t);
+        fprintf(file, "            if (!next) {\n");
+        fprintf(file, "                return 0;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            state.streamBytes += next - (chunk + pos);\n");
+        fprintf(file, "            pos = next - chunk;\n");
+        fprintf(file, "            continue;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        size_t end = pos;\n");
+        fprintf(file, "        if (state.streamPhase == 1) { // behind the key of a streamed field\n");
+        fprintf(file, "            while (end < len && (chunk[end] == ' ' || chunk[end] == '\\t' || chunk[end] == '\\r' || chunk[end] == '\\n' || chunk[end] == ':')) {\n");
+        fprintf(file, "                ++end;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            if (end < len && chunk[end] != '\"') {\n");
+        fprintf(file, "                state.streamPhase = 0; // not a string, e.g. null, which is left to yajl\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (state.streamPhase == 0) {\n");
+        fprintf(file, "            end = %s_parser_impl_next_key_end(chunk, pos, len);\n", t);
+        fprintf(file, "        }\n");
+        fprintf(file, "        if (end > pos && !%s_parser_impl_feed(state, chunk + pos, end - pos, pos)) {\n", t);
+        fprintf(file, "            return 0;\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "        pos = end;\n");
+        fprintf(file, "        if (state.streamPhase == 1 && pos < len && chunk[pos] == '\"') { // at the opening quote of the value\n");
+        fprintf(file, "            state.streamPhase = 2;\n");
+        fprintf(file, "            ++pos;\n");
+        fprintf(file, "            if (state.streamTarget) { // enough for the value, unless it continues in the next chunk\n");
+        fprintf(file, "                const void *quote = memchr(chunk + pos, '\"', len - pos);\n");
+        fprintf(file, "                state.streamTarget->reserve((quote ? static_cast<const char *>(quote) - chunk : len) - pos);\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "            if (!%s_parser_impl_feed(state, \"\\\"\\\"\", 2, pos - 1)) {\n", t);
+        fprintf(file, "                return 0;\n");
+        fprintf(file, "            }\n");
+        fprintf(file, "        }\n");
+        fprintf(file, "    }\n");
+        fprintf(file, "    return 1;\n");
+        fprintf(file, "}\n");
         fprintf(file, "\n");
-    }
-
-    void printNamespaceEnd(FILE *file, const Graph &graph) {
-        const auto ns = split(graph.fileDesc->package(), '.');
-        for (auto it = ns.rbegin(); it != ns.rend(); ++it) {
-            fprintf(file, "} // namespace %s\n", it->c_str());
-        }
-    }
-
-    template <typename Descriptor>
-    static std::string get_full_cpp_type_name(const Descriptor& desc) {
-        return "::" + replace_all(desc.full_name(), ".", "::");
     }
 };
 
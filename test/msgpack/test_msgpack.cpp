@@ -0,0 +1,211 @@
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <cmath>
+#include <vector>
+
+#include "messages.pb.h"
+#include "binarymessage_parser.pb.h"
+#include "forwardingmessage_parser.pb.h"
+#include "simplemessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+// A minimal MessagePack encoder. Besides the fix formats it writes the long headers, so that the decoding of
+// their big-endian fields is covered as well.
+class Packer {
+public:
+    Packer &map(uint32_t n) { return n < 16 ? byte(0x80 | n) : byte(0xdf).be(n, 4); }
+    Packer &array(uint32_t n) { return n < 16 ? byte(0x90 | n) : byte(0xdd).be(n, 4); }
+    Packer &str(const std::string &s) { byte(0xdb).be(s.size(), 4); out.append(s); return *this; }
+    Packer &fixstr(const std::string &s) { byte(0xa0 | s.size()); out.append(s); return *this; }
+    Packer &bin(const std::string &s) {
+        s.size() < 256 ? byte(0xc4).be(s.size(), 1) : byte(0xc5).be(s.size(), 2);
+        out.append(s);
+        return *this;
+    }
+    Packer &nil() { return byte(0xc0); }
+    Packer &boolean(bool b) { return byte(b ? 0xc3 : 0xc2); }
+    Packer &fixint(int8_t i) { return byte(static_cast<uint8_t>(i)); }
+    Packer &i8(int8_t i) { return byte(0xd0).be(static_cast<uint8_t>(i), 1); }
+    Packer &i64(int64_t i) { return byte(0xd3).be(static_cast<uint64_t>(i), 8); }
+    Packer &u16(uint16_t u) { return byte(0xcd).be(u, 2); }
+    Packer &u64(uint64_t u) { return byte(0xcf).be(u, 8); }
+    Packer &f32(float f) { uint32_t bits; memcpy(&bits, &f, 4); return byte(0xca).be(bits, 4); }
+    Packer &f64(double d) { uint64_t bits; memcpy(&bits, &d, 8); return byte(0xcb).be(bits, 8); }
+    Packer &raw(const std::string &s) { out.append(s); return *this; }
+
+    std::string out;
+
+private:
+    Packer &byte(uint8_t b) { out.push_back(static_cast<char>(b)); return *this; }
+    Packer &be(uint64_t v, int len) {
+        for (int i = len - 1; i >= 0; --i) {
+            byte(static_cast<uint8_t>(v >> (i * 8)));
+        }
+        return *this;
+    }
+};
+
+TEST(msgpack, should_parse_simple_message) {
+    const auto input = Packer().map(3).fixstr("id").str("foo").fixstr("my_int32").u16(42)
+            .fixstr("my_double").f64(42.23).out;
+    const auto msg = simplemessage_parser_easy(input);
+    ASSERT_EQ("foo", msg.id());
+    ASSERT_EQ(42, msg.my_int32());
+    ASSERT_EQ(42.23, msg.my_double());
+}
+
+TEST(msgpack, should_parse_negative_ints_and_nil) {
+    const auto msg = simplemessage_parser_easy(Packer().map(2).fixstr("my_int32").i8(-100).fixstr("id").nil().out);
+    ASSERT_EQ(-100, msg.my_int32());
+    ASSERT_FALSE(msg.has_id());
+    ASSERT_EQ(-5, simplemessage_parser_easy(Packer().map(1).fixstr("my_int32").fixint(-5).out).my_int32());
+}
+
+TEST(msgpack, should_allow_int_as_double) {
+    const auto msg = simplemessage_parser_easy(Packer().map(1).fixstr("my_double").fixint(7).out);
+    ASSERT_EQ(7.0, msg.my_double());
+}
+
+TEST(msgpack, should_allow_integral_floats_as_int) {
+    ASSERT_EQ(42, simplemessage_parser_easy(Packer().map(1).fixstr("my_int32").f64(42.0).out).my_int32());
+    ASSERT_EQ(-3, simplemessage_parser_easy(Packer().map(1).fixstr("my_int32").f32(-3.0f).out).my_int32());
+    ASSERT_EQ(2.5, simplemessage_parser_easy(Packer().map(1).fixstr("my_double").f32(2.5f).out).my_double());
+    const auto msg = simplemessage_parser_easy(Packer().map(1).fixstr("my_double").f64(-0.0).out);
+    ASSERT_TRUE(msg.has_my_double());
+    ASSERT_TRUE(std::signbit(msg.my_double()));
+    try {
+        simplemessage_parser_easy(Packer().map(1).fixstr("my_int32").f64(1.5).out);
+        FAIL() << "fraction accepted for an int field";
+    } catch (const std::runtime_error &e) {
+        ASSERT_STREQ("Unexpected double", e.what());
+    }
+}
+
+TEST(msgpack, should_parse_bytes_and_nested_messages) {
+    const std::string data("\x00\xff\"x", 4);
+    const auto input = Packer().map(6)
+            .fixstr("data").bin(data)
+            .fixstr("chunks").array(2).bin("a").bin(std::string(300, 'b'))
+            .fixstr("big").i64(-(1ll << 40))
+            .fixstr("ratio").f32(0.5f)
+            .fixstr("flag").boolean(true)
+            .fixstr("inner").map(2).fixstr("a").fixstr("x").fixstr("b").array(20)
+            .raw(std::string(20, '\x01')).out;
+    const auto msg = binarymessage_parser_easy(input);
+    ASSERT_EQ(data, msg.data());
+    ASSERT_EQ(2, msg.chunks_size());
+    ASSERT_EQ("a", msg.chunks(0));
+    ASSERT_EQ(std::string(300, 'b'), msg.chunks(1));
+    ASSERT_EQ(-(1ll << 40), msg.big());
+    ASSERT_EQ(0.5f, msg.ratio());
+    ASSERT_TRUE(msg.flag());
+    ASSERT_EQ("x", msg.inner().a());
+    ASSERT_EQ(20, msg.inner().b_size());
+    ASSERT_EQ(1.0, msg.inner().b(19));
+}
+
+TEST(msgpack, should_parse_input_split_into_chunks) {
+    auto input = Packer().map(2).fixstr("id").str("foo").fixstr("my_int32").u16(1000).out;
+    SimpleMessage msg;
+    auto state = simplemessage_parser_init(msg);
+    for (size_t i = 0; i < input.size(); ++i) {
+        ASSERT_EQ(0, simplemessage_parser_on_chunk(state, &input[i], 1));
+    }
+    ASSERT_EQ(0, simplemessage_parser_complete(state));
+    simplemessage_parser_free(state);
+    ASSERT_EQ("foo", msg.id());
+    ASSERT_EQ(1000, msg.my_int32());
+}
+
+TEST(msgpack, should_reject_malformed_input) {
+    EXPECT_THROW(simplemessage_parser_easy(""), std::runtime_error);
+    EXPECT_THROW(simplemessage_parser_easy(Packer().map(2).fixstr("id").str("foo").out), std::runtime_error);
+    EXPECT_THROW(simplemessage_parser_easy(Packer().map(1).fixstr("id").raw("\xdb\xff\xff\xff\xff").out),
+                 std::runtime_error);
+    EXPECT_THROW(simplemessage_parser_easy(Packer().map(0).nil().out), std::runtime_error);
+    EXPECT_THROW(simplemessage_parser_easy(Packer().map(1).fixint(1).fixint(1).out), std::runtime_error);
+    EXPECT_THROW(simplemessage_parser_easy(Packer().map(1).fixstr("my_int32").u64(1ull << 63).out),
+                 std::runtime_error);
+    EXPECT_THROW(simplemessage_parser_easy(Packer().raw("\xd4\x01\x02").out), std::runtime_error);
+    EXPECT_THROW(simplemessage_parser_easy(Packer().map(0xffffffff).out), std::runtime_error);
+}
+
+TEST(msgpack, should_capture_unknown_keys_as_json) {
+    auto input = Packer().map(4)
+            .fixstr("id").fixstr("foo")
+            .fixstr("extra").map(2).fixstr("a").array(3).fixint(1).f64(1.5).nil().fixstr("b").bin("x\"y")
+            .fixstr("my_inner").map(2).fixstr("z").boolean(true).fixstr("a").fixstr("bar")
+            .fixstr("n").i8(-3).out;
+    ForwardingMessage msg;
+    forwardingmessage_parser_config_s config;
+    config.captureUnknownKeys = true;
+    auto state = forwardingmessage_parser_init(msg, config);
+    ASSERT_EQ(0, forwardingmessage_parser_on_chunk(state, &input[0], input.size()));
+    ASSERT_EQ(0, forwardingmessage_parser_complete(state));
+    forwardingmessage_parser_free(state);
+    ASSERT_EQ("foo", msg.id());
+    ASSERT_EQ(R"*("extra":{"a":[1,1.5,null],"b":"x\"y"},"n":-3)*", msg.unknown_json());
+    ASSERT_EQ("bar", msg.my_inner().a());
+    ASSERT_EQ(R"*("z":true)*", msg.my_inner().unknown_json());
+}
+
+TEST(msgpack, should_parse_next_message_after_reset) {
+    auto first = Packer().map(1).fixstr("id").fixstr("foo").out;
+    auto broken = Packer().map(1).fixstr("id").out;
+    auto second = Packer().map(1).fixstr("my_int32").fixint(2).out;
+    SimpleMessage msg;
+    auto state = simplemessage_parser_init(msg);
+    ASSERT_EQ(0, simplemessage_parser_on_chunk(state, &first[0], first.size()));
+    ASSERT_EQ(0, simplemessage_parser_complete(state));
+    ASSERT_EQ("foo", msg.id());
+    simplemessage_parser_reset(state);
+    ASSERT_EQ(0, simplemessage_parser_on_chunk(state, &broken[0], broken.size()));
+    ASSERT_NE(0, simplemessage_parser_complete(state));
+    simplemessage_parser_reset(state);
+    ASSERT_EQ(0, simplemessage_parser_on_chunk(state, &second[0], second.size()));
+    ASSERT_EQ(0, simplemessage_parser_complete(state));
+    simplemessage_parser_free(state);
+    ASSERT_FALSE(msg.has_id());
+    ASSERT_EQ(2, msg.my_int32());
+}
+
+static void record_unknown_key(void *ctx, ::google::protobuf::Message *msg, const char *, size_t) {
+    static_cast<std::vector<::google::protobuf::Message *> *>(ctx)->push_back(msg);
+}
+
+TEST(msgpack, should_parse_batch_one_document_after_another) {
+    std::vector<std::string> inputs = {
+            Packer().map(2).fixstr("id").str(std::string(40, 'a')).fixstr("x").fixint(0).out,
+            Packer().map(2).fixstr("x").fixint(1).fixstr("my_int32").fixint(1).out,
+            Packer().map(1).fixstr("id").out,
+            Packer().map(1).fixstr("x").fixint(3).out,
+    };
+    std::vector<char *> docs;
+    std::vector<size_t> docLens;
+    for (auto &input : inputs) {
+        docs.push_back(&input[0]);
+        docLens.push_back(input.size());
+    }
+    std::vector<SimpleMessage> msgs(inputs.size());
+    std::vector<int> results(inputs.size(), -1);
+    std::vector<::google::protobuf::Message *> order;
+    simplemessage_parser_config_s config;
+    config.captureUnknownKeys = true;
+    config.unknownKeyCallback = record_unknown_key;
+    config.unknownKeyCtx = &order;
+    config.sliceBytes = 1;
+    ASSERT_EQ(1u, simplemessage_parser_parse_batch(docs.data(), docLens.data(), msgs.data(), results.data(),
+                                                   inputs.size(), config, 3));
+    ASSERT_EQ((std::vector<int>{0, 0, 1, 0}), results);
+    ASSERT_EQ(std::string(40, 'a'), msgs[0].id());
+    ASSERT_EQ(1, msgs[1].my_int32());
+    // with interleaved lanes, the short second document would be done before the first one
+    ASSERT_EQ((std::vector<::google::protobuf::Message *>{&msgs[0], &msgs[1], &msgs[3]}), order);
+}
+
+} // namespace test
+} // namespace protog
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include "messages.pb.h"
+#include "constrainedmessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+static std::string get_constraint_error(const std::string &json) {
+    try {
+        constrainedmessage_parser_easy(json);
+    } catch (const std::runtime_error &e) {
+        return e.what();
+    }
+    return "";
+}
+
+TEST(constraints, should_accept_valid_values) {
+    const auto json = R"*({ "id": "id-42", "count": 100, "ratio": 0.5, "code": "c0ffee0", "tags": [1, 2, 3],
+        "items": [{ "a": "x" }, { "a": "y" }] })*";
+    const auto msg = constrainedmessage_parser_easy(json);
+    ASSERT_EQ("id-42", msg.id());
+    ASSERT_EQ(100, msg.count());
+    ASSERT_EQ(3, msg.tags_size());
+    ASSERT_EQ(2, msg.items_size());
+}
+
+TEST(constraints, should_reject_values_out_of_range) {
+    ASSERT_EQ("Value of .count is too small", get_constraint_error(R"*({ "count": -1 })*"));
+    ASSERT_EQ("Value of .count is too large", get_constraint_error(R"*({ "count": 101 })*"));
+    ASSERT_EQ("Value of .ratio is too large", get_constraint_error(R"*({ "ratio": 1.5 })*"));
+    ASSERT_EQ("Value of .ratio is too large", get_constraint_error(R"*({ "ratio": 2 })*"));
+}
+
+TEST(constraints, should_reject_invalid_strings) {
+    ASSERT_EQ("Value of .id is too short", get_constraint_error(R"*({ "id": "id-" })*"));
+    ASSERT_EQ("Value of .id is too long", get_constraint_error(R"*({ "id": "id-123456" })*"));
+    ASSERT_EQ("Value of .id has the wrong prefix", get_constraint_error(R"*({ "id": "xx-1" })*"));
+    ASSERT_EQ("Value of .code has the wrong suffix", get_constraint_error(R"*({ "code": "abc" })*"));
+    ASSERT_EQ("Value of .code contains characters that are not allowed", get_constraint_error(R"*({ "code": "xyz0" })*"));
+}
+
+TEST(constraints, should_reject_invalid_item_counts) {
+    ASSERT_EQ("Value of .tags has too many items", get_constraint_error(R"*({ "tags": [1, 2, 3, 4] })*"));
+    ASSERT_EQ("Value of .tags has too few items", get_constraint_error(R"*({ "tags": [] })*"));
+    ASSERT_EQ("Value of .items has too many items", get_constraint_error(R"*({ "tags": [1], "items": [{}, {}, {}] })*"));
+}
+
+TEST(constraints, should_reject_missing_items) {
+    ASSERT_EQ("Value of .tags has too few items", get_constraint_error(R"*({ "id": "id-1" })*"));
+    ASSERT_EQ("Value of .tags has too few items", get_constraint_error(R"*({ "tags": null })*"));
+    ASSERT_EQ("Value of .tags has too few items", get_constraint_error("{}"));
+}
+
+TEST(constraints, should_skip_items_beyond_keep_items) {
+    const auto msg = constrainedmessage_parser_easy(R"*({ "labels": ["a", "b", "c", "d"], "id": "id-1", "tags": [1] })*");
+    ASSERT_EQ(2, msg.labels_size());
+    ASSERT_EQ("b", msg.labels(1));
+    ASSERT_EQ("id-1", msg.id());
+}
+
+} // namespace test
+} // namespace protog
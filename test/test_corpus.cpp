@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <iterator>
+
+#include "protog_corpus.h"
+
+#include "messages.pb.h"
+#include "constrainedmessage_parser.pb.h"
+#include "forwardingmessage_parser.pb.h"
+#include "nestedmessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+static std::vector<std::string> read_corpus(const std::string &name) {
+    std::ifstream in(std::string(CORPUS_DIR) + "/" + name);
+    std::vector<std::string> documents;
+    splitDocuments(std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()), documents);
+    return documents;
+}
+
+TEST(corpus, should_parse_generated_documents) {
+    const auto documents = read_corpus("nestedmessage_corpus.json");
+    ASSERT_EQ(200u, documents.size());
+    size_t with_list = 0;
+    for (auto json : documents) {
+        NestedMessage msg;
+        nestedmessage_parser_config_s config;
+        config.ignoreUnknownKeys = true;
+        auto state = nestedmessage_parser_init(msg, config);
+        ASSERT_EQ(0, nestedmessage_parser_on_chunk(state, &json[0], json.size())) << json;
+        ASSERT_EQ(0, nestedmessage_parser_complete(state)) << json;
+        nestedmessage_parser_free(state);
+        with_list += msg.my_list_size() > 0;
+    }
+    ASSERT_GT(with_list, 0u);
+}
+
+TEST(corpus, should_capture_injected_unknown_keys) {
+    const auto documents = read_corpus("forwardingmessage_corpus.json");
+    ASSERT_EQ(200u, documents.size());
+    size_t with_unknown = 0;
+    for (auto json : documents) {
+        ForwardingMessage msg;
+        forwardingmessage_parser_config_s config;
+        config.captureUnknownKeys = true;
+        auto state = forwardingmessage_parser_init(msg, config);
+        ASSERT_EQ(0, forwardingmessage_parser_on_chunk(state, &json[0], json.size())) << json;
+        ASSERT_EQ(0, forwardingmessage_parser_complete(state)) << json;
+        forwardingmessage_parser_free(state);
+        with_unknown += !msg.unknown_json().empty();
+    }
+    ASSERT_GT(with_unknown, 0u);
+    ASSERT_LT(with_unknown, 200u);
+}
+
+TEST(corpus, should_satisfy_constraints) {
+    const auto documents = read_corpus("constrainedmessage_corpus.json");
+    ASSERT_EQ(200u, documents.size());
+    for (auto json : documents) {
+        ConstrainedMessage msg;
+        auto state = constrainedmessage_parser_init(msg);
+        ASSERT_EQ(0, constrainedmessage_parser_on_chunk(state, &json[0], json.size())) << json;
+        ASSERT_EQ(0, constrainedmessage_parser_complete(state)) << json;
+        constrainedmessage_parser_free(state);
+        ASSERT_GE(msg.tags_size(), 1);
+        ASSERT_TRUE(!msg.has_kind() || msg.kind() != WireMessage::NONE) << json;
+    }
+}
+
+} // namespace test
+} // namespace protog
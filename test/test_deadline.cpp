@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "messages.pb.h"
+#include "nestedmessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+static const std::string LIST_JSON = R"*({ "id": "foo", "my_list": [{ "a": "x" }, { "a": "y", "b": [1, 2] }, { "a": "z" }] })*";
+
+TEST(deadline, should_abort_after_event_budget) {
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.maxEvents = 10;
+    auto state = nestedmessage_parser_init(msg, config);
+    ASSERT_EQ(1, nestedmessage_parser_on_chunk(state, const_cast<char *>(LIST_JSON.data()), LIST_JSON.size()));
+    char *err = nestedmessage_parser_get_error(state);
+    ASSERT_STREQ("Parse exceeds maxEvents", err);
+    nestedmessage_parser_free_error(state, err);
+    nestedmessage_parser_free(state);
+}
+
+TEST(deadline, should_abort_after_time_budget) {
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.timeBudget = std::chrono::milliseconds(1);
+    auto state = nestedmessage_parser_init(msg, config);
+    std::string chunk = R"*({ "my_list": [)*";
+    ASSERT_EQ(0, nestedmessage_parser_on_chunk(state, const_cast<char *>(chunk.data()), chunk.size()));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    chunk = R"*({ "a": "x" }] })*";
+    ASSERT_EQ(1, nestedmessage_parser_on_chunk(state, const_cast<char *>(chunk.data()), chunk.size()));
+    char *err = nestedmessage_parser_get_error(state);
+    ASSERT_STREQ("Parse exceeds timeBudget", err);
+    nestedmessage_parser_free_error(state, err);
+    nestedmessage_parser_free(state);
+}
+
+TEST(deadline, should_count_events_of_flat_arrays) {
+    std::string json = R"*({ "my_inner": { "b": [1)*";
+    for (int i = 2; i <= 100; ++i) {
+        json += ", " + std::to_string(i);
+    }
+    json += "] } }";
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.maxEvents = 50;
+    auto state = nestedmessage_parser_init(msg, config);
+    ASSERT_EQ(1, nestedmessage_parser_on_chunk(state, &json[0], json.size()));
+    char *err = nestedmessage_parser_get_error(state);
+    ASSERT_STREQ("Parse exceeds maxEvents", err);
+    nestedmessage_parser_free_error(state, err);
+    nestedmessage_parser_free(state);
+    ASSERT_GE(msg.my_inner().b_size(), 40);
+    ASSERT_LT(msg.my_inner().b_size(), 50);
+}
+
+TEST(deadline, should_check_time_budget_per_chunk) {
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.timeBudget = std::chrono::milliseconds(1);
+    auto state = nestedmessage_parser_init(msg, config);
+    std::string chunk = R"*({ "id": "a)*";
+    ASSERT_EQ(0, nestedmessage_parser_on_chunk(state, &chunk[0], chunk.size()));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    // the string has not ended yet, so no callback runs
+    chunk = "bcdef";
+    ASSERT_EQ(1, nestedmessage_parser_on_chunk(state, &chunk[0], chunk.size()));
+    char *err = nestedmessage_parser_get_error(state);
+    ASSERT_STREQ("Parse exceeds timeBudget", err);
+    nestedmessage_parser_free_error(state, err);
+    nestedmessage_parser_free(state);
+}
+
+TEST(deadline, should_yield_after_slice_bytes) {
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.sliceBytes = 16;
+    auto state = nestedmessage_parser_init(msg, config);
+    size_t offset = 0;
+    size_t yields = 0;
+    int rc;
+    while ((rc = nestedmessage_parser_on_chunk_slice(state, const_cast<char *>(LIST_JSON.data()), LIST_JSON.size(), &offset)) ==
+           nestedmessage_parser_yield) {
+        ++yields;
+        ASSERT_EQ(yields * 16, offset);
+    }
+    ASSERT_EQ(nestedmessage_parser_ok, rc);
+    ASSERT_EQ((LIST_JSON.size() - 1) / 16, yields);
+    ASSERT_EQ(0, nestedmessage_parser_complete(state));
+    nestedmessage_parser_free(state);
+    ASSERT_EQ(3, msg.my_list_size());
+    ASSERT_EQ(2, msg.my_list(1).b_size());
+}
+
+TEST(deadline, should_yield_after_slice_events) {
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.sliceEvents = 4;
+    auto state = nestedmessage_parser_init(msg, config);
+    size_t offset = 0;
+    size_t yields = 0;
+    while (nestedmessage_parser_on_chunk_slice(state, const_cast<char *>(LIST_JSON.data()), LIST_JSON.size(), &offset) ==
+           nestedmessage_parser_yield) {
+        ++yields;
+    }
+    ASSERT_EQ(LIST_JSON.size(), offset);
+    ASSERT_GT(yields, 0u);
+    ASSERT_EQ(0, nestedmessage_parser_complete(state));
+    nestedmessage_parser_free(state);
+    ASSERT_EQ(3, msg.my_list_size());
+}
+
+} // namespace test
+} // namespace protog
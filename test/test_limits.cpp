@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include "messages.pb.h"
+#include "nestedmessage_parser.pb.h"
+#include "simplemessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+static std::string get_limit_error(NestedMessage &msg, const nestedmessage_parser_config_s &config, const std::string &json) {
+    auto state = nestedmessage_parser_init(msg, config);
+    std::string error;
+    if (nestedmessage_parser_on_chunk(state, const_cast<char *>(json.data()), json.size()) ||
+        nestedmessage_parser_complete(state)) {
+        char *err = nestedmessage_parser_get_error(state);
+        error = err;
+        nestedmessage_parser_free_error(state, err);
+    }
+    nestedmessage_parser_free(state);
+    return error;
+}
+
+TEST(limits, should_limit_nesting_depth) {
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.maxDepth = 3;
+    ASSERT_EQ("", get_limit_error(msg, config, R"*({ "my_inner": { "b": [1] } })*"));
+    config.maxDepth = 2;
+    ASSERT_EQ("Nesting exceeds maxDepth", get_limit_error(msg, config, R"*({ "my_inner": { "b": [1] } })*"));
+}
+
+TEST(limits, should_limit_nesting_depth_of_unknown_values) {
+    const std::string json = R"*({ "foo": [[[[1]]]] })*";
+    SimpleMessage msg;
+    simplemessage_parser_config_s config;
+    config.ignoreUnknownKeys = true;
+    config.maxDepth = 4;
+    auto state = simplemessage_parser_init(msg, config);
+    ASSERT_EQ(1, simplemessage_parser_on_chunk(state, const_cast<char *>(json.data()), json.size()));
+    simplemessage_parser_free(state);
+}
+
+TEST(limits, should_limit_string_length) {
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.maxStringLength = 5;
+    ASSERT_EQ("", get_limit_error(msg, config, R"*({ "id": "12345" })*"));
+    ASSERT_EQ("String exceeds maxStringLength", get_limit_error(msg, config, R"*({ "id": "123456" })*"));
+    ASSERT_EQ("String exceeds maxStringLength", get_limit_error(msg, config, R"*({ "my_inner_is_too_long": 1 })*"));
+}
+
+TEST(limits, should_stop_feeding_long_strings_split_into_chunks) {
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.maxStringLength = 50;
+    auto state = nestedmessage_parser_init(msg, config);
+    std::string chunk = R"*({ "id": ")*";
+    ASSERT_EQ(0, nestedmessage_parser_on_chunk(state, const_cast<char *>(chunk.data()), chunk.size()));
+    chunk = std::string(10, 'a');
+    size_t chunks = 0;
+    while (nestedmessage_parser_on_chunk(state, const_cast<char *>(chunk.data()), chunk.size()) == 0) {
+        ASSERT_LT(++chunks, 10u);
+    }
+    char *err = nestedmessage_parser_get_error(state);
+    ASSERT_STREQ("String exceeds maxStringLength", err);
+    nestedmessage_parser_free_error(state, err);
+    ASSERT_EQ(1, nestedmessage_parser_complete(state));
+    nestedmessage_parser_free(state);
+}
+
+TEST(limits, should_limit_array_length) {
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.maxArrayLength = 2;
+    ASSERT_EQ("", get_limit_error(msg, config, R"*({ "my_inner": { "b": [1, 2] } })*"));
+    msg.Clear();
+    ASSERT_EQ("Value of .my_inner.b[] exceeds maxArrayLength",
+              get_limit_error(msg, config, R"*({ "my_inner": { "b": [1, 2, 3] } })*"));
+    ASSERT_EQ(2, msg.my_inner().b_size());
+    msg.Clear();
+    ASSERT_EQ("Value of .my_list[] exceeds maxArrayLength", get_limit_error(msg, config, R"*({ "my_list": [{}, {}, {}] })*"));
+    ASSERT_EQ(2, msg.my_list_size());
+}
+
+TEST(limits, should_limit_total_bytes) {
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.maxTotalBytes = 10;
+    ASSERT_EQ("", get_limit_error(msg, config, R"*({ "id": "0123456789" })*"));
+    msg.Clear();
+    ASSERT_EQ("Message exceeds maxTotalBytes", get_limit_error(msg, config, R"*({ "id": "0123456789", "my_inner": {} })*"));
+    msg.Clear();
+    ASSERT_EQ("Message exceeds maxTotalBytes", get_limit_error(msg, config, R"*({ "my_inner": { "b": [1, 2] } })*"));
+}
+
+} // namespace test
+} // namespace protog
@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <mutex>
+
+#include "protog_loader.h"
+
+#include "messages.pb.h"
+#include "simplemessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+// A directory of json files, which is removed with the files in it.
+class TempDir {
+public:
+    TempDir() {
+        char tmpl[] = "/tmp/protog_loader_XXXXXX";
+        path = mkdtemp(tmpl);
+    }
+
+    ~TempDir() {
+        for (const auto &file : files) {
+            unlink(file.c_str());
+        }
+        rmdir(path.c_str());
+    }
+
+    std::string write(const std::string &name, const std::string &content) {
+        const std::string file = path + "/" + name;
+        const int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        EXPECT_EQ(static_cast<ssize_t>(content.size()), ::write(fd, content.data(), content.size()));
+        close(fd);
+        files.push_back(file);
+        return file;
+    }
+
+    std::string path;
+    std::vector<std::string> files;
+};
+
+// Loads 500 documents and a few broken paths, and parses them with one parser per worker.
+static void load_and_parse(bool useIoUring) {
+    TempDir dir;
+    std::vector<std::string> paths;
+    for (int i = 0; i < 500; ++i) {
+        paths.push_back(dir.write(std::to_string(i) + ".json",
+                                  R"*({ "id": "doc)*" + std::to_string(i) + R"*(", "my_int32": )*" + std::to_string(i) + "}"));
+    }
+    paths.push_back(dir.write("big.json", std::string(8192, ' ')));
+    paths.push_back(dir.path + "/missing.json");
+    paths.push_back(dir.write("empty.json", ""));
+
+    const size_t workers = 4;
+    FileLoader loader(workers, 16, 8192, useIoUring);
+    if (useIoUring && !loader.usesIoUring()) {
+        std::cerr << "io_uring is not available, testing the thread pool fallback" << std::endl;
+    }
+    std::vector<SimpleMessage> messages(workers);
+    std::vector<simplemessage_parser_state_s *> states;
+    for (auto &msg : messages) {
+        states.push_back(simplemessage_parser_init(msg));
+    }
+    std::vector<int> ids(paths.size(), -1);
+    std::vector<int> errors(paths.size(), 0);
+    std::mutex mutex;
+    loader.load(paths, [&](size_t worker, size_t file, char *data, size_t len) {
+        simplemessage_parser_reset(states[worker]);
+        int rc = simplemessage_parser_on_chunk(states[worker], data, len);
+        rc = rc != 0 ? rc : simplemessage_parser_complete(states[worker]);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (rc == 0 && messages[worker].id() == "doc" + std::to_string(messages[worker].my_int32())) {
+            ids[file] = messages[worker].my_int32();
+        } else {
+            errors[file] = -1;
+        }
+    }, [&](size_t file, int err) {
+        std::lock_guard<std::mutex> lock(mutex);
+        errors[file] = err;
+    });
+    for (auto state : states) {
+        simplemessage_parser_free(state);
+    }
+
+    for (int i = 0; i < 500; ++i) {
+        ASSERT_EQ(i, ids[i]);
+        ASSERT_EQ(0, errors[i]);
+    }
+    ASSERT_EQ(EFBIG, errors[500]);
+    ASSERT_EQ(ENOENT, errors[501]);
+    ASSERT_EQ(-1, errors[502]); // read, but not valid json
+}
+
+TEST(loader, should_parse_files_through_io_uring) {
+    load_and_parse(true);
+}
+
+TEST(loader, should_parse_files_with_thread_pool) {
+    load_and_parse(false);
+}
+
+TEST(loader, should_be_reusable) {
+    TempDir dir;
+    std::vector<std::string> paths(3, dir.write("a.json", "{}"));
+    FileLoader loader(2, 2, 4096);
+    for (int round = 0; round < 3; ++round) {
+        size_t handled = 0;
+        loader.load(paths, [&](size_t, size_t, char *, size_t len) {
+            __atomic_add_fetch(&handled, len, __ATOMIC_RELAXED);
+        }, [](size_t, int err) { FAIL() << err; });
+        ASSERT_EQ(6u, handled);
+    }
+}
+
+} // namespace test
+} // namespace protog
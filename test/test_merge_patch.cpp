@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+
+#include "messages.pb.h"
+#include "nestedmessage_parser.pb.h"
+#include "simplemessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+TEST(merge_patch, should_keep_fields_missing_in_patch) {
+    auto msg = simplemessage_parser_easy(R"*({ "id": "foo", "my_int32": 42 })*");
+    simplemessage_parser_patch_easy(msg, R"*({ "my_double": 1.5 })*");
+    ASSERT_EQ("foo", msg.id());
+    ASSERT_EQ(42, msg.my_int32());
+    ASSERT_EQ(1.5, msg.my_double());
+}
+
+TEST(merge_patch, should_clear_fields_set_to_null) {
+    auto msg = simplemessage_parser_easy(R"*({ "id": "foo", "my_int32": 42 })*");
+    simplemessage_parser_patch_easy(msg, R"*({ "id": null, "my_int32": 23 })*");
+    ASSERT_FALSE(msg.has_id());
+    ASSERT_EQ(23, msg.my_int32());
+}
+
+TEST(merge_patch, should_merge_objects_and_replace_arrays) {
+    auto msg = nestedmessage_parser_easy(R"*({ "id": "foo", "my_inner": { "a": "bar", "b": [1, 2] },
+        "my_list": [{ "a": "x" }, { "a": "y" }] })*");
+    nestedmessage_parser_patch_easy(msg, R"*({ "my_inner": { "b": [3] }, "my_list": [{ "a": "z" }] })*");
+    ASSERT_EQ("foo", msg.id());
+    ASSERT_EQ("bar", msg.my_inner().a());
+    ASSERT_EQ(1, msg.my_inner().b_size());
+    ASSERT_EQ(3, msg.my_inner().b(0));
+    ASSERT_EQ(1, msg.my_list_size());
+    ASSERT_EQ("z", msg.my_list(0).a());
+}
+
+TEST(merge_patch, should_clear_sub_message_set_to_null) {
+    auto msg = nestedmessage_parser_easy(R"*({ "id": "foo", "my_inner": { "a": "bar" } })*");
+    nestedmessage_parser_patch_easy(msg, R"*({ "my_inner": null })*");
+    ASSERT_EQ("foo", msg.id());
+    ASSERT_FALSE(msg.has_my_inner());
+}
+
+TEST(merge_patch, should_throw_on_invalid_patch) {
+    auto msg = simplemessage_parser_easy(R"*({ "id": "foo" })*");
+    EXPECT_THROW(simplemessage_parser_patch_easy(msg, "{"), std::runtime_error);
+}
+
+} // namespace test
+} // namespace protog
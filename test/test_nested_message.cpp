@@ -45,5 +45,57 @@ TEST(nested_message, should_parse_fields_in_inner_message) {
     ASSERT_EQ(inner.b(1), 23);
 }
 
+TEST(nested_message, should_parse_batch_in_interleaved_lanes) {
+    std::vector<std::string> jsons;
+    for (int i = 0; i < 23; ++i) {
+        std::string json = R"*({ "id": "doc)*" + std::to_string(i) + R"*(", "my_list": [)*";
+        for (int j = 0; j < i % 4; ++j) {
+            json += std::string(j ? ", " : "") + R"*({ "a": "item)*" + std::to_string(j) + R"*(", "b": [1.5, 2] })*";
+        }
+        json += R"*(], "my_inner": { "a": "inner" } })*";
+        jsons.push_back(i == 7 ? "{ \"id\": " : json);
+    }
+    std::vector<char *> docs;
+    std::vector<size_t> docLens;
+    for (auto &json : jsons) {
+        docs.push_back(&json[0]);
+        docLens.push_back(json.size());
+    }
+    std::vector<NestedMessage> msgs(jsons.size());
+    msgs[3].set_id("stale");
+    std::vector<int> results(jsons.size(), -1);
+    nestedmessage_parser_config_s config;
+    config.sliceBytes = 8;
+    ASSERT_EQ(1u, nestedmessage_parser_parse_batch(docs.data(), docLens.data(), msgs.data(), results.data(), jsons.size(),
+                                                   config, 3));
+    for (size_t i = 0; i < jsons.size(); ++i) {
+        if (i == 7) {
+            ASSERT_EQ(1, results[i]);
+            continue;
+        }
+        ASSERT_EQ(0, results[i]);
+        ASSERT_EQ(nestedmessage_parser_easy(jsons[i]).SerializeAsString(), msgs[i].SerializeAsString()) << jsons[i];
+    }
+}
+
+TEST(nested_message, should_skip_items_beyond_keep_items) {
+    std::string json = R"*({ "my_list": [{ "a": "x", "b": [1, 2, 3] }, { "a": "y", "b": [4] },
+        { "a": "z", "b": [5, { "c": [6] }] }, {}], "my_inner": { "b": [7, 8] } })*";
+    nestedmessage_parser_config_s config;
+    ASSERT_EQ(0, nestedmessage_parser_config_keep_items(config, ".my_list", 2));
+    ASSERT_EQ(0, nestedmessage_parser_config_keep_items(config, ".my_list[].b", 1));
+    ASSERT_EQ(1, nestedmessage_parser_config_keep_items(config, ".my_list[].a", 1));
+    NestedMessage msg;
+    auto state = nestedmessage_parser_init(msg, config);
+    ASSERT_EQ(0, nestedmessage_parser_on_chunk(state, &json[0], json.size()));
+    ASSERT_EQ(0, nestedmessage_parser_complete(state));
+    ASSERT_EQ(2, msg.my_list_size());
+    ASSERT_EQ("y", msg.my_list(1).a());
+    ASSERT_EQ(1, msg.my_list(0).b_size());
+    ASSERT_EQ(2, msg.my_inner().b_size());
+    ASSERT_EQ(4u, nestedmessage_parser_truncated_items(state));
+    nestedmessage_parser_free(state);
+}
+
 } // namespace test
 } // namespace protog
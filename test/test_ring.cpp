@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+
+#include <sys/wait.h>
+
+#include <thread>
+#include <vector>
+
+#include "protog_ring.h"
+
+#include "messages.pb.h"
+#include "simplemessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+// Forks a worker process that parses SimpleMessage bodies from requests into responses.
+static pid_t fork_worker(ShmRing &requests, ShmRing &responses) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        SimpleMessage msg;
+        auto state = simplemessage_parser_init(msg);
+        serveParser(requests, responses, msg, [state](char *json, size_t len, SimpleMessage &) {
+            simplemessage_parser_reset(state);
+            int rc = simplemessage_parser_on_chunk(state, json, len);
+            return rc != 0 ? rc : simplemessage_parser_complete(state);
+        });
+        simplemessage_parser_free(state);
+        _exit(0);
+    }
+    return pid;
+}
+
+static void send(ShmRing &requests, const std::string &json, uint64_t tag) {
+    char *body = requests.reserve(json.size(), tag);
+    ASSERT_NE(nullptr, body);
+    memcpy(body, json.data(), json.size());
+    requests.commit();
+}
+
+TEST(ring, should_return_parsed_messages_from_worker_process) {
+    ShmRing requests, responses;
+    ASSERT_EQ(0, requests.create(4096)); // small rings wrap around and fill up
+    ASSERT_EQ(0, responses.create(4096));
+    const pid_t pid = fork_worker(requests, responses);
+    ASSERT_LT(0, pid);
+
+    const size_t count = 2000;
+    std::thread producer([&requests, count]() {
+        for (size_t i = 0; i < count; ++i) {
+            if (i % 100 == 99) {
+                send(requests, R"*({ "id": )*", i);
+            } else {
+                send(requests, R"*({ "id": "msg-)*" + std::to_string(i) + R"*(", "my_int32": )*" + std::to_string(i) + "}", i);
+            }
+        }
+        requests.close();
+    });
+
+    size_t received = 0;
+    size_t len;
+    uint64_t tag;
+    uint32_t flags;
+    while (const char *wire = responses.next(&len, &tag, &flags)) {
+        ASSERT_EQ(received, tag);
+        if (tag % 100 == 99) {
+            ASSERT_EQ(ShmRing::REJECTED, flags);
+        } else {
+            ASSERT_EQ(0u, flags);
+            SimpleMessage msg;
+            ASSERT_TRUE(msg.ParseFromArray(wire, static_cast<int>(len)));
+            ASSERT_EQ("msg-" + std::to_string(tag), msg.id());
+            ASSERT_EQ(static_cast<int>(tag), msg.my_int32());
+        }
+        responses.release();
+        ++received;
+    }
+    producer.join();
+    ASSERT_EQ(count, received);
+
+    int status = 0;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST(ring, should_wrap_records_larger_than_the_rest_of_the_ring) {
+    ShmRing ring;
+    ASSERT_EQ(0, ring.create(4096));
+    // the second and fifth record start at a non-zero offset and need the whole ring, the fourth needs more
+    // than the half of the ring that is left behind the third
+    const std::vector<size_t> sizes = {16, ring.getMaxLength(), 2048 - 16, 2100, ring.getMaxLength(), 1};
+    std::vector<std::string> received;
+    std::thread consumer([&ring, &received]() {
+        size_t len;
+        uint64_t tag;
+        while (const char *payload = ring.next(&len, &tag)) {
+            received.emplace_back(payload, len);
+            ring.release();
+        }
+    });
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        send(ring, std::string(sizes[i], static_cast<char>('a' + i)), i);
+    }
+    ring.close();
+    consumer.join();
+    ASSERT_EQ(sizes.size(), received.size());
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        ASSERT_EQ(std::string(sizes[i], static_cast<char>('a' + i)), received[i]);
+    }
+}
+
+TEST(ring, should_attach_to_ring_of_other_process) {
+    ShmRing ring;
+    ASSERT_EQ(0, ring.create(100));
+    ASSERT_EQ(4096 - 16u, ring.getMaxLength());
+    ASSERT_EQ(nullptr, ring.reserve(4096, 0));
+    send(ring, "hello", 7);
+
+    ShmRing attached;
+    ASSERT_EQ(0, attached.attach(dup(ring.getFd())));
+    size_t len;
+    uint64_t tag;
+    const char *payload = attached.next(&len, &tag);
+    ASSERT_NE(nullptr, payload);
+    ASSERT_EQ("hello", std::string(payload, len));
+    ASSERT_EQ(7u, tag);
+    attached.release();
+    ring.close();
+    ASSERT_EQ(nullptr, attached.next(&len, &tag));
+    ASSERT_EQ(nullptr, ring.reserve(1, 0));
+
+    ShmRing invalid;
+    ASSERT_EQ(EINVAL, invalid.attach(memfd_create("not_a_ring", MFD_CLOEXEC)));
+}
+
+TEST(ring, should_keep_lengths_and_flags_in_range) {
+    ShmRing huge;
+    ASSERT_EQ(EINVAL, huge.create((static_cast<size_t>(1) << 32) + 1));
+
+    ShmRing ring;
+    ASSERT_EQ(0, ring.create(4096));
+    // the highest bit marks the end of the ring, so the consumer must not see it in the caller's flags
+    ASSERT_NE(nullptr, ring.reserve(5, 1, 0x80000000 | ShmRing::REJECTED));
+    ring.commit();
+    send(ring, "hello", 2);
+    size_t len;
+    uint64_t tag;
+    uint32_t flags;
+    ASSERT_NE(nullptr, ring.next(&len, &tag, &flags));
+    ASSERT_EQ(1u, tag);
+    ASSERT_EQ(5u, len);
+    ASSERT_EQ(static_cast<uint32_t>(ShmRing::REJECTED), flags);
+    ring.release();
+    const char *payload = ring.next(&len, &tag, &flags);
+    ASSERT_NE(nullptr, payload);
+    ASSERT_EQ(2u, tag);
+    ASSERT_EQ("hello", std::string(payload, len));
+}
+
+} // namespace test
+} // namespace protog
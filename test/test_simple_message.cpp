@@ -44,6 +44,34 @@ TEST(simple_message, should_allow_any_order) {
     ASSERT_FALSE(msg.has_my_double());
 }
 
+TEST(simple_message, should_fail_on_values_of_the_wrong_type) {
+    const std::vector<std::pair<std::string, std::string>> cases = {
+        {R"*({ "id": 5 })*", "Unexpected integer"},
+        {R"*({ "my_int32": "42" })*", "Unexpected string"},
+        {R"*({ "id": { "a": 1 } })*", "Unexpected object"},
+        {R"*({ "my_double": [1.5] })*", "Unexpected array"},
+        {R"*({ "id": true })*", "Unexpected boolean"},
+    };
+    for (const auto &c : cases) {
+        std::string json = c.first;
+        SimpleMessage msg;
+        simplemessage_parser_config_s config;
+        auto state = simplemessage_parser_init(msg, config);
+        ASSERT_TRUE(simplemessage_parser_on_chunk(state, &json[0], json.size()) != 0 ||
+                    simplemessage_parser_complete(state) != 0) << json;
+        char *err = simplemessage_parser_get_error(state);
+        ASSERT_STREQ(c.second.c_str(), err) << json;
+        simplemessage_parser_free_error(state, err);
+        // the state stays usable after the failure
+        ASSERT_EQ(0, simplemessage_parser_reset(state));
+        json = R"*({ "my_int32": 42 })*";
+        ASSERT_EQ(0, simplemessage_parser_on_chunk(state, &json[0], json.size()));
+        ASSERT_EQ(0, simplemessage_parser_complete(state));
+        ASSERT_EQ(42, msg.my_int32());
+        simplemessage_parser_free(state);
+    }
+}
+
 // TODO: test every single type conversion!
 
 TEST(simple_message, should_allow_int_as_double) {
@@ -53,5 +81,24 @@ TEST(simple_message, should_allow_int_as_double) {
     ASSERT_EQ(42.0, msg.my_double());
 }
 
+TEST(simple_message, should_parse_next_document_after_reset) {
+    std::string first = R"*({ "id": "foo", "my_int32": 42 })*";
+    std::string broken = R"*({ "id": )*";
+    std::string second = R"*({ "my_double": 1.5 })*";
+    SimpleMessage msg;
+    auto state = simplemessage_parser_init(msg);
+    ASSERT_EQ(0, simplemessage_parser_on_chunk(state, &first[0], first.size()));
+    ASSERT_EQ(0, simplemessage_parser_complete(state));
+    ASSERT_EQ(0, simplemessage_parser_reset(state));
+    ASSERT_NE(0, simplemessage_parser_on_chunk(state, &broken[0], broken.size()) +
+                 simplemessage_parser_complete(state));
+    ASSERT_EQ(0, simplemessage_parser_reset(state));
+    ASSERT_EQ(0, simplemessage_parser_on_chunk(state, &second[0], second.size()));
+    ASSERT_EQ(0, simplemessage_parser_complete(state));
+    simplemessage_parser_free(state);
+    ASSERT_FALSE(msg.has_id());
+    ASSERT_EQ(1.5, msg.my_double());
+}
+
 } // namespace test
 } // namespace protog
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "messages.pb.h"
+#include "nestedmessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+static int parse_with_stats(const std::string &json) {
+    NestedMessage msg;
+    nestedmessage_parser_config_s config;
+    config.collectStats = true;
+    config.ignoreUnknownKeys = true;
+    auto state = nestedmessage_parser_init(msg, config);
+    int rc = nestedmessage_parser_on_chunk(state, const_cast<char *>(json.data()), json.size());
+    if (rc == 0) {
+        rc = nestedmessage_parser_complete(state);
+    }
+    nestedmessage_parser_free(state);
+    return rc;
+}
+
+static uint64_t sum_histogram(const nestedmessage_parser_stats_s &stats) {
+    uint64_t sum = 0;
+    for (const auto count : stats.latencyHistogram) {
+        sum += count;
+    }
+    return sum;
+}
+
+TEST(stats, should_count_parses_of_all_threads) {
+    const std::string valid = R"*({ "id": "foo", "unknown": [1, 2, 3], "my_list": [{ "b": [1.5] }] })*";
+    const std::string invalid = R"*({ "id": "foo", )*";
+
+    nestedmessage_parser_stats_s before;
+    nestedmessage_parser_stats(&before);
+
+    ASSERT_EQ(0, parse_with_stats(valid));
+    std::thread worker([&] {
+        ASSERT_EQ(0, parse_with_stats(valid));
+        ASSERT_EQ(1, parse_with_stats(invalid));
+    });
+    worker.join();
+
+    nestedmessage_parser_stats_s after;
+    nestedmessage_parser_stats(&after);
+    ASSERT_EQ(2u, after.messagesCompleted - before.messagesCompleted);
+    ASSERT_EQ(1u, after.messagesRejected - before.messagesRejected);
+    ASSERT_EQ(2 * valid.size() + invalid.size(), after.bytesParsed - before.bytesParsed);
+    ASSERT_EQ(2u, after.unknownKeys - before.unknownKeys);
+    ASSERT_EQ(2 * strlen(": [1, 2, 3]"), after.skippedBytes - before.skippedBytes);
+    // id, my_list[0] and b[0] of each valid parse, id of the invalid one
+    ASSERT_EQ(7u, after.allocations - before.allocations);
+    ASSERT_GT(after.bytesAllocated, before.bytesAllocated);
+    ASSERT_EQ(3u, sum_histogram(after) - sum_histogram(before));
+}
+
+TEST(stats, should_reuse_the_counters_of_exited_threads) {
+    const std::string valid = R"*({ "id": "foo" })*";
+
+    // make sure a block exists that the following threads can take over
+    std::thread([&] { ASSERT_EQ(0, parse_with_stats(valid)); }).join();
+    nestedmessage_parser_stats_s before;
+    nestedmessage_parser_stats(&before);
+
+    for (int i = 0; i < 100; ++i) {
+        std::thread([&] { ASSERT_EQ(0, parse_with_stats(valid)); }).join();
+    }
+
+    nestedmessage_parser_stats_s after;
+    nestedmessage_parser_stats(&after);
+    ASSERT_EQ(before.threads, after.threads);
+    ASSERT_EQ(100u, after.messagesCompleted - before.messagesCompleted);
+    ASSERT_EQ(100 * valid.size(), after.bytesParsed - before.bytesParsed);
+    ASSERT_EQ(100u, sum_histogram(after) - sum_histogram(before));
+}
+
+TEST(stats, should_not_count_parses_without_collect_stats) {
+    nestedmessage_parser_stats_s before;
+    nestedmessage_parser_stats(&before);
+    nestedmessage_parser_easy(R"*({ "id": "foo" })*");
+    nestedmessage_parser_stats_s after;
+    nestedmessage_parser_stats(&after);
+    ASSERT_EQ(before.messagesCompleted, after.messagesCompleted);
+    ASSERT_EQ(before.bytesParsed, after.bytesParsed);
+}
+
+} // namespace test
+} // namespace protog
@@ -0,0 +1,159 @@
+#include <gtest/gtest.h>
+
+#include "messages.pb.h"
+#include "streamedmessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+// collects the pieces that stringSink receives
+struct Sink {
+    std::map<int, std::string> values;
+    std::map<int, int> completed;
+    size_t pieces = 0;
+
+    static void receive(void *ctx, ::google::protobuf::Message *, int field, const char *data, size_t len, bool last) {
+        Sink &sink = *static_cast<Sink *>(ctx);
+        sink.values[field].append(data, len);
+        sink.completed[field] += last;
+        ++sink.pieces;
+    }
+};
+
+// Feeds json in chunks of chunkLen bytes.
+static int parse(StreamedMessage &msg, const streamedmessage_parser_config_s &config, const std::string &json,
+                 size_t chunkLen) {
+    auto state = streamedmessage_parser_init(msg, config);
+    int rc = 0;
+    for (size_t pos = 0; rc == 0 && pos < json.size(); pos += chunkLen) {
+        std::string chunk = json.substr(pos, chunkLen);
+        rc = streamedmessage_parser_on_chunk(state, &chunk[0], chunk.size());
+    }
+    if (rc == 0) {
+        rc = streamedmessage_parser_complete(state);
+    }
+    streamedmessage_parser_free(state);
+    return rc;
+}
+
+static const std::string json = R"*({ "id": "a", "body" : "x\"y\\z\né€😀 \ud83d\ude00 \/ föö )*"
+                                R"*(täxt", "blob": "", "inner": { "a": "b" } })*";
+static const std::string body = "x\"y\\z\n\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80 \xf0\x9f\x98\x80 / f\xc3\xb6\xc3\xb6 t\xc3\xa4xt";
+
+TEST(stream, should_decode_streamed_strings_in_any_chunks) {
+    streamedmessage_parser_config_s config;
+    config.streamStrings = true;
+    for (size_t chunkLen = 1; chunkLen <= json.size(); ++chunkLen) {
+        StreamedMessage msg;
+        ASSERT_EQ(0, parse(msg, config, json, chunkLen)) << chunkLen;
+        ASSERT_EQ("a", msg.id());
+        ASSERT_EQ(body, msg.body()) << chunkLen;
+        ASSERT_TRUE(msg.has_blob());
+        ASSERT_EQ("", msg.blob());
+        ASSERT_EQ("b", msg.inner().a());
+    }
+}
+
+TEST(stream, should_replace_lone_surrogates) {
+    streamedmessage_parser_config_s config;
+    config.streamStrings = true;
+    for (size_t chunkLen : {size_t(1), size_t(2), size_t(64)}) {
+        StreamedMessage msg;
+        ASSERT_EQ(0, parse(msg, config, R"*({"body": "\ud800x\ud800\u0041\ud800\n\udc00"})*", chunkLen));
+        ASSERT_EQ("?x?A?\n\xed\xb0\x80", msg.body());
+    }
+}
+
+TEST(stream, should_not_modify_the_chunk) {
+    streamedmessage_parser_config_s config;
+    config.streamStrings = true;
+    StreamedMessage msg;
+    auto state = streamedmessage_parser_init(msg, config);
+    std::string chunk = R"*({"body": "abc\n", "id": "x"})*";
+    ASSERT_EQ(0, streamedmessage_parser_on_chunk(state, &chunk[0], chunk.size()));
+    ASSERT_EQ(0, streamedmessage_parser_complete(state));
+    streamedmessage_parser_free(state);
+    ASSERT_EQ("abc\n", msg.body());
+    ASSERT_EQ(R"*({"body": "abc\n", "id": "x"})*", chunk);
+}
+
+TEST(stream, should_limit_the_decoded_length_of_streamed_strings) {
+    streamedmessage_parser_config_s config;
+    config.streamStrings = true;
+    config.maxStringLength = 10;
+    std::string escaped;
+    for (int i = 0; i < 10; ++i) {
+        escaped += "\\u0041";
+    }
+    // the colons in the other strings do not end a piece of the chunk after a key
+    const std::string input = R"*({"id": "a\": b", "body": ")*" + escaped + R"*(", "inner": {"a": ":"}})*";
+    for (size_t chunkLen : {size_t(1), size_t(4), size_t(16), input.size()}) {
+        StreamedMessage msg;
+        ASSERT_EQ(0, parse(msg, config, input, chunkLen)) << chunkLen;
+        ASSERT_EQ("a\": b", msg.id());
+        ASSERT_EQ(std::string(10, 'A'), msg.body());
+        ASSERT_EQ(":", msg.inner().a());
+    }
+    StreamedMessage msg;
+    ASSERT_NE(0, parse(msg, config, R"*({"body": ")*" + escaped + R"*(\u0041"})*", 4));
+}
+
+TEST(stream, should_pass_pieces_to_sink) {
+    const std::string big(200000, 'q');
+    const std::string input = R"*({"blob": ")*" + big + R"*(", "body": null, "id": "i"})*";
+    Sink sink;
+    streamedmessage_parser_config_s config;
+    config.streamStrings = true;
+    config.stringSink = Sink::receive;
+    config.stringSinkCtx = &sink;
+    StreamedMessage msg;
+    ASSERT_EQ(0, parse(msg, config, input, 4096));
+    ASSERT_FALSE(msg.has_blob());
+    ASSERT_FALSE(msg.has_body());
+    ASSERT_EQ("i", msg.id());
+    ASSERT_EQ(big, sink.values[3]);
+    ASSERT_EQ(1, sink.completed[3]);
+    ASSERT_EQ(0u, sink.values.count(2));
+    ASSERT_GT(sink.pieces, 40u);
+}
+
+TEST(stream, should_pass_whole_values_to_sink_without_streaming) {
+    Sink sink;
+    streamedmessage_parser_config_s config;
+    config.stringSink = Sink::receive;
+    config.stringSinkCtx = &sink;
+    StreamedMessage msg;
+    ASSERT_EQ(0, parse(msg, config, json, 7));
+    ASSERT_FALSE(msg.has_body());
+    ASSERT_EQ(body, sink.values[2]);
+    ASSERT_EQ(1, sink.completed[2]);
+    ASSERT_EQ(1, sink.completed[3]);
+    ASSERT_EQ(2u, sink.pieces);
+    ASSERT_EQ(body, streamedmessage_parser_easy(json).body());
+}
+
+TEST(stream, should_reject_invalid_streamed_strings) {
+    streamedmessage_parser_config_s config;
+    config.streamStrings = true;
+    const std::vector<std::string> inputs = {
+            R"*({"body": "a\qb"})*",
+            R"*({"body": "a\u12x4"})*",
+            "{\"body\": \"a\nb\"}",
+            "{\"body\": \"a\xff\"}",
+            "{\"body\": \"a\xc3\"}",
+            R"*({"body": "abc)*",
+            R"*({"body": ")*" + std::string(100001, 'a') + "\"}",
+    };
+    for (const auto &input : inputs) {
+        for (size_t chunkLen : {size_t(1), size_t(5), input.size()}) {
+            StreamedMessage msg;
+            ASSERT_NE(0, parse(msg, config, input, chunkLen)) << input.substr(0, 20) << " " << chunkLen;
+        }
+    }
+    config.maxStringLength = 10;
+    StreamedMessage msg;
+    ASSERT_NE(0, parse(msg, config, R"*({"blob": "01234567890"})*", 3));
+}
+
+} // namespace test
+} // namespace protog
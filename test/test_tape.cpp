@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+
+#include "protog_tape.h"
+
+#include "messages.pb.h"
+#include "forwardingmessage_parser.pb.h"
+#include "nestedmessage_parser.pb.h"
+#include "simplemessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+static std::string record(const std::string &json) {
+    TapeRecorder recorder;
+    std::string tape;
+    EXPECT_EQ(0, recorder.record(json.data(), json.size(), tape)) << recorder.getError();
+    return tape;
+}
+
+TEST(tape, should_replay_into_different_parsers) {
+    const std::string json = R"*({ "id": "föo", "my_inner": { "a": "x", "b": [1, 2.5] }, "my_list": [{ "a": "y" }] })*";
+    const auto tape = record(json);
+
+    NestedMessage nested;
+    auto nestedState = nestedmessage_parser_init(nested);
+    ASSERT_EQ(0, nestedmessage_parser_replay(nestedState, tape.data(), tape.size()));
+    nestedmessage_parser_free(nestedState);
+    ASSERT_EQ("f\xc3\xb6o", nested.id());
+    ASSERT_EQ("x", nested.my_inner().a());
+    ASSERT_EQ(2, nested.my_inner().b_size());
+    ASSERT_EQ(1.0, nested.my_inner().b(0));
+    ASSERT_EQ(2.5, nested.my_inner().b(1));
+    ASSERT_EQ(1, nested.my_list_size());
+    ASSERT_EQ("y", nested.my_list(0).a());
+
+    SimpleMessage simple;
+    simplemessage_parser_config_s config;
+    config.ignoreUnknownKeys = true;
+    auto simpleState = simplemessage_parser_init(simple, config);
+    ASSERT_EQ(0, simplemessage_parser_replay(simpleState, tape.data(), tape.size()));
+    simplemessage_parser_free(simpleState);
+    ASSERT_EQ("f\xc3\xb6o", simple.id());
+}
+
+TEST(tape, should_match_parsing_the_json) {
+    const std::string json = R"*({ "my_double": -1e300, "my_int32": -42, "id": "" })*";
+    const auto tape = record(json);
+    SimpleMessage msg;
+    auto state = simplemessage_parser_init(msg);
+    for (int i = 0; i < 3; ++i) { // the same tape can be replayed after a reset
+        simplemessage_parser_reset(state);
+        ASSERT_EQ(0, simplemessage_parser_replay(state, tape.data(), tape.size()));
+        ASSERT_EQ(simplemessage_parser_easy(json).SerializeAsString(), msg.SerializeAsString());
+    }
+    simplemessage_parser_free(state);
+}
+
+TEST(tape, should_capture_unknown_keys_from_the_json) {
+    const std::string json = R"*({ "id": "foo", "extra": {"a": [1, 2]}, "my_inner": { "z" : true }, "n": 1.5 })*";
+    const auto tape = record(json);
+    ForwardingMessage msg;
+    forwardingmessage_parser_config_s config;
+    config.captureUnknownKeys = true;
+    auto state = forwardingmessage_parser_init(msg, config);
+    ASSERT_NE(0, forwardingmessage_parser_replay(state, tape.data(), tape.size()));
+    forwardingmessage_parser_reset(state);
+    ASSERT_EQ(0, forwardingmessage_parser_replay(state, tape.data(), tape.size(), json.data(), json.size()));
+    forwardingmessage_parser_free(state);
+    ASSERT_EQ("foo", msg.id());
+    ASSERT_EQ(R"*("extra":{"a": [1, 2]},"n":1.5)*", msg.unknown_json());
+    ASSERT_EQ(R"*("z":true)*", msg.my_inner().unknown_json());
+}
+
+TEST(tape, should_reject_invalid_json_and_tapes) {
+    TapeRecorder recorder;
+    std::string tape;
+    ASSERT_NE(0, recorder.record("{\"id\": ", 7, tape));
+    ASSERT_FALSE(recorder.getError().empty());
+
+    tape = record(R"*({ "id": "foo", "my_int32": 42 })*");
+    SimpleMessage msg;
+    auto state = simplemessage_parser_init(msg);
+    for (size_t len : {size_t(0), size_t(7), size_t(8), size_t(12), tape.size() - 5}) {
+        simplemessage_parser_reset(state);
+        ASSERT_NE(0, simplemessage_parser_replay(state, tape.data(), len)) << len;
+        char *err = simplemessage_parser_get_error(state);
+        ASSERT_NE(nullptr, strstr(err, "tape")) << err;
+        simplemessage_parser_free_error(state, err);
+    }
+    std::string corrupt = tape;
+    corrupt[8] = 42;
+    simplemessage_parser_reset(state);
+    ASSERT_NE(0, simplemessage_parser_replay(state, corrupt.data(), corrupt.size()));
+    simplemessage_parser_free(state);
+}
+
+TEST(tape, should_reject_offsets_outside_of_the_json) {
+    const std::string json = R"*({ "id": "foo", "extra": [1, 2] })*";
+    const auto tape = record(json);
+    ForwardingMessage msg;
+    forwardingmessage_parser_config_s config;
+    config.captureUnknownKeys = true;
+    auto state = forwardingmessage_parser_init(msg, config);
+    const auto expect_error = [&](const std::string &tape, size_t jsonLen, const char *error) {
+        forwardingmessage_parser_reset(state);
+        ASSERT_NE(0, forwardingmessage_parser_replay(state, tape.data(), tape.size(), json.data(), jsonLen));
+        char *err = forwardingmessage_parser_get_error(state);
+        ASSERT_STREQ(error, err);
+        forwardingmessage_parser_free_error(state, err);
+    };
+    expect_error(tape, json.size() - 1, "Tape does not match the json");
+
+    // the offset behind the closing } of the document, in the last record
+    const uint32_t offsets[] = {static_cast<uint32_t>(json.size() + 1), 0};
+    for (const uint32_t offset : offsets) {
+        std::string corrupt = tape;
+        memcpy(&corrupt[corrupt.size() - 4], &offset, 4);
+        expect_error(corrupt, json.size(), "Corrupt tape");
+    }
+    forwardingmessage_parser_reset(state);
+    ASSERT_EQ(0, forwardingmessage_parser_replay(state, tape.data(), tape.size(), json.data(), json.size()));
+    forwardingmessage_parser_free(state);
+    ASSERT_EQ(R"*("extra":[1, 2])*", msg.unknown_json());
+}
+
+} // namespace test
+} // namespace protog
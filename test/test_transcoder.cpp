@@ -0,0 +1,178 @@
+#include <gtest/gtest.h>
+
+#include "messages.pb.h"
+#include "forwardingmessage_json.pb.h"
+#include "forwardingmessage_parser.pb.h"
+#include "wiremessage_json.pb.h"
+#include "wiremessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+static WireMessage make_wire_message(int i) {
+    WireMessage msg;
+    msg.set_i32(-i);
+    msg.set_i64(-1234567890123ll * i);
+    msg.set_u32(4000000000u - i);
+    msg.set_u64(1000000000000ull * i);
+    msg.set_s32(-7 * i);
+    msg.set_s64(-9000000000ll * i);
+    msg.set_f32(7 * i);
+    msg.set_sf64(-8 * i);
+    msg.set_ratio(i / 3.0f);
+    msg.set_value(i % 2 ? 1e300 / i : i * 1.1 / 7);
+    msg.set_flag(i % 2);
+    msg.set_kind(static_cast<WireMessage::Kind>(i % 3));
+    msg.set_text("text \"" + std::to_string(i) + "\" \\ \n\x01 \xc3\xa9");
+    msg.set_data(std::string("\0\x1f", 2));
+    for (int j = 0; j < i % 5; ++j) {
+        msg.add_packed(j * 1000 - 2);
+        msg.add_unpacked(-j);
+        msg.add_names("n" + std::to_string(j));
+        msg.add_items()->set_a(std::to_string(j));
+    }
+    msg.mutable_inner()->add_b(0.5 * i);
+    return msg;
+}
+
+static std::string transcode(const std::string &wire) {
+    return wiremessage_json_transcode_easy(wire);
+}
+
+TEST(transcoder, should_write_all_field_types) {
+    WireMessage msg;
+    msg.set_i32(-5);
+    msg.set_i64(-1234567890123ll);
+    msg.set_u32(4000000000u);
+    msg.set_u64(12345678901234567890ull);
+    msg.set_s32(-7);
+    msg.set_s64(-9000000000ll);
+    msg.set_f32(7);
+    msg.set_sf64(-8);
+    msg.set_ratio(0.1f);
+    msg.set_value(2.5);
+    msg.set_flag(true);
+    msg.set_kind(WireMessage::OTHER);
+    msg.set_text("a\"b\\c\n\x01\xc3\xa9");
+    msg.set_data("\x02");
+    msg.add_packed(1);
+    msg.add_packed(-2);
+    msg.add_packed(300);
+    msg.add_unpacked(-1);
+    msg.add_unpacked(2);
+    msg.add_names("x");
+    msg.add_names("y");
+    msg.mutable_inner()->set_a("in");
+    msg.mutable_inner()->add_b(1.5);
+    msg.mutable_inner()->add_b(2);
+    msg.add_items()->set_a("i0");
+    msg.add_items();
+    ASSERT_EQ(R"*({"i32":-5,"i64":-1234567890123,"u32":4000000000,"u64":12345678901234567890,"s32":-7,)*"
+              R"*("s64":-9000000000,"f32":7,"sf64":-8,"ratio":0.1,"value":2.5,"flag":true,"kind":2,)*"
+              R"*("text":"a\"b\\c\n\u0001é","data":"\u0002","packed":[1,-2,300],"unpacked":[-1,2],)*"
+              R"*("names":["x","y"],"inner":{"a":"in","b":[1.5,2]},"items":[{"a":"i0"},{}]})*",
+              transcode(msg.SerializeAsString()));
+    ASSERT_EQ("{}", transcode(""));
+}
+
+TEST(transcoder, should_round_trip_through_the_parser) {
+    for (int i = 0; i < 100; ++i) {
+        const auto msg = make_wire_message(i);
+        const auto json = transcode(msg.SerializeAsString());
+        ASSERT_EQ(msg.SerializeAsString(), wiremessage_parser_easy(json).SerializeAsString()) << json;
+    }
+}
+
+TEST(transcoder, should_escape_bytes_that_are_not_utf8) {
+    WireMessage msg;
+    // lone continuation, overlong form, surrogate, truncated sequence, valid two and four byte sequences
+    msg.set_data(std::string("\xff\x80" "a" "\xc0\xaf" "\xed\xa0\x80" "\xc3\xa9\xf0\x9f\x98\x80" "\xe2\x82", 16));
+    const auto json = transcode(msg.SerializeAsString());
+    ASSERT_EQ(R"*({"data":"\u00ff\u0080a\u00c0\u00af\u00ed\u00a0\u0080é😀\u00e2\u0082"})*", json);
+    ASSERT_EQ("\xc3\xbf\xc2\x80" "a" "\xc3\x80\xc2\xaf" "\xc3\xad\xc2\xa0\xc2\x80" "\xc3\xa9\xf0\x9f\x98\x80" "\xc3\xa2\xc2\x82",
+              wiremessage_parser_easy(json).data());
+}
+
+TEST(transcoder, should_merge_fields_that_appear_again) {
+    for (int i = 0; i < 20; ++i) {
+        const auto a = make_wire_message(i);
+        const auto b = make_wire_message(i + 3);
+        WireMessage merged = a;
+        merged.MergeFrom(b);
+        const auto json = transcode(a.SerializeAsString() + b.SerializeAsString());
+        ASSERT_EQ(merged.SerializeAsString(), wiremessage_parser_easy(json).SerializeAsString()) << json;
+    }
+
+    WireMessage a, b;
+    a.set_i32(1);
+    a.add_packed(1);
+    a.mutable_inner()->set_a("x");
+    b.add_names("n");
+    b.add_packed(2);
+    b.mutable_inner()->add_b(2);
+    b.set_i32(3);
+    ASSERT_EQ(R"*({"i32":3,"packed":[1,2],"inner":{"a":"x","b":[2]},"names":["n"]})*",
+              transcode(a.SerializeAsString() + b.SerializeAsString()));
+}
+
+TEST(transcoder, should_skip_unknown_fields) {
+    WireMessage msg;
+    msg.set_text("t");
+    msg.add_packed(5);
+    std::string wire = msg.SerializeAsString();
+    wire += std::string("\x98\x06\x2a", 3);             // 99: varint
+    wire += std::string("\x93\x06\x08\x01\x94\x06", 6); // 98: group with 1: varint
+    wire += std::string("\x8a\x06\x01x", 4);            // 97: bytes
+    wire += std::string("\x0d\x01\x02\x03\x04", 5);     // i32 as fixed32
+    ASSERT_EQ(R"*({"text":"t","packed":[5]})*", transcode(wire));
+}
+
+TEST(transcoder, should_reject_malformed_wire_format) {
+    const std::vector<std::string> inputs = {
+            std::string("\x08", 1),                 // truncated varint
+            std::string("\x6a\x05" "ab", 4),        // string longer than the message
+            std::string("\x93\x06\x08\x01", 4),     // unterminated group
+            std::string("\x0c", 1),                 // end of a group that never started
+            std::string("\x00\x01", 2),             // field number 0
+            std::string("\x7a\x01\x80", 3),         // truncated varint in packed items
+            std::string("\x92\x01\x02\x12\x01", 5), // truncated item of inner
+            std::string("\x3d\x01\x02", 3),         // truncated fixed32
+    };
+    for (const auto &input : inputs) {
+        std::string json = "prefix";
+        ASSERT_EQ(1, wiremessage_json_transcode(input.data(), input.size(), json));
+        ASSERT_EQ("prefix", json);
+        ASSERT_THROW(transcode(input), std::runtime_error);
+    }
+
+    WireMessage msg;
+    msg.mutable_inner()->set_a("a");
+    const auto wire = msg.SerializeAsString();
+    std::string json;
+    ASSERT_EQ(1, wiremessage_json_transcode(wire.data(), wire.size(), json, 1));
+    ASSERT_EQ(0, wiremessage_json_transcode(wire.data(), wire.size(), json, 2));
+    ASSERT_EQ(R"*({"inner":{"a":"a"}})*", json);
+}
+
+TEST(transcoder, should_write_captured_unknown_keys) {
+    ForwardingMessage msg;
+    msg.set_id("f");
+    msg.mutable_my_inner()->set_a("b");
+    msg.mutable_my_inner()->set_unknown_json(R"*("z":null)*");
+    msg.add_my_list()->set_unknown_json(R"*("q":"w")*");
+    msg.set_unknown_json(R"*("x":1,"y":[true])*");
+    const auto json = forwardingmessage_json_transcode_easy(msg.SerializeAsString());
+    ASSERT_EQ(R"*({"id":"f","my_inner":{"a":"b","z":null},"my_list":[{"q":"w"}],"x":1,"y":[true]})*", json);
+
+    ForwardingMessage parsed;
+    forwardingmessage_parser_config_s config;
+    config.captureUnknownKeys = true;
+    auto state = forwardingmessage_parser_init(parsed, config);
+    ASSERT_EQ(0, forwardingmessage_parser_on_chunk(state, const_cast<char *>(json.data()), json.size()));
+    ASSERT_EQ(0, forwardingmessage_parser_complete(state));
+    forwardingmessage_parser_free(state);
+    ASSERT_EQ(msg.SerializeAsString(), parsed.SerializeAsString());
+}
+
+} // namespace test
+} // namespace protog
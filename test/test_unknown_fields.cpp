@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include "messages.pb.h"
+#include "collidingkeymessage_parser.pb.h"
+#include "forwardingmessage_parser.pb.h"
+#include "nestedmessage_parser.pb.h"
+#include "simplemessage_parser.pb.h"
+
+namespace protog {
+namespace test {
+
+static void parse_forwarding(ForwardingMessage &msg, const std::string &json, size_t chunkLen) {
+    forwardingmessage_parser_config_s config;
+    config.captureUnknownKeys = true;
+    auto state = forwardingmessage_parser_init(msg, config);
+    for (size_t i = 0; i < json.size(); i += chunkLen) {
+        const auto len = std::min(chunkLen, json.size() - i);
+        ASSERT_EQ(0, forwardingmessage_parser_on_chunk(state, const_cast<char *>(json.data() + i), len));
+    }
+    ASSERT_EQ(0, forwardingmessage_parser_complete(state));
+    forwardingmessage_parser_free(state);
+}
+
+TEST(unknown_fields, should_fail_on_unknown_key_by_default) {
+    try {
+        simplemessage_parser_easy(R"*({ "foo": 1 })*");
+        FAIL() << "unknown key accepted";
+    } catch (const std::runtime_error &e) {
+        ASSERT_STREQ("Invalid key in .", e.what());
+    }
+}
+
+TEST(unknown_fields, should_not_match_keys_by_hash_alone) {
+    std::string json = R"*({ "kjno4jlnx4uo5e": 1, "kfstjyc54fk41m": 2 })*";
+    CollidingKeyMessage msg;
+    collidingkeymessage_parser_config_s config;
+    config.ignoreUnknownKeys = true;
+    auto state = collidingkeymessage_parser_init(msg, config);
+    ASSERT_EQ(0, collidingkeymessage_parser_on_chunk(state, &json[0], json.size()));
+    ASSERT_EQ(0, collidingkeymessage_parser_complete(state));
+    ASSERT_EQ(2, msg.kfstjyc54fk41m());
+    collidingkeymessage_parser_free(state);
+
+    try {
+        collidingkeymessage_parser_easy(R"*({ "kjno4jlnx4uo5e": 1 })*");
+        FAIL() << "colliding key accepted";
+    } catch (const std::runtime_error &e) {
+        ASSERT_STREQ("Invalid key in .", e.what());
+    }
+}
+
+TEST(unknown_fields, should_skip_unknown_keys) {
+    const std::string json = R"*({ "foo": { "id": "bar", "x": [1, { "y": null }] }, "id": "foo", "bar": [], "my_int32": 42 })*";
+    SimpleMessage msg;
+    simplemessage_parser_config_s config;
+    config.ignoreUnknownKeys = true;
+    auto state = simplemessage_parser_init(msg, config);
+    ASSERT_EQ(0, simplemessage_parser_on_chunk(state, const_cast<char *>(json.data()), json.size()));
+    ASSERT_EQ(0, simplemessage_parser_complete(state));
+    simplemessage_parser_free(state);
+    ASSERT_EQ("foo", msg.id());
+    ASSERT_EQ(42, msg.my_int32());
+}
+
+TEST(unknown_fields, should_capture_unknown_keys_into_field) {
+    const std::string json = R"*({ "id": "foo", "extra": {"a": [1, 2, {"b": null}]},
+        "my_inner": { "a": "bar", "z" : true }, "n": 1.5, "s": "x\"y", "my_list": [{ "q": "w" }] })*";
+    ForwardingMessage msg;
+    parse_forwarding(msg, json, json.size());
+    ASSERT_EQ("foo", msg.id());
+    ASSERT_EQ(R"*("extra":{"a": [1, 2, {"b": null}]},"n":1.5,"s":"x\"y")*", msg.unknown_json());
+    ASSERT_EQ("bar", msg.my_inner().a());
+    ASSERT_EQ(R"*("z":true)*", msg.my_inner().unknown_json());
+    ASSERT_EQ(1, msg.my_list_size());
+    ASSERT_EQ(R"*("q":"w")*", msg.my_list(0).unknown_json());
+}
+
+TEST(unknown_fields, should_capture_unknown_keys_across_chunks) {
+    const std::string json = R"*({ "n": 12345, "extra": {"a": [1, 2]}, "my_inner": { "z": "long value" }, "id": "foo" })*";
+    for (size_t chunkLen = 1; chunkLen < 8; ++chunkLen) {
+        ForwardingMessage msg;
+        parse_forwarding(msg, json, chunkLen);
+        ASSERT_EQ("foo", msg.id());
+        ASSERT_EQ(R"*("n":12345,"extra":{"a": [1, 2]})*", msg.unknown_json());
+        ASSERT_EQ(R"*("z":"long value")*", msg.my_inner().unknown_json());
+    }
+}
+
+TEST(unknown_fields, should_pass_unknown_keys_to_callback) {
+    const std::string json = R"*({ "id": "foo", "bar": [true, false] })*";
+    SimpleMessage msg;
+    std::vector<std::string> captured;
+    simplemessage_parser_config_s config;
+    config.captureUnknownKeys = true;
+    config.unknownKeyCtx = &captured;
+    config.unknownKeyCallback = [](void *ctx, ::google::protobuf::Message *msg, const char *json, size_t jsonLen) {
+        static_cast<std::vector<std::string> *>(ctx)->emplace_back(json, jsonLen);
+    };
+    auto state = simplemessage_parser_init(msg, config);
+    ASSERT_EQ(0, simplemessage_parser_on_chunk(state, const_cast<char *>(json.data()), json.size()));
+    ASSERT_EQ(0, simplemessage_parser_complete(state));
+    simplemessage_parser_free(state);
+    ASSERT_EQ("foo", msg.id());
+    ASSERT_EQ(1u, captured.size());
+    ASSERT_EQ(R"*("bar":[true, false])*", captured[0]);
+}
+
+TEST(unknown_fields, should_pass_the_enclosing_message_to_callback) {
+    const std::string json = R"*({"x": 1, "my_inner": {"y": 2}, "my_list": [{"a": "0"}, {"z": 3}]})*";
+    NestedMessage msg;
+    std::vector<std::pair<const ::google::protobuf::Message *, std::string>> captured;
+    nestedmessage_parser_config_s config;
+    config.captureUnknownKeys = true;
+    config.unknownKeyCtx = &captured;
+    config.unknownKeyCallback = [](void *ctx, ::google::protobuf::Message *msg, const char *json, size_t jsonLen) {
+        static_cast<std::vector<std::pair<const ::google::protobuf::Message *, std::string>> *>(ctx)->emplace_back(
+                msg, std::string(json, jsonLen));
+    };
+    auto state = nestedmessage_parser_init(msg, config);
+    ASSERT_EQ(0, nestedmessage_parser_on_chunk(state, const_cast<char *>(json.data()), json.size()));
+    ASSERT_EQ(0, nestedmessage_parser_complete(state));
+    nestedmessage_parser_free(state);
+    ASSERT_EQ(3u, captured.size());
+    ASSERT_EQ(&msg, captured[0].first);
+    ASSERT_EQ(R"*("x":1)*", captured[0].second);
+    ASSERT_EQ(&msg.my_inner(), captured[1].first);
+    ASSERT_EQ(R"*("y":2)*", captured[1].second);
+    ASSERT_EQ(&msg.my_list(1), captured[2].first);
+    ASSERT_EQ(R"*("z":3)*", captured[2].second);
+    ASSERT_EQ("0", msg.my_list(0).a());
+}
+
+} // namespace test
+} // namespace protog